@@ -0,0 +1,189 @@
+/* bench.h: shared helpers for allocator benchmarks */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Static Builds
+ *
+ * Built against libmalloc.a (-DMALLOC_STATIC), fragmentation is read from the
+ * linked allocator directly; with -DMALLOC_FAST as well, the workloads
+ * allocate and free through the inline fast path instead of calling malloc
+ * and free.
+ **/
+
+#ifdef MALLOC_STATIC
+double internal_fragmentation();
+double external_fragmentation();
+#endif
+
+#ifdef MALLOC_FAST
+#include "malloc/fast.h"
+#define malloc(size)    malloc_fast(size)
+#define free(ptr)       free_fast(ptr)
+#endif
+
+/* Hardware Events */
+
+typedef struct {
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+} Event;
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* Functions */
+
+static inline double bench_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Small, fast per-thread generator (PCG-style LCG step, high bits out) */
+static inline uint32_t bench_random(uint64_t *seed) {
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*seed >> 33);
+}
+
+static inline void bench_run(size_t nthreads, void *(*worker)(void *), void **args) {
+    pthread_t threads[nthreads];
+    for (size_t t = 0; t < nthreads; t++) {
+        pthread_create(&threads[t], NULL, worker, args ? args[t] : (void *)(t + 1));
+    }
+    for (size_t t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/* Open and start a user space counter for the calling thread (-1 if refused) */
+static inline int perf_open(const Event *event) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = event->type;
+    attr.config         = event->config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return fd;
+}
+
+/* Stop counter and read it, scaling for time it was multiplexed off the PMU
+ * (-1 if unavailable) */
+static inline double perf_read(int fd) {
+    uint64_t values[3];
+    if (fd < 0) {
+        return -1.0;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, values, sizeof(values)) != sizeof(values) || !values[2]) {
+        return -1.0;
+    }
+    return (double)values[0] * values[1] / values[2];
+}
+
+/**
+ * Print one machine readable result row:
+ *
+ *  NAME THREADS OPS/SEC PEAK_RSS_KB INTERNAL% EXTERNAL%
+ *
+ * Fragmentation comes from the preloaded (or linked) allocator when it
+ * exports the functions (otherwise "-", as with glibc).
+ **/
+static inline void bench_report(const char *name, size_t nthreads, double ops, double seconds) {
+    typedef double (*Fragmentation)();
+#ifdef MALLOC_STATIC
+    Fragmentation internal = internal_fragmentation;
+    Fragmentation external = external_fragmentation;
+#else
+    Fragmentation internal = (Fragmentation)dlsym(RTLD_DEFAULT, "internal_fragmentation");
+    Fragmentation external = (Fragmentation)dlsym(RTLD_DEFAULT, "external_fragmentation");
+#endif
+    struct rusage usage;
+    char          fragmentation[64] = "- -";
+
+    getrusage(RUSAGE_SELF, &usage);
+    if (internal && external) {
+        snprintf(fragmentation, sizeof(fragmentation), "%.2lf %.2lf", internal(), external());
+    }
+
+    printf("%s %lu %.0lf %ld %s\n", name, nthreads, ops / seconds, usage.ru_maxrss, fragmentation);
+    fflush(stdout);
+}
+
+/* Cache line of an address (64 byte lines) */
+static inline uintptr_t bench_line(const void *ptr) {
+    return (uintptr_t)ptr >> 6;
+}
+
+static inline int bench_line_compare(const void *a, const void *b) {
+    const uintptr_t *x = a, *y = b;
+    return x[0] != y[0] ? (x[0] < y[0] ? -1 : 1) : (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+/**
+ * Print how many of the cache lines the workers wrote to were written by more
+ * than one worker:
+ *
+ *  NAME shared-lines SHARED TOTAL
+ *
+ * Unlike the timing, this shows false sharing even when the workers did not
+ * run in parallel.  lines[t] holds the n lines worker t wrote to.
+ **/
+static inline void bench_report_lines(const char *name, uintptr_t **lines, size_t nthreads, size_t n) {
+    uintptr_t (*pairs)[2] = calloc(nthreads * n, sizeof(*pairs));
+    size_t    shared = 0, total = 0;
+
+    for (size_t t = 0; t < nthreads; t++) {
+        for (size_t i = 0; i < n; i++) {
+            pairs[t * n + i][0] = lines[t][i];
+            pairs[t * n + i][1] = t;
+        }
+    }
+    qsort(pairs, nthreads * n, sizeof(*pairs), bench_line_compare);
+
+    for (size_t i = 0; i < nthreads * n; ) {
+        size_t j = i + 1;
+        bool   mixed = false;
+        while (j < nthreads * n && pairs[j][0] == pairs[i][0]) {
+            mixed |= pairs[j][1] != pairs[i][1];
+            j++;
+        }
+        shared += mixed;
+        total++;
+        i = j;
+    }
+
+    printf("%s shared-lines %lu %lu\n", name, shared, total);
+    fflush(stdout);
+    free(pairs);
+}
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
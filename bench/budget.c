@@ -0,0 +1,74 @@
+/* budget.c: Cache under a memory budget
+ *
+ * Fills a cache of random sized entries that, left alone, keeps growing.
+ * When the allocator has malloc_register_pressure (see budget.h), the cache
+ * registers a callback that evicts its oldest half, so with MALLOC_BUDGET_SOFT
+ * set the heap should level off near the soft limit instead.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define ENTRIES     (1<<18)
+#define MIN_SIZE    64
+#define MAX_SIZE    4096
+
+/* Globals */
+
+void *  Cache[ENTRIES];
+size_t  Oldest    = 0;	    /* Oldest entry still cached */
+size_t  Newest    = 0;	    /* Next entry to insert */
+size_t  Pressures = 0;
+size_t  Evictions = 0;
+
+/* Functions */
+
+void evict(size_t used, size_t limit, void *arg) {
+    size_t target = Oldest + (Newest - Oldest) / 2;
+
+    Pressures++;
+    while (Oldest < target) {
+        free(Cache[Oldest % ENTRIES]);
+        Cache[Oldest++ % ENTRIES] = NULL;
+        Evictions++;
+    }
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    typedef int (*Register)(void (*)(size_t, size_t, void *), void *);
+    Register reg   = (Register)dlsym(RTLD_DEFAULT, "malloc_register_pressure");
+    size_t   total = argc > 1 ? strtoul(argv[1], NULL, 10) : ENTRIES;
+    size_t   fails = 0;
+    uint64_t seed  = 1;
+
+    if (reg) {
+        reg(evict, NULL);
+    }
+
+    double start = bench_now();
+    for (size_t i = 0; i < total; i++) {
+        size_t size  = MIN_SIZE + bench_random(&seed) % (MAX_SIZE - MIN_SIZE);
+        void * entry = malloc(size);
+        if (!entry) {
+            fails++;
+            continue;
+        }
+        memset(entry, (int)i, size);
+
+        // Entries past the ring (or failed) are dropped oldest first
+        if (Newest - Oldest == ENTRIES) {
+            free(Cache[Oldest++ % ENTRIES]);
+        }
+        Cache[Newest++ % ENTRIES] = entry;
+    }
+    double seconds = bench_now() - start;
+
+    printf("budget pressures=%lu evictions=%lu failures=%lu cached=%lu\n", Pressures, Evictions, fails, Newest - Oldest);
+    bench_report("budget", 1, total, seconds);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,68 @@
+/* cache_scratch.c: Passive false sharing
+ *
+ * The main thread allocates one small object per worker back to back, so they
+ * likely share cache lines.  Each worker frees its object and then repeatedly
+ * allocates, writes and frees small objects of the same size.  An allocator
+ * that hands the freed neighbours back out to different threads makes those
+ * writes fight over the same cache lines.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define THREADS     1
+#define ITERATIONS  (1<<16)
+#define OBJECT_SIZE 8
+#define WRITES      64
+
+/* Globals */
+
+size_t      Iterations = ITERATIONS;
+uintptr_t **Lines      = NULL;	/* Cache line of each object, per worker */
+
+/* Threads */
+
+void *worker(void *arg) {
+    uintptr_t *lines = Lines[*(size_t *)arg];
+    free(arg);
+
+    for (size_t i = 0; i < Iterations; i++) {
+        char * volatile object = malloc(OBJECT_SIZE);
+        for (size_t w = 0; w < WRITES; w++) {
+            object[w % OBJECT_SIZE]++;
+        }
+        lines[i] = bench_line(object);
+        free(object);
+    }
+
+    return NULL;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS;
+    Iterations      = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+
+    void *args[nthreads];
+    for (size_t t = 0; t < nthreads; t++) {
+        args[t] = malloc(OBJECT_SIZE);
+        *(size_t *)args[t] = t;
+    }
+
+    Lines = calloc(nthreads, sizeof(uintptr_t *));
+    for (size_t t = 0; t < nthreads; t++) {
+        Lines[t] = calloc(Iterations, sizeof(uintptr_t));
+    }
+
+    double start = bench_now();
+    bench_run(nthreads, worker, args);
+    double seconds = bench_now() - start;
+
+    bench_report("cache-scratch", nthreads, 2.0 * nthreads * Iterations, seconds);
+    bench_report_lines("cache-scratch", Lines, nthreads, Iterations);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
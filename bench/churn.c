@@ -0,0 +1,58 @@
+/* churn.c: Random size churn
+ *
+ * Each worker keeps a live set of objects with sizes spread over a wide range
+ * and replaces random members, which exercises splitting, merging and the free
+ * list search far more than fixed size workloads do.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define THREADS     1
+#define ITERATIONS  (1<<16)
+#define SLOTS       2048
+#define MAX_SIZE    4096
+
+/* Globals */
+
+size_t Iterations = ITERATIONS;
+
+/* Threads */
+
+void *worker(void *arg) {
+    uint64_t seed = (uint64_t)arg;
+    void *   slots[SLOTS] = {NULL};
+
+    for (size_t i = 0; i < Iterations; i++) {
+        size_t slot = bench_random(&seed) % SLOTS;
+        /* Skew towards small sizes: pick a power of two range, then a size */
+        size_t range = 1UL << (4 + bench_random(&seed) % 9);
+        size_t size  = 1 + bench_random(&seed) % (range < MAX_SIZE ? range : MAX_SIZE);
+        free(slots[slot]);
+        slots[slot] = malloc(size);
+        memset(slots[slot], (int)i, size < 64 ? size : 64);
+    }
+
+    for (size_t s = 0; s < SLOTS; s++) {
+        free(slots[s]);
+    }
+
+    return NULL;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS;
+    Iterations      = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+
+    double start = bench_now();
+    bench_run(nthreads, worker, NULL);
+    double seconds = bench_now() - start;
+
+    bench_report("churn", nthreads, 2.0 * nthreads * Iterations, seconds);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
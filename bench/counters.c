@@ -0,0 +1,58 @@
+/* counters.c: measure accounting overhead on the malloc/free fast path */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Constants */
+
+#define THREADS     1
+#define ITERATIONS  (1<<20)
+
+/* Globals */
+
+size_t Iterations = ITERATIONS;
+
+/* Threads */
+
+void *worker(void *arg) {
+    size_t seed = (size_t)arg;
+
+    for (size_t i = 0; i < Iterations; i++) {
+        seed   = seed * 6364136223846793005UL + 1442695040888963407UL;
+        // Volatile keeps the compiler from eliding the malloc/free pair
+        char * volatile p = malloc(16 + ((seed >> 33) & 255));
+        p[0]   = (char)i;
+        free(p);
+    }
+
+    return NULL;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS;
+    Iterations      = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+
+    pthread_t       threads[nthreads];
+    struct timespec start, stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t t = 0; t < nthreads; t++) {
+        pthread_create(&threads[t], NULL, worker, (void *)(t + 1));
+    }
+    for (size_t t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    double ops     = 2.0 * nthreads * Iterations;
+    printf("counters %lu %.0lf %.2lf\n", nthreads, ops / seconds, seconds * 1e9 / ops);
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
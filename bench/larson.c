@@ -0,0 +1,78 @@
+/* larson.c: Larson server simulation
+ *
+ * Each thread owns a set of slots and repeatedly replaces a random slot with a
+ * new random sized object.  At the end of each round the slots are handed to
+ * a fresh thread, as a server hands connections to new workers, so objects are
+ * routinely freed by a different thread than the one that allocated them.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define THREADS     1
+#define ITERATIONS  (1<<16)
+#define ROUNDS      4
+#define SLOTS       1000
+#define MIN_SIZE    16
+#define MAX_SIZE    256
+
+/* Globals */
+
+size_t Iterations = ITERATIONS;
+
+typedef struct {
+    void *      slots[SLOTS];
+    uint64_t    seed;
+} Arena;
+
+/* Threads */
+
+void *worker(void *arg) {
+    Arena *arena = arg;
+
+    for (size_t i = 0; i < Iterations; i++) {
+        size_t slot = bench_random(&arena->seed) % SLOTS;
+        size_t size = MIN_SIZE + bench_random(&arena->seed) % (MAX_SIZE - MIN_SIZE);
+        free(arena->slots[slot]);
+        arena->slots[slot] = malloc(size);
+        ((char *)arena->slots[slot])[0] = (char)i;
+    }
+
+    return NULL;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS;
+    Iterations      = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+
+    Arena *arenas = calloc(nthreads, sizeof(Arena));
+    void  *args[nthreads];
+    for (size_t t = 0; t < nthreads; t++) {
+        arenas[t].seed = t + 1;
+        for (size_t s = 0; s < SLOTS; s++) {
+            arenas[t].slots[s] = malloc(MIN_SIZE + bench_random(&arenas[t].seed) % (MAX_SIZE - MIN_SIZE));
+        }
+        args[t] = &arenas[t];
+    }
+
+    double start = bench_now();
+    for (size_t round = 0; round < ROUNDS; round++) {
+        bench_run(nthreads, worker, args);
+    }
+    double seconds = bench_now() - start;
+
+    bench_report("larson", nthreads, 2.0 * ROUNDS * nthreads * Iterations, seconds);
+
+    for (size_t t = 0; t < nthreads; t++) {
+        for (size_t s = 0; s < SLOTS; s++) {
+            free(arenas[t].slots[s]);
+        }
+    }
+    free(arenas);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
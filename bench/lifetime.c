@@ -0,0 +1,61 @@
+/* lifetime.c: Mixed lifetime workload
+ *
+ * Each round allocates a burst of short-lived request buffers and a few
+ * long-lived session objects, then frees the request buffers.  Sessions are
+ * never freed (as with caches and connection tables that live until exit), so
+ * an allocator that places them between request buffers strands the holes
+ * around them.  Record it with MALLOC_TRACE and compare bin/replay with and
+ * without MALLOC_LIFETIME.
+ *
+ * Sessions and request buffers fall in different size classes, because a
+ * replayed trace has no call sites and prediction falls back to size class.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define ROUNDS      2048
+#define BURST       256
+#define SESSIONS    4
+
+/* Functions */
+
+__attribute__((noinline)) void *request_buffer(uint64_t *seed) {
+    return malloc(160 + bench_random(seed) % 864);
+}
+
+__attribute__((noinline)) void *session_object(uint64_t *seed) {
+    return malloc(96 + bench_random(seed) % 32);
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t   rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : ROUNDS;
+    uint64_t seed   = 1;
+    void *   requests[BURST];
+    void *   session = NULL;
+
+    double start = bench_now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t b = 0; b < BURST; b++) {
+            requests[b] = request_buffer(&seed);
+            if (b % (BURST / SESSIONS) == 0) {
+                /* Chain sessions so they stay reachable */
+                void **next = session_object(&seed);
+                *next   = session;
+                session = next;
+            }
+        }
+        for (size_t b = 0; b < BURST; b++) {
+            free(requests[b]);
+        }
+    }
+    double seconds = bench_now() - start;
+
+    bench_report("lifetime", 1, (double)rounds * (2 * BURST + SESSIONS), seconds);
+    return session ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,106 @@
+/* perf.c: hardware performance counters around malloc/free loops
+ *
+ * Runs a replace-random-slot loop for several size distributions and reports
+ * per-operation cycles, instructions, L1D/LLC/dTLB read misses and branch
+ * misses from perf_event_open.  Counters the kernel (or a container) refuses
+ * are reported as "-" rather than failing the run.  Counts cover user space
+ * only, and include the few instructions of the loop itself.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define ITERATIONS  (1<<16)
+#define SLOTS       4096
+
+/* Events */
+
+Event Events[] = {
+    {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d-misses",    PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"llc-misses",    PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dtlb-misses",   PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+#define NEVENTS (sizeof(Events) / sizeof(Events[0]))
+
+/* Size Distributions */
+
+typedef struct {
+    const char *name;
+    size_t      min;
+    size_t      max;
+} Distribution;
+
+Distribution Distributions[] = {
+    {"fixed-16",   16,   16},
+    {"small",      16,   256},
+    {"mixed",      16,   4096},
+    {"large",      4096, 65536},
+};
+
+#define NDISTRIBUTIONS (sizeof(Distributions) / sizeof(Distributions[0]))
+
+/* Functions */
+
+size_t distribution_size(const Distribution *d, uint64_t *seed) {
+    return d->min + (d->max > d->min ? bench_random(seed) % (d->max - d->min + 1) : 0);
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : ITERATIONS;
+    void * slots[SLOTS];
+
+    for (size_t d = 0; d < NDISTRIBUTIONS; d++) {
+        const Distribution *distribution = &Distributions[d];
+        uint64_t seed = d + 1;
+        int      fds[NEVENTS];
+
+        for (size_t s = 0; s < SLOTS; s++) {
+            slots[s] = malloc(distribution_size(distribution, &seed));
+        }
+
+        for (size_t e = 0; e < NEVENTS; e++) {
+            fds[e] = perf_open(&Events[e]);
+        }
+
+        double start = bench_now();
+        for (size_t i = 0; i < iterations; i++) {
+            size_t slot = bench_random(&seed) % SLOTS;
+            free(slots[slot]);
+            slots[slot] = malloc(distribution_size(distribution, &seed));
+            *(char * volatile)slots[slot] = (char)i;
+        }
+        double seconds = bench_now() - start;
+
+        /* One row per distribution: perf NAME ns/op then each event per op */
+        double ops = 2.0 * iterations;
+        printf("perf %s %.2lf", distribution->name, seconds * 1e9 / ops);
+        for (size_t e = 0; e < NEVENTS; e++) {
+            double count = perf_read(fds[e]);
+            if (count < 0) {
+                printf(" -");
+            } else {
+                printf(" %.3lf", count / ops);
+            }
+            if (fds[e] >= 0) {
+                close(fds[e]);
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+
+        for (size_t s = 0; s < SLOTS; s++) {
+            free(slots[s]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,99 @@
+/* persist.c: Warm restart of a cache kept in a persistent heap
+ *
+ * The first run (with MALLOC_PERSIST set and an empty heap file) builds a
+ * hash table of NODES entries and stores it as the persistent root.  Later
+ * runs find the root again and verify every entry instead of rebuilding, so
+ * comparing the two runs shows what a restart saves.  The allocator's
+ * persist_root and persist_set_root are found with dlsym, so this also runs
+ * (always rebuilding) under other allocators.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define NODES       (1<<20)
+#define BUCKETS     (1<<16)
+
+/* Structures */
+
+typedef struct entry Entry;
+struct entry {
+    Entry *     next;
+    uint64_t    key;
+    uint64_t    value;
+    char        payload[40];
+};
+
+typedef struct {
+    size_t      nodes;
+    Entry *     buckets[BUCKETS];
+} Cache;
+
+/* Functions */
+
+Cache * cache_build(size_t nodes) {
+    Cache *cache = malloc(sizeof(Cache));
+    memset(cache, 0, sizeof(Cache));
+    cache->nodes = nodes;
+
+    uint64_t seed = 1;
+    for (size_t n = 0; n < nodes; n++) {
+        Entry *entry = malloc(sizeof(Entry));
+        entry->key   = ((uint64_t)bench_random(&seed) << 32) | n;
+        entry->value = entry->key * 0x9E3779B97F4A7C15ULL;
+        memset(entry->payload, (int)n, sizeof(entry->payload));
+
+        Entry **bucket = &cache->buckets[entry->key % BUCKETS];
+        entry->next = *bucket;
+        *bucket     = entry;
+    }
+    return cache;
+}
+
+size_t  cache_verify(const Cache *cache) {
+    size_t count = 0;
+    for (size_t b = 0; b < BUCKETS; b++) {
+        for (const Entry *entry = cache->buckets[b]; entry; entry = entry->next) {
+            if (entry->value != entry->key * 0x9E3779B97F4A7C15ULL || entry->key % BUCKETS != b) {
+                return 0;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nodes = argc > 1 ? strtoul(argv[1], NULL, 10) : NODES;
+
+    void *(*root)()        = (void *(*)())dlsym(RTLD_DEFAULT, "persist_root");
+    void  (*set_root)(void *) = (void (*)(void *))dlsym(RTLD_DEFAULT, "persist_set_root");
+
+    /* The first allocation attaches the heap */
+    double start = bench_now();
+    void * volatile first = malloc(1);
+    free(first);
+    Cache *cache = root ? root() : NULL;
+    double attached = bench_now();
+
+    if (cache) {
+        size_t count = cache_verify(cache);
+        double verified = bench_now();
+        printf("reattach:  %8.3lf ms\n", (attached - start) * 1000.0);
+        printf("verify:    %8.3lf ms (%lu of %lu entries)\n", (verified - attached) * 1000.0, count, cache->nodes);
+        return count == cache->nodes ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    cache = cache_build(nodes);
+    double built = bench_now();
+    if (set_root) {
+        set_root(cache);
+    }
+    printf("build:     %8.3lf ms (%lu entries)\n", (built - attached) * 1000.0, nodes);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
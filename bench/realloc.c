@@ -0,0 +1,71 @@
+/* realloc.c: Realloc growth
+ *
+ * Each worker grows a set of buffers a little at a time (as string builders
+ * and vectors do) and checks that realloc preserved their contents.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define THREADS     1
+#define ITERATIONS  (1<<12)
+#define BUFFERS     16
+#define STEP        64
+#define MAX_SIZE    (1<<14)
+
+/* Globals */
+
+size_t Iterations = ITERATIONS;
+
+/* Threads */
+
+void *worker(void *arg) {
+    uint64_t seed = (uint64_t)arg;
+    char *   buffers[BUFFERS] = {NULL};
+    size_t   sizes[BUFFERS]   = {0};
+
+    for (size_t i = 0; i < Iterations; i++) {
+        size_t b = bench_random(&seed) % BUFFERS;
+        size_t n = sizes[b] + STEP;
+
+        if (n > MAX_SIZE) {
+            free(buffers[b]);
+            buffers[b] = NULL;
+            sizes[b]   = 0;
+            continue;
+        }
+
+        buffers[b] = realloc(buffers[b], n);
+        if (sizes[b] && buffers[b][sizes[b] - 1] != (char)(sizes[b] - 1)) {
+            fprintf(stderr, "realloc lost contents of buffer %lu\n", b);
+            exit(EXIT_FAILURE);
+        }
+        for (size_t c = sizes[b]; c < n; c++) {
+            buffers[b][c] = (char)c;
+        }
+        sizes[b] = n;
+    }
+
+    for (size_t b = 0; b < BUFFERS; b++) {
+        free(buffers[b]);
+    }
+
+    return NULL;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS;
+    Iterations      = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+
+    double start = bench_now();
+    bench_run(nthreads, worker, NULL);
+    double seconds = bench_now() - start;
+
+    bench_report("realloc", nthreads, (double)nthreads * Iterations, seconds);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,96 @@
+/* tlb.c: random access over a large heap
+ *
+ * Fills MEGABYTES of heap with random sized objects, then reads and writes
+ * random offsets in random objects.  With 4 KB pages nearly every access
+ * misses the dTLB; with the heap in transparent huge pages (MALLOC_HUGEPAGE=1)
+ * far fewer do.  Reports allocation throughput, ns and dTLB misses per access,
+ * and how much of the heap ended up in huge pages (AnonHugePages).
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define MEGABYTES   2048
+#define ACCESSES    (1<<24)
+#define MIN_SIZE    64
+#define MAX_SIZE    4096
+
+/* Functions */
+
+long anon_huge_kb() {
+    char  line[256];
+    long  kb = -1;
+    FILE *fs = fopen("/proc/self/smaps_rollup", "r");
+    if (!fs) {
+        return kb;
+    }
+    while (fgets(line, sizeof(line), fs)) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(fs);
+    return kb;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t megabytes = argc > 1 ? strtoul(argv[1], NULL, 10) : MEGABYTES;
+    size_t accesses  = argc > 2 ? strtoul(argv[2], NULL, 10) : ACCESSES;
+    size_t total     = megabytes << 20;
+    size_t capacity  = total / MIN_SIZE + 1;
+    uint64_t seed    = 1;
+
+    char  **objects  = malloc(capacity * sizeof(char *));
+    size_t *sizes    = malloc(capacity * sizeof(size_t));
+    size_t  nobjects = 0;
+
+    /* Fill heap */
+    double start = bench_now();
+    for (size_t used = 0; used < total; used += sizes[nobjects++]) {
+        sizes[nobjects]   = MIN_SIZE + bench_random(&seed) % (MAX_SIZE - MIN_SIZE);
+        objects[nobjects] = malloc(sizes[nobjects]);
+        if (!objects[nobjects]) {
+            fprintf(stderr, "out of memory after %lu objects\n", nobjects);
+            return EXIT_FAILURE;
+        }
+        memset(objects[nobjects], 0, sizes[nobjects]);
+    }
+    double fill = bench_now() - start;
+
+    /* Random access */
+    Event event = {"dtlb-misses", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)};
+    int   fd    = perf_open(&event);
+    uint64_t sum = 0;
+
+    start = bench_now();
+    for (size_t i = 0; i < accesses; i++) {
+        size_t o = bench_random(&seed) % nobjects;
+        char  *p = objects[o] + bench_random(&seed) % sizes[o];
+        sum += *p;
+        *p   = (char)i;
+    }
+    double access = bench_now() - start;
+    double misses = perf_read(fd);
+
+    /* Row: tlb MEGABYTES ALLOCS/SEC NS/ACCESS DTLB/ACCESS ANON_HUGE_KB */
+    printf("tlb %lu %.0lf %.2lf ", megabytes, nobjects / fill, access * 1e9 / accesses);
+    if (misses < 0) {
+        printf("-");
+    } else {
+        printf("%.3lf", misses / accesses);
+    }
+    printf(" %ld\n", anon_huge_kb());
+    fflush(stdout);
+
+    for (size_t o = 0; o < nobjects; o++) {
+        free(objects[o]);
+    }
+    free(objects);
+    free(sizes);
+    return sum == 42 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
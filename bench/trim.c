@@ -0,0 +1,81 @@
+/* trim.c: Giving memory back at a quiet point
+ *
+ * Fills a cache of random sized entries, then drops all but one in every
+ * KEEP of them (the odd entries first, then the even ones, so many freed
+ * blocks land between two free neighbours) and trims the heap, the way a
+ * service would after flushing a cache.  Reports resident memory before and
+ * after the trim, using malloc_release (which returns the bytes released)
+ * when the allocator has it and malloc_trim (as in glibc) otherwise.
+ **/
+
+#include "bench.h"
+
+/* Constants */
+
+#define ENTRIES     (1<<16)
+#define MIN_SIZE    64
+#define MAX_SIZE    4096
+#define KEEP        64
+
+/* Globals */
+
+void *  Cache[ENTRIES];
+
+/* Functions */
+
+/* Resident memory of the process in KB */
+size_t resident() {
+    size_t pages = 0, rss = 0;
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &pages, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(statm);
+    }
+    return rss * (getpagesize() / 1024);
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    typedef size_t (*Release)(size_t);
+    typedef int    (*Trim)(size_t);
+    Release release = (Release)dlsym(RTLD_DEFAULT, "malloc_release");
+    Trim    trim    = (Trim)dlsym(RTLD_DEFAULT, "malloc_trim");
+    size_t  total   = argc > 1 ? strtoul(argv[1], NULL, 10) : ENTRIES;
+    uint64_t seed   = 1;
+
+    total = total > ENTRIES ? ENTRIES : total;
+    for (size_t i = 0; i < total; i++) {
+        size_t size = MIN_SIZE + bench_random(&seed) % (MAX_SIZE - MIN_SIZE);
+        Cache[i] = malloc(size);
+        memset(Cache[i], (int)i, size);
+    }
+
+    for (size_t parity = 1; parity <= 2; parity++) {
+        for (size_t i = parity % 2; i < total; i += 2) {
+            if (i % KEEP) {
+                free(Cache[i]);
+                Cache[i] = NULL;
+            }
+        }
+    }
+
+    size_t before   = resident();
+    size_t released = 0;
+    double start    = bench_now();
+    if (release) {
+        released = release(0);
+    } else if (trim) {
+        trim(0);
+    }
+    double seconds = bench_now() - start;
+    size_t after   = resident();
+
+    printf("trim rss_before=%lu rss_after=%lu released=%lu seconds=%.6lf\n", before, after, released, seconds);
+    bench_report("trim", 1, total, seconds);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,96 @@
+/* xmalloc.c: Producer/consumer allocation
+ *
+ * Threads are paired: producers allocate objects and pass them through a
+ * single-producer/single-consumer ring to consumers, which free them.  Every
+ * object is therefore freed by a thread other than the one that allocated it.
+ **/
+
+#include "bench.h"
+
+#include <sched.h>
+
+/* Constants */
+
+#define THREADS     2
+#define ITERATIONS  (1<<18)
+#define RING        1024
+#define MAX_RINGS   64
+#define MIN_SIZE    16
+#define MAX_SIZE    512
+
+/* Globals */
+
+size_t Iterations = ITERATIONS;
+
+typedef struct {
+    void *      objects[RING];
+    size_t      head;			/* Next slot producer writes */
+    size_t      tail;			/* Next slot consumer reads */
+    uint64_t    seed;
+} __attribute__((aligned(64))) Ring;
+
+Ring   Rings[MAX_RINGS];
+
+/* Threads */
+
+void *producer(void *arg) {
+    Ring *ring = arg;
+
+    for (size_t i = 0; i < Iterations; i++) {
+        char *object = malloc(MIN_SIZE + bench_random(&ring->seed) % (MAX_SIZE - MIN_SIZE));
+        object[0] = (char)i;
+        while (i - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RING) {
+            sched_yield();
+        }
+        ring->objects[i % RING] = object;
+        __atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void *consumer(void *arg) {
+    Ring *ring = arg;
+
+    for (size_t i = 0; i < Iterations; i++) {
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= i) {
+            sched_yield();
+        }
+        free(ring->objects[i % RING]);
+        __atomic_store_n(&ring->tail, i + 1, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void *worker(void *arg) {
+    size_t t = (size_t)arg;
+    return (t % 2 ? producer : consumer)(&Rings[t / 2]);
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nthreads = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS;
+    Iterations      = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+
+    nthreads = nthreads < 2 ? 2 : nthreads & ~1UL;
+    nthreads = nthreads > 2 * MAX_RINGS ? 2 * MAX_RINGS : nthreads;
+    for (size_t r = 0; r < nthreads / 2; r++) {
+        Rings[r].seed = r + 1;
+    }
+
+    void *args[nthreads];
+    for (size_t t = 0; t < nthreads; t++) {
+        args[t] = (void *)t;
+    }
+
+    double start = bench_now();
+    bench_run(nthreads, worker, args);
+    double seconds = bench_now() - start;
+
+    bench_report("xmalloc", nthreads, (double)nthreads * Iterations, seconds);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Fill an evicting cache with no budget, a soft limit, and a hard limit, and
+# compare how far the heap grows.
+
+# Functions
+
+bench-budget() {
+    soft=$1
+    hard=$2
+    env MALLOC_BUDGET_SOFT=$soft MALLOC_BUDGET_HARD=$hard LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_budget 2> /dev/null | \
+        awk -v soft=${soft:--} -v hard=${hard:--} '
+            /^budget pressures/ { split($2, p, "="); split($3, e, "="); split($4, f, "=") }
+            /^budget 1 /        { ops = $3 }
+            /^heap size:/       { heap = $3 }
+            END { printf "%8s %8s %12.0f %12d %10d %10d %10d\n", soft, hard, ops, heap / 1048576, p[2], e[2], f[2] }'
+}
+
+# Main execution
+
+printf "%8s %8s %12s %12s %10s %10s %10s\n" "soft(MB)" "hard(MB)" "ops/sec" "heap(MB)" "pressures" "evictions" "failures"
+bench-budget "" ""
+bench-budget 128 ""
+bench-budget 128 256
+bench-budget "" 256
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Compare accounting modes: sharded (default), global array, and compiled out.
+
+# Functions
+
+bench-library() {
+    library=$1
+    mode=$2
+    for threads in 1 2 4; do
+        env LD_PRELOAD=./lib/$library ./bin/bench_counters $threads 2> /dev/null | \
+            awk -v lib=$library -v mode=$mode '/^counters / { printf "%-28s %-8s %8d %14.0f %10.2f\n", lib, mode, $2, $3, $4 }'
+    done
+}
+
+# Main execution
+
+printf "%-28s %-8s %8s %14s %10s\n" "library" "mode" "threads" "ops/sec" "ns/op"
+bench-library libmalloc-ff.so        sharded
+bench-library libmalloc-ff-global.so global
+bench-library libmalloc-ff-noacct.so off
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Compare free (and malloc) latency percentiles on the churn workload with
+# frees done in place and deferred to the reclaimer thread (MALLOC_DEFER=1).
+
+# Functions
+
+bench-defer() {
+    defer=$1
+    threads=$2
+    env MALLOC_DEFER=$defer MALLOC_LATENCY=1 LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_churn $threads 2> /dev/null | \
+        awk -v mode=$([ $defer = 1 ] && echo deferred || echo inline) -v threads=$threads '
+            /^churn /       { ops = $3 }
+            /^heap size:/   { heap = $3 }
+            /^  malloc /    { malloc = $2 "/" $4 "/" $6 }
+            /^  free /      { free = $2 "/" $4 "/" $6 }
+            END { printf "%-10s %8d %12.0f %12d %22s %22s\n", mode, threads, ops, heap, free, malloc }'
+}
+
+# Main execution
+
+printf "%-10s %8s %12s %12s %22s %22s\n" "free" "threads" "ops/sec" "heap_size" "free p50/p99/p99.9" "malloc p50/p99/p99.9"
+for threads in 1 4; do
+    bench-defer 0 $threads
+    bench-defer 1 $threads
+done
+
+# vim: sts=4 sw=4 ts=8 ft=sh
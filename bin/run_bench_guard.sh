@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Compare churn throughput with guarded sampling off and at a few rates (the
+# median of several runs, since one run is noisy).
+
+# Constants
+
+RUNS=7
+
+# Functions
+
+bench-rate() {
+    rate=$1
+    for run in $(seq $RUNS); do
+        env MALLOC_GUARD=$rate LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_churn 1 262144 2> /dev/null | \
+            awk '/^churn / { print $3 }'
+    done | sort -n | awk -v rate=${rate:-off} '
+        { ops[NR] = $1 }
+        END { printf "%-12s %14.0f\n", rate, ops[int((NR + 1) / 2)] }'
+}
+
+# Main execution
+
+printf "%-12s %14s\n" "guard rate" "ops/sec"
+for rate in "" 5000 1000 100; do
+    bench-rate "$rate"
+done
+
+# vim: sts=4 sw=4 ts=8 ft=sh
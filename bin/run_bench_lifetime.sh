@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Record a mixed lifetime workload once, then replay the trace against each
+# fit policy with and without lifetime-segregated placement.
+
+# Functions
+
+replay-library() {
+    library=$1
+    lifetime=$2
+    env MALLOC_LIFETIME=$lifetime LD_PRELOAD=./lib/$library ./bin/replay $TRACE 2> /dev/null | \
+        awk -v lib=$library -v mode=$([ $lifetime = 1 ] && echo segregated || echo mixed) '
+            /^ops\/sec:/   { ops = $2 }
+            /^peak rss:/   { peak = $3 }
+            /^heap size:/  { heap = $3 }
+            /^internal:/   { internal = $2 }
+            /^external:/   { external = $2 }
+            END { printf "%-16s %-11s %12.0f %12d %12d %9s %9s\n", lib, mode, ops, peak, heap, internal, external }'
+}
+
+# Main execution
+
+TRACE=$(mktemp)
+trap "rm -f $TRACE" EXIT INT
+
+env MALLOC_TRACE=$TRACE LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_lifetime > /dev/null 2>&1
+
+printf "%-16s %-11s %12s %12s %12s %9s %9s\n" "library" "placement" "ops/sec" "peak_rss" "heap_size" "internal" "external"
+for library in libmalloc-ff.so libmalloc-bf.so libmalloc-wf.so; do
+    replay-library $library 0
+    replay-library $library 1
+done
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Compare the false sharing workloads with the default layout and with small
+# objects carved from per-thread cache lines (MALLOC_LINES=1).  Besides
+# throughput, report how many of the cache lines the workers wrote to were
+# written by more than one of them (which timing alone cannot show on a
+# machine without enough cores to run them in parallel).
+
+# Functions
+
+bench-lines() {
+    benchmark=$1
+    lines=$2
+    threads=$3
+    env MALLOC_LINES=$lines LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_$benchmark $threads 2> /dev/null | \
+        awk -v mode=$([ $lines = 1 ] && echo per-thread || echo shared) -v benchmark=$benchmark -v threads=$threads '
+            NF == 6             { ops = $3 }
+            /shared-lines/      { shared = $3; total = $4 }
+            /^heap size:/       { heap = $3 }
+            END { printf "%-14s %-10s %8d %12.0f %12d %14s\n", benchmark, mode, threads, ops, heap, shared "/" total }'
+}
+
+# Main execution
+
+printf "%-14s %-10s %8s %12s %12s %14s\n" "benchmark" "layout" "threads" "ops/sec" "heap_size" "shared_lines"
+for benchmark in cache_thrash cache_scratch; do
+    for threads in 1 2 4; do
+        bench-lines $benchmark 0 $threads
+        bench-lines $benchmark 1 $threads
+    done
+done
+
+# vim: sts=4 sw=4 ts=8 ft=sh
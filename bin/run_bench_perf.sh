@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Hardware counters per malloc/free operation for each fit policy and size
+# distribution.  Counters that are unavailable (perf_event_paranoid, no PMU in
+# a VM or container) are shown as "-".
+
+# Functions
+
+bench-library() {
+    library=$1
+    preload=$2
+    env LD_PRELOAD=$preload ./bin/bench_perf 2> /dev/null | \
+        awk -v lib=$library '/^perf / { printf "%-16s %-10s %8s %8s %8s %8s %8s %8s %8s\n", lib, $2, $3, $4, $5, $6, $7, $8, $9 }'
+}
+
+# Main execution
+
+printf "%-16s %-10s %8s %8s %8s %8s %8s %8s %8s\n" "library" "sizes" "ns/op" "cycles" "instrs" "l1d-miss" "llc-miss" "dtlb-miss" "br-miss"
+bench-library glibc           ""
+bench-library libmalloc-ff.so ./lib/libmalloc-ff.so
+bench-library libmalloc-bf.so ./lib/libmalloc-bf.so
+bench-library libmalloc-wf.so ./lib/libmalloc-wf.so
+
+# vim: sts=4 sw=4 ts=8 ft=sh
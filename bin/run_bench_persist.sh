@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Build a cache in a persistent heap file, then restart twice: once after a
+# clean exit (free list relinked) and once as if the last sync had been
+# interrupted (header clean flag cleared, so the heap is walked).
+
+# Main execution
+
+HEAP=$(mktemp -u)
+trap "rm -f $HEAP" EXIT INT
+
+export MALLOC_PERSIST=$HEAP MALLOC_PERSIST_SIZE=256
+
+echo "glibc (no persistent heap):"
+./bin/bench_persist
+echo "first run:"
+env LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_persist
+echo "restart after clean exit:"
+env LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_persist
+echo "restart after interrupted sync:"
+printf '\0\0\0\0' | dd of=$HEAP bs=1 seek=12 conv=notrunc status=none
+env LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_persist
+
+# vim: sts=4 sw=4 ts=8 ft=sh
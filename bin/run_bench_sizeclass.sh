@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Record the churn workload once, then replay the trace against first fit with
+# and without rounding requests up to the generated size classes.
+
+# Functions
+
+replay-library() {
+    library=$1
+    env LD_PRELOAD=./lib/$library ./bin/replay $TRACE 2> /dev/null | \
+        awk -v lib=$library '
+            /^ops\/sec:/   { ops = $2 }
+            /^peak rss:/   { peak = $3 }
+            /^heap size:/  { heap = $3 }
+            /^resizes:/    { resizes = $2 }
+            /^internal:/   { internal = $2 }
+            /^external:/   { external = $2 }
+            END { printf "%-28s %12.0f %12d %12d %9d %9s %9s\n", lib, ops, peak, heap, resizes, internal, external }'
+}
+
+# Main execution
+
+TRACE=$(mktemp)
+trap "rm -f $TRACE" EXIT INT
+
+env MALLOC_TRACE=$TRACE LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_churn > /dev/null 2>&1
+
+./bin/sizeclass -n 32 $TRACE 2>&1 > /dev/null
+printf "%-28s %12s %12s %12s %9s %9s %9s\n" "library" "ops/sec" "peak_rss" "heap_size" "resizes" "internal" "external"
+for library in libmalloc-ff.so libmalloc-ff-classes.so; do
+    replay-library $library
+done
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Compare the first fit allocator preloaded as a shared object with the same
+# allocator linked statically from libmalloc.a (built -O2 with LTO), calling
+# malloc and free directly and through the inline fast path (fast.h).
+
+# Functions
+
+bench-static() {
+    benchmark=$1
+    threads=$2
+    for build in preload static fast; do
+        case $build in
+            preload)    command="env LD_PRELOAD=./lib/libmalloc-ff.so ./bin/bench_$benchmark";;
+            *)          command="./bin/bench_$benchmark-$build";;
+        esac
+        $command $threads 2> /dev/null | \
+            awk -v build=$build 'NF == 6 { printf "%-14s %-8s %8d %14.0f %12d %9s %9s\n", $1, build, $2, $3, $4, $5, $6 }'
+    done
+}
+
+# Main execution
+
+printf "%-14s %-8s %8s %14s %12s %9s %9s\n" "benchmark" "build" "threads" "ops/sec" "peak_rss_kb" "internal" "external"
+for benchmark in churn larson cache_thrash xmalloc; do
+    for threads in 1 2 4; do
+        # xmalloc needs at least one producer/consumer pair
+        [ $benchmark = xmalloc -a $threads = 1 ] && continue
+        bench-static $benchmark $threads
+    done
+done
+
+# vim: sts=4 sw=4 ts=8 ft=sh
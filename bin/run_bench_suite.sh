@@ -0,0 +1,32 @@
+#!/bin/bash
+
+# Run the allocator workloads against each build and glibc.
+#
+# Output is one whitespace separated row per run:
+#
+#   benchmark library threads ops/sec peak_rss_kb internal% external%
+
+# Functions
+
+bench-library() {
+    library=$1
+    preload=$2
+    for benchmark in larson xmalloc cache_scratch cache_thrash churn realloc; do
+        for threads in 1 2 4; do
+            # xmalloc needs at least one producer/consumer pair
+            [ $benchmark = xmalloc -a $threads = 1 ] && continue
+            env LD_PRELOAD=$preload ./bin/bench_$benchmark $threads 2> /dev/null | \
+                awk -v lib=$library 'NF == 6 { printf "%-14s %-20s %8d %14.0f %12d %9s %9s\n", $1, lib, $2, $3, $4, $5, $6 }'
+        done
+    done
+}
+
+# Main execution
+
+printf "%-14s %-20s %8s %14s %12s %9s %9s\n" "benchmark" "library" "threads" "ops/sec" "peak_rss_kb" "internal" "external"
+bench-library glibc           ""
+bench-library libmalloc-ff.so ./lib/libmalloc-ff.so
+bench-library libmalloc-bf.so ./lib/libmalloc-bf.so
+bench-library libmalloc-wf.so ./lib/libmalloc-wf.so
+
+# vim: sts=4 sw=4 ts=8 ft=sh
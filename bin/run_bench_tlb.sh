@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Compare the sbrk heap with the transparent huge page heap on a large random
+# access workload (override the heap size in MB with $TLB_MEGABYTES).
+
+# Functions
+
+bench-library() {
+    library=$1
+    mode=$2
+    hugepage=$3
+    env MALLOC_HUGEPAGE=$hugepage LD_PRELOAD=./lib/$library ./bin/bench_tlb ${TLB_MEGABYTES:-2048} 2> /dev/null | \
+        awk -v lib=$library -v mode=$mode '/^tlb / { printf "%-16s %-10s %8d %12.0f %10.2f %10s %14d\n", lib, mode, $2, $3, $4, $5, $6 }'
+}
+
+# Main execution
+
+printf "%-16s %-10s %8s %12s %10s %10s %14s\n" "library" "heap" "MB" "allocs/sec" "ns/access" "dtlb/acc" "anon_huge_kb"
+bench-library libmalloc-ff.so sbrk     0
+bench-library libmalloc-ff.so hugepage 1
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Drop most of a fragmented cache and trim the heap, comparing resident
+# memory before and after with glibc (malloc_trim) and each fit
+# (malloc_release).
+
+# Functions
+
+bench-trim() {
+    library=$1
+    preload=$2
+    env LD_PRELOAD=$preload ./bin/bench_trim 2> /dev/null | \
+        awk -v lib=$library '
+            /^trim rss_before/  { for (i = 2; i <= NF; i++) { split($i, kv, "="); v[kv[1]] = kv[2] } }
+            /^free blocks:/     { blocks = $3 }
+            END { printf "%-20s %14d %14d %14d %12s %10.3f\n", lib, v["rss_before"], v["rss_after"], v["released"] / 1024, blocks == "" ? "-" : blocks, v["seconds"] * 1000 }'
+}
+
+# Main execution
+
+printf "%-20s %14s %14s %14s %12s %10s\n" "library" "rss_before_kb" "rss_after_kb" "released_kb" "free_blocks" "trim_ms"
+bench-trim glibc           ""
+bench-trim libmalloc-ff.so ./lib/libmalloc-ff.so
+bench-trim libmalloc-bf.so ./lib/libmalloc-bf.so
+bench-trim libmalloc-wf.so ./lib/libmalloc-wf.so
+
+# vim: sts=4 sw=4 ts=8 ft=sh
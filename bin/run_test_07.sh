@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Record a trace of a real program, then replay it against each fit and the
+# system allocator: every record must be replayed.  A failed realloc must not
+# be recorded, and must leave its object traced (so the later free refers to
+# it).
+
+# Functions
+
+replay-library() {
+    library=$1
+    records=$2
+    echo -n "Replaying with ${library:-glibc}... "
+    output=$(env ${library:+LD_PRELOAD=./lib/$library} ./bin/replay $TRACE 2> /dev/null)
+    if [ $? -eq 0 ] && \
+       echo "$output" | grep -q "^records: *$records$" && \
+       echo "$output" | grep -q "^operations: *[1-9]" && \
+       echo "$output" | grep -q "^peak rss: *[0-9]" && \
+       { [ -z "$library" ] || echo "$output" | grep -q "^heap size: *[1-9]"; }; then
+        echo success
+    else
+        echo failure
+    fi
+}
+
+# Main execution
+
+TRACE=$(mktemp)
+trap "rm -f $TRACE" EXIT INT
+
+env MALLOC_TRACE=$TRACE LD_PRELOAD=./lib/libmalloc-ff.so sort src/*.c > /dev/null 2>&1
+RECORDS=$(( ($(stat -c %s $TRACE) - 16) / 32 ))
+
+echo -n "Recording trace ($RECORDS records)... "
+[ $RECORDS -gt 0 ] && echo success || echo failure
+
+for fit in ff bf wf; do
+    replay-library libmalloc-$fit.so $RECORDS
+done
+replay-library "" $RECORDS
+
+# test_06: malloc (object 1), failed realloc, free (of object 1)
+env MALLOC_TRACE=$TRACE LD_PRELOAD=./lib/libmalloc-ff.so ./bin/test_06 > /dev/null 2>&1
+RECORDS=$(( ($(stat -c %s $TRACE) - 16) / 32 ))
+FREED=$(od -An -t u4 -j $((16 + 32 + 20)) -N 4 $TRACE | tr -d ' ')
+
+echo -n "Tracing a failed realloc... "
+[ $RECORDS -eq 2 ] && [ "$FREED" = 1 ] && echo success || echo failure
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -0,0 +1,76 @@
+#!/bin/bash
+
+# Generate size class tables from small fixed histograms whose optimal class
+# sets are known, and check the generated header rounds sizes to them.
+
+# Functions
+
+classes() {
+    awk '/SizeClasses\[NSIZECLASSES\] = \{/ { table = 1; next }
+         table && /^\};/                     { exit }
+         table                               { gsub(/,/, " "); printf "%s", $0 }' $HEADER | tr -s ' ' | sed 's/^ //; s/ $//'
+}
+
+test-histogram() {
+    n=$1
+    expected=$2
+    echo -n "Generating $n classes ($expected)... "
+    if ./bin/sizeclass -n $n $HISTOGRAM > $HEADER 2> /dev/null && [ "$(classes)" = "$expected" ]; then
+        echo success
+    else
+        echo failure
+    fi
+}
+
+test-rounding() {
+    echo -n "Rounding with the generated header... "
+    ./bin/sizeclass -n 3 $HISTOGRAM > $HEADER 2> /dev/null
+    cat > $PROGRAM.c <<EOC
+#include "$HEADER"
+#include <assert.h>
+int main() {
+    assert(size_class_round(1)  == 8);
+    assert(size_class_round(8)  == 8);
+    assert(size_class_round(9)  == 32);
+    assert(size_class_round(32) == 32);
+    assert(size_class_round(33) == 64);
+    assert(size_class_round(64) == 64);
+    assert(size_class_round(65) == 65);
+    return 0;
+}
+EOC
+    if gcc -o $PROGRAM $PROGRAM.c 2> /dev/null && $PROGRAM; then
+        echo success
+    else
+        echo failure
+    fi
+}
+
+# Main execution
+
+HISTOGRAM=$(mktemp)
+HEADER=$(mktemp --suffix=.h)
+PROGRAM=$(mktemp)
+trap "rm -f $HISTOGRAM $HEADER $PROGRAM $PROGRAM.c" EXIT INT
+
+# Three popular sizes with a few requests between them:
+#
+#   3 classes:  8, 32, 64 wastes 16 + 8 + 16 bytes (any other set wastes at
+#               least 8 bytes on each of 100 requests).
+#   2 classes:  32, 64 wastes 2440 bytes (8, 64: 3304; 16, 64: 4040; ...).
+#   6 classes:  one per size, no waste.
+cat > $HISTOGRAM <<EOH
+8 100
+16 1
+24 1
+32 100
+48 1
+64 100
+EOH
+
+test-histogram 3 "8 32 64"
+test-histogram 2 "32 64"
+test-histogram 6 "8 16 24 32 48 64"
+test-rounding
+
+# vim: sts=4 sw=4 ts=8 ft=sh
@@ -15,6 +15,8 @@
 #define ALIGN(size)     (((size) + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
 #define SBRK_FAILURE    ((void *)(-1))
 #define TRIM_THRESHOLD  (1<<10)
+#define MMAP_THRESHOLD  (1<<17)	/* Large callocs get their own mapping */
+#define BLOCK_MAPPED    ((size_t)1)	/* Capacity flag for mapped blocks */
 
 /* Block Structure */
 
@@ -35,8 +37,12 @@ struct block {
 /* Block Functions */
 
 Block * block_allocate(size_t size);
+Block * block_allocate_long(size_t size);
 bool    block_release(Block *block);
 
+Block * block_map(size_t size);
+bool    block_unmap(Block *block);
+
 Block * block_detach(Block *block);
 
 bool    block_merge(Block *dst, Block *src);
@@ -0,0 +1,45 @@
+/* budget.h: Heap Memory Budget */
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Budget Constants */
+
+#define BUDGET_CALLBACKS    16	    /* Pressure callbacks that can be registered */
+#define BUDGET_STEP         16	    /* Above the soft limit, signal pressure again
+				       every 1/BUDGET_STEP of it the heap grows */
+
+/* Budget Functions
+ *
+ * The budget covers the heap (the HEAP_SIZE counter) plus blocks calloc maps
+ * on their own.  Growing past the hard limit fails (ENOMEM); growing past the
+ * soft limit flags pressure, which the allocator relieves once it has
+ * dropped the heap lock: pressure callbacks first (so caches can shed
+ * entries), then trimming the top of the heap and releasing the pages of
+ * free blocks.  An allocation the hard limit refused is tried once more
+ * after that.
+ **/
+
+typedef void (*PressureCallback)(size_t used, size_t limit, void *arg);
+
+extern bool     BudgetPressure;	    /* Whether relief is due */
+
+void    budget_init();
+bool    budget_set(size_t soft, size_t hard);
+bool    budget_register(PressureCallback callback, void *arg);
+size_t  budget_used();
+
+bool    budget_charge(size_t bytes, bool mapped);
+void    budget_credit(size_t bytes, bool mapped);
+
+bool    budget_relief_begin();
+void    budget_notify();
+void    budget_relief_end();
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -3,6 +3,7 @@
 #ifndef COUNTERS_H
 #define COUNTERS_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -28,12 +29,107 @@ enum {
     NCOUNTERS,	    /* Number of counters */
 };
 
+/* Accounting Modes (select with -DACCOUNTING=...)
+ *
+ *  ACCOUNTING_OFF:     Only the counters updated next to a system call (GROWS,
+ *                      SHRINKS, HEAP_SIZE) are kept; everything else is
+ *                      compiled out of the hot path.
+ *
+ *  ACCOUNTING_GLOBAL:  Every counter lives in one shared array (updated
+ *                      atomically, since some updates happen outside the
+ *                      heap lock).
+ *
+ *  ACCOUNTING_SHARDED: Every thread updates its own cache line padded shard;
+ *                      shards are only summed when the counters are read.
+ *                      The kept counters stay in one shared array, so the
+ *                      allocator can read HEAP_SIZE with counter_read
+ *                      without summing anything.
+ *
+ * Whatever the mode, read counters with counter_read or counters_snapshot.
+ **/
+
+#define ACCOUNTING_OFF      0
+#define ACCOUNTING_GLOBAL   1
+#define ACCOUNTING_SHARDED  2
+
+#ifndef ACCOUNTING
+#define ACCOUNTING  ACCOUNTING_SHARDED
+#endif
+
+#define COUNTER_SHARDS      64
+#define COUNTER_KEPT(c)     ((c) == GROWS || (c) == SHRINKS || (c) == HEAP_SIZE)
+
+#if ACCOUNTING == ACCOUNTING_SHARDED
+
+typedef struct {
+    size_t  counters[NCOUNTERS];    /* Partial sums for one thread */
+    int     shared;		    /* Whether threads share (overflow) shard */
+} __attribute__((aligned(64))) CounterShard;
+
+extern __thread CounterShard *LocalShard __attribute__((tls_model("initial-exec")));
+extern size_t KeptCounters[NCOUNTERS];	/* Kept counters (never sharded) */
+
+CounterShard *	counters_shard();
+
+__attribute__((always_inline))
+static inline void counter_add(int counter, size_t n) {
+    // Kept counters change next to a system call, so sharding buys nothing
+    // and one shared value can be read without summing
+    if (COUNTER_KEPT(counter)) {
+        __atomic_add_fetch(&KeptCounters[counter], n, __ATOMIC_RELAXED);
+        return;
+    }
+
+    CounterShard *shard = LocalShard;
+    if (__builtin_expect(shard == NULL, 0)) {
+        shard = counters_shard();
+    }
+
+    if (__builtin_expect(shard->shared, 0)) {
+        __atomic_fetch_add(&shard->counters[counter], n, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&shard->counters[counter], shard->counters[counter] + n, __ATOMIC_RELAXED);
+    }
+}
+
+#define COUNTER_ADD(c, n)   counter_add((c), (n))
+
+#else
+
 extern size_t Counters[NCOUNTERS];  /* Counters array */
 
-/* Counter Functions */
+#if ACCOUNTING == ACCOUNTING_OFF
+#define COUNTER_ADD(c, n)   do { if (COUNTER_KEPT(c)) __atomic_add_fetch(&Counters[c], (n), __ATOMIC_RELAXED); } while (0)
+#else
+#define COUNTER_ADD(c, n)   __atomic_add_fetch(&Counters[c], (n), __ATOMIC_RELAXED)
+#endif
+
+#endif
+
+#define COUNTER_INC(c)      COUNTER_ADD((c), 1)
+#define COUNTER_DEC(c)      COUNTER_ADD((c), (size_t)-1)
+#define COUNTER_SUB(c, n)   COUNTER_ADD((c), -(size_t)(n))
+
+/* Counter Functions
+ *
+ * INIT_COUNTERS only calls init_counters until it has run once (which a
+ * constructor normally does before main), so the hot path pays a load and a
+ * predicted branch instead of a call.
+ **/
+
+extern bool CountersInitialized;
+
+#define INIT_COUNTERS() \
+    do { if (__builtin_expect(!CountersInitialized, 0)) init_counters(); } while (0)
+
+void   init_counters();
+void   dump_counters();
+void   counters_snapshot(size_t counters[NCOUNTERS]);
+void   counters_restore(const size_t counters[NCOUNTERS]);
+size_t counter_read(int counter);
 
-void init_counters();
-void dump_counters();
+double internal_fragmentation();
+double external_fragmentation();
 
 #endif
 
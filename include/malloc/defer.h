@@ -0,0 +1,33 @@
+/* defer.h: Deferred Frees */
+
+#ifndef DEFER_H
+#define DEFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Defer Constants */
+
+#define DEFER_BATCH     64	/* Frees a thread buffers before handing them off */
+#define DEFER_BACKLOG   1024	/* Pending frees before threads free in place */
+
+/* Defer Functions
+ *
+ * Deferred pointers are chained through their first word (every block holds
+ * at least ALIGNMENT bytes), so buffering them needs no memory of its own.
+ * The reclaimer is passed NULL terminated chains.
+ **/
+
+typedef void (*DeferReclaimer)(void *chain);
+
+extern bool DeferEnabled;   /* Whether MALLOC_DEFER is set (free defers too) */
+
+void    defer_init(DeferReclaimer reclaimer);
+void    defer_push(void *ptr);
+void    defer_flush();
+void    defer_drain();
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,100 @@
+/* fast.h: Inline Allocation Fast Path */
+
+#ifndef FAST_H
+#define FAST_H
+
+#include "malloc/block.h"
+#include "malloc/counters.h"
+#include "malloc/defer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Fast Path Constants */
+
+#define FAST_MAX        128				/* Largest capacity cached */
+#define FAST_CLASSES    (FAST_MAX / ALIGNMENT)		/* Cached capacity classes */
+#define FAST_DEPTH      32				/* Blocks cached per class */
+
+/* Fast Path Structures
+ *
+ * Each thread keeps a few freed small blocks per capacity class in front of
+ * the heap lock.  Cached blocks stay allocated as far as the heap is
+ * concerned (so heap_walk and malloc_iterate report them as in use); their
+ * data is chained through its first word.
+ *
+ * A class only has room once the thread has missed on it in malloc_fast, and
+ * loses it again when it fills up and is handed back to the heap, so threads
+ * that mostly free (a consumer in a producer/consumer pair) do not pin blocks
+ * they never reuse.
+ **/
+
+typedef struct {
+    void *      head[FAST_CLASSES];	/* Cached data by capacity class */
+    uint32_t    room[FAST_CLASSES];	/* Blocks each class may still take */
+} FastCache;
+
+/* Fast Path Functions
+ *
+ * Programs that link libmalloc.a can include this header and call
+ * malloc_fast and free_fast, which inline to a few loads and stores for
+ * cached sizes and fall back to malloc_slow and free_slow otherwise.  Caching
+ * is off while any feature that must see every allocation is enabled:
+ * latency, stats, profiling, tracing, lifetime prediction, guard sampling,
+ * per-thread lines or a persistent heap.
+ **/
+
+extern bool FastEnabled;	/* Whether threads may cache freed blocks */
+extern __thread FastCache MallocCache __attribute__((tls_model("initial-exec")));
+
+void    fast_init(DeferReclaimer reclaimer);
+void *  malloc_slow(size_t size);
+void    free_slow(void *ptr);
+void    malloc_fast_flush();
+
+/**
+ * Allocate specified amount of memory, from the thread's cache if possible.
+ * @param   size    Amount of bytes to allocate.
+ * @return  Pointer to the requested amount of memory.
+ **/
+__attribute__((always_inline))
+static inline void *malloc_fast(size_t size) {
+    size_t class = (size - 1) / ALIGNMENT;	/* Size 0 wraps past every class */
+
+    if (__builtin_expect(class < FAST_CLASSES, 1)) {
+        void *data = MallocCache.head[class];
+        if (__builtin_expect(data != NULL, 1)) {
+            MallocCache.head[class] = *(void **)data;
+            MallocCache.room[class]++;
+            (BLOCK_FROM_POINTER(data))->size = size;
+            COUNTER_INC(MALLOCS);
+            COUNTER_ADD(REQUESTED, size);
+            return data;
+        }
+    }
+    return malloc_slow(size);
+}
+
+/**
+ * Release previously allocated memory, into the thread's cache if possible.
+ * @param   ptr     Pointer to previously allocated memory.
+ **/
+__attribute__((always_inline))
+static inline void free_fast(void *ptr) {
+    if (__builtin_expect(ptr != NULL, 1)) {
+        size_t class = (BLOCK_FROM_POINTER(ptr))->capacity / ALIGNMENT - 1;
+        if (__builtin_expect(class < FAST_CLASSES && MallocCache.room[class], 1)) {
+            *(void **)ptr = MallocCache.head[class];
+            MallocCache.head[class] = ptr;
+            MallocCache.room[class]--;
+            COUNTER_INC(FREES);
+            return;
+        }
+    }
+    free_slow(ptr);
+}
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,51 @@
+/* freeindex.h: Free List Size Index */
+
+#ifndef FREEINDEX_H
+#define FREEINDEX_H
+
+#include "malloc/block.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Free Index Structure
+ *
+ * Contiguous side arrays (structure-of-arrays) mirroring the free blocks of
+ * one heap region in free list order: capacities[i] is the capacity of
+ * blocks[i] (0 and NULL for a hole left by a removed block), and the first
+ * and last data word of blocks[i] hold i.  Searches stream over the
+ * capacities array instead of chasing next pointers through the heap.
+ **/
+
+typedef struct {
+    size_t *    capacities;	/* Capacity of each free block */
+    Block **    blocks;		/* Free block for each capacity entry */
+    size_t *    largest;	/* Max tree over the capacities (root at 1) */
+    size_t      length;		/* Number of entries in use (holes included) */
+    size_t      holes;		/* Number of holes among them */
+    size_t      allocated;	/* Number of entries mapped */
+    size_t      span;		/* Number of entries the max tree covers */
+    bool        broken;		/* Index could not be maintained */
+} FreeIndex;
+
+extern FreeIndex Indexes[2];	/* Main heap and long-lived region */
+
+/* Free Index Functions */
+
+bool    free_index_valid();
+
+void    free_index_append(Block *block);
+void    free_index_replace(Block *old, Block *block);
+void    free_index_remove(Block *block);
+void    free_index_rebuild();
+
+Block * free_index_search_ff(size_t size);
+Block * free_index_search_bf(size_t size);
+Block * free_index_search_wf(size_t size);
+Block * free_index_search_region(size_t size, bool long_lived);
+Block * free_index_adjacent(Block *block);
+size_t  free_index_largest();
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
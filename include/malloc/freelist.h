@@ -5,11 +5,29 @@
 
 #include "malloc/block.h"
 
+/* Free List Statistics */
+
+typedef struct {
+    size_t  blocks;	/* Number of blocks in free list */
+    size_t  bytes;	/* Total capacity of blocks in free list */
+    size_t  slack;	/* Total unused capacity (capacity - size) in free list */
+    size_t  largest;	/* Capacity of largest block in free list */
+} FreeStats;
+
 /* Free List Functions */
 
+extern Block FreeList;	/* Sentinel of the free list */
+
 Block *	free_list_search(size_t size);
+Block *	free_list_search_region(size_t size, bool long_lived);
 void	free_list_insert(Block *block);
+void	free_list_append(Block *block);
+Block * free_list_detach(Block *block, size_t size);
+size_t  free_list_consolidate();
+size_t  free_list_trim(size_t pad);
+size_t  free_list_purge();
 size_t  free_list_length();
+void    free_list_stats(FreeStats *stats);
 
 #endif
 
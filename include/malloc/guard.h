@@ -0,0 +1,48 @@
+/* guard.h: Sampled Guard Page Allocations */
+
+#ifndef GUARD_H
+#define GUARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Guard Constants
+ *
+ * The pool is an alternating run of guard pages and slot pages:
+ *
+ *      [guard][slot 0][guard][slot 1] ... [slot N-1][guard]
+ *
+ * Each sampled allocation gets a slot to itself, placed against the end of
+ * the slot page, so an overflow runs into the next guard page.  Freed slots
+ * are made inaccessible and reused round robin, oldest first, so a dangling
+ * pointer keeps faulting for as long as possible.
+ **/
+
+#define GUARD_SLOTS         16	    /* Default slots in the pool */
+#define GUARD_SLOTS_MAX     1024    /* Most slots MALLOC_GUARD_SLOTS may ask for */
+#define GUARD_PATTERN       0xAB    /* Fill between end of request and end of block */
+
+/* Guard Functions (guard_malloc and guard_free are called with the heap lock held) */
+
+extern size_t       GuardRate;	    /* Sample one allocation in this many (0 disables) */
+extern uintptr_t    GuardStart;	    /* Start of the pool */
+extern size_t       GuardLength;    /* Length of the pool (0 when disabled) */
+extern __thread int32_t GuardCountdown __attribute__((tls_model("initial-exec")));
+
+void    guard_init();
+bool    guard_sample();
+void *  guard_malloc(size_t size, uintptr_t site);
+size_t  guard_free(void *ptr, uintptr_t site);
+
+/* Whether this allocation should be served from the pool */
+#define GUARD_SAMPLE() \
+    (__builtin_expect(GuardRate != 0, 0) && __builtin_expect(--GuardCountdown <= 0, 0) && guard_sample())
+
+/* Whether pointer lies in the pool (one compare, false when disabled) */
+#define GUARD_OWNS(ptr) \
+    ((uintptr_t)(ptr) - GuardStart < GuardLength)
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
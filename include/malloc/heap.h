@@ -0,0 +1,73 @@
+/* heap.h: Heap Backend */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "malloc/block.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Heap Constants */
+
+#define HUGEPAGE_SIZE       (1UL<<21)	    /* Transparent huge page (2 MB) */
+#define HUGEPAGE_RESERVE    (64UL<<30)	    /* Default address space reserved (64 GB) */
+#define LONG_RESERVE        (16UL<<30)	    /* Long-lived region address space (16 GB) */
+#define LINES_RESERVE       (16UL<<30)	    /* Per-thread lines region address space (16 GB) */
+#define LINES_CHUNK         (16UL<<10)	    /* Lines region chunk owned by one thread (16 KB) */
+#define LINES_HEADER        64		    /* Chunk header (a cache line of its own) */
+
+/* Heap Functions
+ *
+ * heap_sbrk has the same contract as sbrk (returns the previous break or
+ * SBRK_FAILURE), so block.c does not care which backend provides the heap:
+ *
+ *  - Default:          the program break (sbrk).
+ *  - MALLOC_HUGEPAGE:  a 2 MB aligned anonymous region marked MADV_HUGEPAGE,
+ *                      with a break emulated inside it.  Shrinking only hands
+ *                      back whole huge pages (MADV_DONTNEED), so trims never
+ *                      split a huge page.  MALLOC_HUGEPAGE_RESERVE overrides
+ *                      how much address space is reserved (in MB).
+ *  - MALLOC_PERSIST:   a private mapping of a heap file at a fixed address,
+ *                      attached by persist.c with heap_attach.
+ *
+ * Both backends track how far the heap has ever reached, so heap_fresh can
+ * tell calloc which part of a newly grown block is already zero.
+ *
+ * heap_sbrk_long grows a separate region reserved on first use for objects
+ * predicted to be long-lived (see lifetime.h), so they never pin the top of
+ * the main heap.  heap_inside tells whether a range lies below the break of
+ * either, so the free index can peek at a neighbouring block.
+ **/
+
+void *  heap_sbrk(intptr_t increment);
+void *  heap_fresh();
+bool    heap_hugepage();
+
+bool    heap_attach(void *start, void *brk, void *limit);
+bool    heap_persistent();
+
+void *  heap_sbrk_long(intptr_t increment);
+bool    heap_long(const void *ptr);
+bool    heap_inside(const void *start, const void *end);
+
+void *  heap_sbrk_lines(intptr_t increment);
+bool    heap_lines(const void *ptr);
+
+/* Heap Walking
+ *
+ * heap_walk visits every block of the main heap, then of the long-lived
+ * region, then of each chunk of the lines region (past its header), in
+ * address order, allocated (self-linked) or free, until the visitor
+ * returns false.  Callers must hold the heap lock.  Blocks from block_map are
+ * not part of any region and are not visited.
+ **/
+
+typedef bool (*HeapVisitor)(Block *block, bool allocated, void *arg);
+
+bool    heap_walk(HeapVisitor visitor, void *arg);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
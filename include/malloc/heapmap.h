@@ -0,0 +1,56 @@
+/* heapmap.h: Heap Block Map Dumps */
+
+#ifndef HEAPMAP_H
+#define HEAPMAP_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Heap Map Constants */
+
+#define HEAPMAP_MAGIC       0x3150414d50414548UL    /* "HEAPMAP1" */
+#define HEAPMAP_VERSION     1
+#define HEAPMAP_PREFIX      "malloc-heap.%d"	    /* Default map file prefix */
+
+/* Heap Map File Format
+ *
+ * A HeapMapHeader followed by one HeapMapRecord per block, in the order
+ * heap_walk visits them: the main heap, then the long-lived region
+ * (MALLOC_LIFETIME), then each chunk of the lines region (MALLOC_LINES), each
+ * in address order.  Records describe the heap as the allocator sees it;
+ * nothing about the contents of blocks is written.
+ **/
+
+typedef struct {
+    uint64_t    magic;		/* HEAPMAP_MAGIC */
+    uint32_t    version;	/* HEAPMAP_VERSION */
+    uint32_t    pid;		/* Process the map was taken from */
+    uint64_t    timestamp;	/* CLOCK_MONOTONIC nanoseconds */
+    uint64_t    complete;	/* Whether the walk reached the end of the heap */
+} HeapMapHeader;
+
+typedef struct {
+    uint64_t    address;	/* Address of block header */
+    uint64_t    capacity;	/* Capacity of block (excluding header) */
+    uint64_t    size;		/* Bytes requested (last request for free blocks) */
+    uint32_t    allocated;	/* Whether the block is in use */
+    uint32_t    reserved;
+} HeapMapRecord;
+
+/* Heap Map Functions (dumps are taken with the heap lock held) */
+
+extern volatile sig_atomic_t HeapMapRequested;	/* Set by MALLOC_HEAPMAP_SIGNAL */
+
+void    heapmap_init();
+bool    heapmap_dump(const char *path);
+void    heapmap_dump_next();
+
+/* Take a requested dump from inside the allocator (never the signal handler) */
+#define HEAPMAP_CHECK() \
+    do { if (__builtin_expect(HeapMapRequested, 0)) heapmap_dump_next(); } while (0)
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,71 @@
+/* latency.h: Per-Call Latency Histograms */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Operations */
+
+enum {
+    OP_MALLOC,	    /* Calls to malloc */
+    OP_FREE,	    /* Calls to free */
+    OP_REALLOC,	    /* Calls to realloc */
+    OP_CALLOC,	    /* Calls to calloc */
+    NOPERATIONS,    /* Number of operations */
+};
+
+/* Latency Constants
+ *
+ * Histograms are log-linear (HDR-style): values below 2^LATENCY_SUBBITS get
+ * their own bucket, and every power of two above that is split into
+ * 2^LATENCY_SUBBITS linear sub-buckets, so relative error stays below 1/16.
+ **/
+
+#define LATENCY_SUBBITS     4
+#define LATENCY_MAXBITS     40
+#define LATENCY_BUCKETS     ((LATENCY_MAXBITS - LATENCY_SUBBITS + 1) << LATENCY_SUBBITS)
+#define LATENCY_CLASSES     32	    /* Same power of two classes as stats.h */
+
+/* Latency Structures */
+
+typedef struct {
+    uint64_t    count;			    /* Number of samples */
+    uint64_t    max;			    /* Largest sample */
+    uint64_t    buckets[LATENCY_BUCKETS];   /* Samples per bucket */
+} Histogram;
+
+typedef struct {
+    Histogram   operations[NOPERATIONS];
+    Histogram   classes[NOPERATIONS][LATENCY_CLASSES];
+} LatencyTable;
+
+typedef struct {
+    uint64_t    p50;
+    uint64_t    p99;
+    uint64_t    p999;
+} Percentiles;
+
+/* Latency Functions */
+
+extern LatencyTable *Latency;	/* Histograms (NULL when disabled) */
+
+void        latency_init();
+uint64_t    latency_now();
+void        latency_record(int operation, size_t size, uint64_t elapsed);
+void        latency_percentiles(const Histogram *histogram, Percentiles *percentiles);
+void        latency_dump(int fd);
+
+extern const char *OperationNames[NOPERATIONS];
+
+/* Only read the cycle counter when latency instrumentation is enabled */
+#define LATENCY_BEGIN() \
+    uint64_t latency_start = Latency ? latency_now() : 0
+#define LATENCY_END(operation, size) \
+    do { if (Latency && latency_start) latency_record((operation), (size), latency_now() - latency_start); } while (0)
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,35 @@
+/* lifetime.h: Object Lifetime Prediction */
+
+#ifndef LIFETIME_H
+#define LIFETIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Lifetime Constants
+ *
+ * One allocation in LIFETIME_PERIOD is sampled into a ring of LIFETIME_RING
+ * slots.  A sample freed before its slot comes around again (fewer than
+ * LIFETIME_PERIOD * LIFETIME_RING allocations later) counts as short-lived;
+ * one still live when its slot is reused counts as long-lived.
+ **/
+
+#define LIFETIME_PERIOD     64	    /* Allocations between samples */
+#define LIFETIME_RING       1024    /* Sampled objects tracked at once */
+#define LIFETIME_SITES      4096    /* Prediction table entries */
+#define LIFETIME_DECAY      256	    /* Halve entry counts after this many outcomes */
+#define LIFETIME_EVIDENCE   4	    /* Long-lived outcomes needed to predict long */
+
+/* Lifetime Functions (callers hold the heap lock) */
+
+extern bool LifetimeEnabled;	/* Whether MALLOC_LIFETIME is set */
+
+void    lifetime_init();
+bool    lifetime_predict(uintptr_t site, size_t size);
+void    lifetime_malloc(void *ptr, uintptr_t site, size_t size);
+void    lifetime_free(void *ptr);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,47 @@
+/* lines.h: Per-Thread Cache Line Regions */
+
+#ifndef LINES_H
+#define LINES_H
+
+#include "malloc/block.h"
+#include "malloc/heap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Lines Constants
+ *
+ * Small blocks are carved back to back out of LINES_CHUNK sized chunks, each
+ * owned by a single thread.  Chunks are aligned to their size, and freed
+ * blocks only ever go back to the thread that owns their chunk, so blocks
+ * allocated by different threads never share a cache line.
+ **/
+
+#define LINES_MAX       256				/* Largest capacity carved */
+#define LINES_CLASSES   (LINES_MAX / ALIGNMENT)		/* Free lists per owner */
+#define LINES_OWNERS    256				/* Threads with chunks at once */
+
+/* Lines Structures */
+
+typedef struct {
+    uint32_t    owner;	    /* Index of the owning thread's slot */
+} LinesChunk;
+
+typedef struct {
+    Block *     free[LINES_CLASSES];	/* Freed blocks by capacity (singly linked) */
+    Block *     tail;			/* Uncarved rest of the current chunk */
+    bool        used;			/* Whether a live thread owns the slot */
+} LinesOwner;
+
+/* Lines Functions (callers hold the heap lock) */
+
+extern bool LinesEnabled;   /* Whether MALLOC_LINES is set */
+
+void    lines_init();
+Block * lines_allocate(size_t capacity);
+void    lines_free(Block *block);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,66 @@
+/* persist.h: File-Backed Persistent Heap */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include "malloc/block.h"
+#include "malloc/counters.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Persist Constants
+ *
+ * With MALLOC_PERSIST=path, the heap lives in a private mapping of that file
+ * at PERSIST_BASE instead of the program break, so block links stay valid
+ * across restarts without any relocation.  The first PERSIST_HEADER bytes of
+ * the file hold a PersistHeader; the heap starts right after it.
+ * MALLOC_PERSIST_SIZE sets the size of a new file (in MB).
+ *
+ * The mapping is private so forked children get copy-on-write heaps like
+ * everyone else; the owner writes its heap back with persist_sync (at exit),
+ * so the file always holds the heap as of the last sync.
+ **/
+
+#define PERSIST_MAGIC       0x5453495352455048UL    /* "HPERSIST" */
+#define PERSIST_VERSION     1
+#define PERSIST_BASE        (0x500000000000UL)	    /* Fixed mapping address */
+#define PERSIST_RESERVE     (1UL<<30)		    /* Default file size (1 GB) */
+#define PERSIST_HEADER      (1UL<<12)		    /* Bytes before the heap */
+
+/* Persist Header Structure
+ *
+ * free_next and sentinel describe the FreeList as of the last persist_sync:
+ * the chain starts at free_next and ends at whatever block links back to the
+ * old sentinel address, which is relinked to this process' FreeList on
+ * attach.  They (and counters) are only trusted when clean is set, which is
+ * written last; otherwise the free list is rebuilt by walking the heap.
+ **/
+
+typedef struct {
+    uint64_t    magic;			/* PERSIST_MAGIC */
+    uint32_t    version;		/* PERSIST_VERSION */
+    uint32_t    clean;			/* Whether the last sync completed */
+    uintptr_t   base;			/* Address the file is mapped at */
+    size_t      reserve;		/* Size of the file */
+    uintptr_t   brk;			/* Heap break */
+    Block *     free_next;		/* First free block (NULL when empty) */
+    Block *     sentinel;		/* Address of FreeList when synced */
+    void *      root;			/* Application root object */
+    size_t      counters[NCOUNTERS];	/* Counters when synced */
+} PersistHeader;
+
+/* Persist Functions */
+
+extern PersistHeader *Persist;	/* Mapped header (NULL when disabled) */
+
+void    persist_init();
+void    persist_sync();
+
+void *  persist_root();
+void    persist_set_root(void *root);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
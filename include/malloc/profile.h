@@ -0,0 +1,47 @@
+/* profile.h: Sampling Heap Profiler */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Profile Constants */
+
+#define PROFILE_RATE    (512 * 1024)	    /* Default mean bytes between samples */
+#define PROFILE_DEPTH   32		    /* Maximum frames kept per stack */
+#define PROFILE_SKIP    2		    /* Frames inside the allocator */
+#define PROFILE_PREFIX  "malloc-heap.%d"    /* Default profile file prefix */
+
+/* Profile Structures */
+
+typedef struct {
+    uint64_t    hash;			    /* Hash of frames */
+    uint32_t    depth;			    /* Number of frames */
+    void *      frames[PROFILE_DEPTH];	    /* Return addresses (innermost first) */
+    uint64_t    allocs;			    /* Sampled allocations */
+    uint64_t    alloc_bytes;		    /* Sampled bytes allocated */
+    uint64_t    frees;			    /* Sampled allocations freed */
+    uint64_t    free_bytes;		    /* Sampled bytes freed */
+} ProfileStack;
+
+/* Profile Functions */
+
+extern size_t ProfileRate;  /* Mean bytes between samples (0 when disabled) */
+
+void    profile_init();
+void    profile_malloc(void *ptr, size_t size);
+uint64_t profile_free(void *ptr);
+void    profile_restore(void *ptr, uint64_t sample);
+bool    profile_dump(const char *path);
+
+/* Only pay for sampling when the profiler is enabled */
+#define PROFILE_MALLOC(ptr, size)   do { if (ProfileRate && (ptr)) profile_malloc((ptr), (size)); } while (0)
+#define PROFILE_FREE(ptr)           (ProfileRate && (ptr) ? profile_free(ptr) : 0)
+#define PROFILE_RESTORE(ptr, sample) \
+    do { if (sample) profile_restore((ptr), (sample)); } while (0)
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
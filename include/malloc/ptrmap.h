@@ -0,0 +1,38 @@
+/* ptrmap.h: Pointer Hash Map */
+
+#ifndef PTRMAP_H
+#define PTRMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Pointer Map Structure
+ *
+ * Open addressing (linear probing) hash table from pointers to 64-bit values,
+ * stored in anonymous mappings so the allocator can track its own objects
+ * without calling malloc.  A key of 0 marks an empty slot, so NULL cannot be
+ * stored.  The map is not thread-safe; callers provide their own locking.
+ **/
+
+typedef struct {
+    uintptr_t   key;	    /* Pointer (0 when slot is empty) */
+    uint64_t    value;	    /* Value associated with pointer */
+} PtrEntry;
+
+typedef struct {
+    PtrEntry *  entries;    /* Slots (power of two) */
+    size_t      length;	    /* Number of slots in use */
+    size_t      capacity;   /* Number of slots mapped */
+} PtrMap;
+
+/* Pointer Map Functions */
+
+bool    ptr_map_insert(PtrMap *map, const void *key, uint64_t value);
+bool    ptr_map_lookup(const PtrMap *map, const void *key, uint64_t *value);
+bool    ptr_map_remove(PtrMap *map, const void *key, uint64_t *value);
+void    ptr_map_clear(PtrMap *map);
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
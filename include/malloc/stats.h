@@ -0,0 +1,96 @@
+/* stats.h: Live Statistics Page */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "malloc/counters.h"
+#include "malloc/latency.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Stats Constants */
+
+#define STATS_MAGIC     0x5441545350414548ULL	/* "HEAPSTAT" */
+#define STATS_VERSION   2
+#define STATS_CLASSES   32			/* Power of two size classes */
+#define STATS_INTERVAL  64			/* Default operations between publishes */
+#define STATS_PATH      "/dev/shm/malloc-heap.%d"
+
+/* Stats Structures */
+
+typedef struct {
+    uint64_t    mallocs;	/* Number of allocations in size class */
+    uint64_t    frees;		/* Number of frees in size class */
+    uint64_t    live;		/* Requested bytes currently allocated */
+} SizeClassStats;
+
+typedef struct {
+    uint64_t    magic;		/* STATS_MAGIC once the page is initialized */
+    uint32_t    version;	/* STATS_VERSION */
+    uint32_t    pid;		/* Process publishing this page */
+    uint64_t    sequence;	/* Seqlock: odd while an update is in progress */
+    uint64_t    timestamp;	/* CLOCK_MONOTONIC time of update (ns) */
+
+    uint64_t    counters[NCOUNTERS];	    /* Snapshot of Counters */
+    uint64_t    free_blocks;		    /* Number of blocks in free list */
+    uint64_t    free_bytes;		    /* Total capacity in free list */
+    uint64_t    free_slack;		    /* Unused capacity in free list */
+    uint64_t    largest_free;		    /* Largest block in free list */
+
+    SizeClassStats  classes[STATS_CLASSES]; /* Size class i holds (2^(i-1), 2^i] */
+    Percentiles     latency[NOPERATIONS];   /* Call latency (cycles, 0 when disabled) */
+} StatsPage;
+
+/* Stats Macros */
+
+#define STATS_CLASS(size) \
+    ((size) <= 1 ? 0 : ((size) > (1UL<<(STATS_CLASSES - 2)) ? STATS_CLASSES - 1 : 64 - __builtin_clzl((size) - 1)))
+
+/* Stats Functions */
+
+extern StatsPage *Stats;    /* Published page (NULL when disabled) */
+
+void    stats_init();
+void    stats_snapshot(StatsPage *page);
+void    stats_publish(bool force);
+
+void    stats_malloc(size_t size);
+void    stats_free(size_t size);
+
+/* Only pay for live statistics when they are enabled */
+#define STATS_MALLOC(size)  do { if (Stats) stats_malloc(size); } while (0)
+#define STATS_FREE(size)    do { if (Stats) stats_free(size); } while (0)
+#define STATS_PUBLISH()     do { if (Stats) stats_publish(false); } while (0)
+
+/**
+ * Take a consistent copy of a (possibly remote) stats page.
+ *
+ * Retries while the publisher is in the middle of an update, so readers never
+ * block the allocating process.
+ * @param   page    Pointer to mapped stats page.
+ * @param   copy    Pointer to structure to copy page into.
+ * @return  Whether or not a consistent copy was made.
+ **/
+static inline bool stats_read(const StatsPage *page, StatsPage *copy) {
+    for (int attempt = 0; attempt < (1<<16); attempt++) {
+        uint64_t before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            continue;
+        }
+
+        memcpy(copy, page, sizeof(StatsPage));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == before) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
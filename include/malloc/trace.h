@@ -0,0 +1,60 @@
+/* trace.h: Allocation Trace Recording */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "malloc/latency.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Trace Constants */
+
+#define TRACE_MAGIC     0x31454341525448ULL	/* "HTRACE1" */
+#define TRACE_VERSION   1
+#define TRACE_BUFFER    (1<<12)			/* Records buffered between writes */
+
+/* Trace Structures
+ *
+ * A trace file is a TraceHeader followed by TraceRecords in the order the
+ * calls completed.  Pointers are replaced by object ids (numbered from 1 in
+ * allocation order), so a trace can be replayed against any allocator.  An id
+ * of 0 means NULL or a pointer allocated before tracing started.
+ **/
+
+typedef struct {
+    uint64_t    magic;		/* TRACE_MAGIC */
+    uint32_t    version;	/* TRACE_VERSION */
+    uint32_t    pid;		/* Process that recorded the trace */
+} TraceHeader;
+
+typedef struct {
+    uint64_t    timestamp;	/* Nanoseconds since tracing started */
+    uint64_t    size;		/* Bytes requested (nmemb * size for calloc) */
+    uint32_t    id;		/* Object returned (malloc, calloc, realloc) */
+    uint32_t    old;		/* Object passed in (free, realloc) */
+    uint16_t    thread;		/* Thread number (in order of first call) */
+    uint8_t     operation;	/* OP_MALLOC, OP_FREE, OP_REALLOC, OP_CALLOC */
+    uint8_t     reserved[5];
+} TraceRecord;
+
+/* Trace Functions */
+
+extern bool TraceEnabled;   /* Whether MALLOC_TRACE is recording */
+
+void        trace_init();
+uint32_t    trace_forget(void *ptr);
+void        trace_restore(void *ptr, uint32_t id);
+void        trace_record(int operation, void *ptr, uint32_t old, size_t size);
+
+/* Only pay for tracing when it is enabled */
+#define TRACE_FORGET(ptr)   (TraceEnabled && (ptr) ? trace_forget(ptr) : 0)
+#define TRACE_RESTORE(ptr, id) \
+    do { if (id) trace_restore((ptr), (id)); } while (0)
+#define TRACE_RECORD(operation, ptr, old, size) \
+    do { if (TraceEnabled) trace_record((operation), (ptr), (old), (size)); } while (0)
+
+#endif
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -1,28 +1,37 @@
 /* block.c: Block Structure */
 
 #include "malloc/block.h"
+#include "malloc/budget.h"
 #include "malloc/counters.h"
+#include "malloc/heap.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 /**
- * Allocate a new block on the heap using sbrk:
+ * Allocate a new block by growing a heap region:
  *
  *  1. Determined aligned amount of memory to allocate.
  *  2. Allocate memory on the heap.
  *  3. Set allocage block properties.
  *
+ * @param   grow    Function that moves the region break (sbrk contract).
  * @param   size    Number of bytes to allocate.
  * @return  Pointer to data portion of newly allocate block.
  **/
-Block *	block_allocate(size_t size) {
+static Block *	block_grow(void *(*grow)(intptr_t), size_t size) {
     // Allocate block
     intptr_t allocated = sizeof(Block) + ALIGN(size);
-    Block *  block     = sbrk(allocated);
+    if (!budget_charge(allocated, false)) {
+        return NULL;
+    }
+
+    Block *  block     = grow(allocated);
     if (block == SBRK_FAILURE) {
+        budget_credit(allocated, false);
     	return NULL;
     }
 
@@ -33,16 +42,38 @@ Block *	block_allocate(size_t size) {
     block->next     = block;
 
     // Update counters
-    Counters[HEAP_SIZE] += allocated;
-    Counters[BLOCKS]++;
-    Counters[GROWS]++;
+    COUNTER_ADD(HEAP_SIZE, allocated);
+    budget_credit(allocated, false);
+    COUNTER_INC(BLOCKS);
+    COUNTER_INC(GROWS);
     return block;
 }
 
+/**
+ * Allocate a new block on the heap using heap_sbrk.
+ *
+ * @param   size    Number of bytes to allocate.
+ * @return  Pointer to data portion of newly allocate block.
+ **/
+Block *	block_allocate(size_t size) {
+    return block_grow(heap_sbrk, size);
+}
+
+/**
+ * Allocate a new block in the long-lived region using heap_sbrk_long.
+ *
+ * @param   size    Number of bytes to allocate.
+ * @return  Pointer to data portion of newly allocate block.
+ **/
+Block *	block_allocate_long(size_t size) {
+    return block_grow(heap_sbrk_long, size);
+}
+
 /**
  * Attempt to release memory used by block to heap:
  *
- *  1. If the block is at the end of the heap.
+ *  1. If the block is at the end of the heap (or of the long-lived region
+ *  it was allocated in).
  *  2. The block capacity meets the trim threshold.
  *
  * @param   block   Pointer to block to release.
@@ -55,7 +86,8 @@ bool	block_release(Block *block) {
     // Counters[SHRINKS]++;
     // Counters[HEAP_SIZE] -= allocated;
 
-    intptr_t endHeap  = (intptr_t)sbrk(0);
+    void *(*grow)(intptr_t) = heap_long(block) ? heap_sbrk_long : heap_sbrk;
+    intptr_t endHeap  = (intptr_t)grow(0);
     if (endHeap == (intptr_t)SBRK_FAILURE)
         return false;
 
@@ -68,15 +100,64 @@ bool	block_release(Block *block) {
     
         allocated = block->capacity + sizeof(Block);
        
-        Counters[BLOCKS]--;
-        Counters[SHRINKS]++;
-        Counters[HEAP_SIZE] -= allocated;
-        sbrk(allocated * -1);
+        COUNTER_DEC(BLOCKS);
+        COUNTER_INC(SHRINKS);
+        COUNTER_SUB(HEAP_SIZE, allocated);
+        grow(allocated * -1);
         return true;
     }
     return false;
 }
 
+/**
+ * Allocate a block in its own anonymous mapping (which the kernel zeroes):
+ *
+ *  1. Round header and requested size up to whole pages.
+ *  2. Map the memory and mark the capacity with BLOCK_MAPPED, so release
+ *  knows to unmap it rather than return it to the heap.
+ *
+ * Mapped blocks are never part of the heap or the free list, so they do not
+ * change HEAP_SIZE or BLOCKS (they are charged to the budget separately).
+ * @param   size    Number of bytes to allocate.
+ * @return  Pointer to newly mapped block.
+ **/
+Block * block_map(size_t size) {
+    size_t page      = getpagesize();
+    size_t allocated = (sizeof(Block) + ALIGN(size) + page - 1) & ~(page - 1);
+    if (allocated < size || !budget_charge(allocated, true)) {
+        return NULL;
+    }
+
+    Block *block = mmap(NULL, allocated, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        budget_credit(allocated, true);
+        return NULL;
+    }
+
+    block->capacity = (allocated - sizeof(Block)) | BLOCK_MAPPED;
+    block->size     = size;
+    block->prev     = block;
+    block->next     = block;
+    return block;
+}
+
+/**
+ * Unmap block if it was allocated with block_map.
+ *
+ * @param   block   Pointer to block to release.
+ * @return  Whether or not the block was mapped (and is now unmapped).
+ **/
+bool    block_unmap(Block *block) {
+    if (!(block->capacity & BLOCK_MAPPED)) {
+        return false;
+    }
+
+    size_t allocated = sizeof(Block) + (block->capacity & ~BLOCK_MAPPED);
+    munmap(block, allocated);
+    budget_credit(allocated, true);
+    return true;
+}
+
 /**
  * Detach specified block from its neighbors.
  *
@@ -120,8 +201,8 @@ bool	block_merge(Block *dst, Block *src) {
         //dst->size += src->size;
         //dst->next = src->next;
 
-        Counters[MERGES]++;
-        Counters[BLOCKS]--;
+        COUNTER_INC(MERGES);
+        COUNTER_DEC(BLOCKS);
         return true;
     }
 
@@ -158,8 +239,8 @@ Block * block_split(Block *block, size_t size) {
         block->size = size;
         block->next = new;
        
-        Counters[SPLITS]++;
-        Counters[BLOCKS]++;
+        COUNTER_INC(SPLITS);
+        COUNTER_INC(BLOCKS);
     }
     else{
         block->size = size;
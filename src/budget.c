@@ -0,0 +1,190 @@
+/* budget.c: Heap Memory Budget
+ *
+ * MALLOC_BUDGET_SOFT and MALLOC_BUDGET_HARD (in MB), or malloc_set_budget,
+ * bound how large the heap may grow (see budget.h).  A hard limit turns the
+ * sbrk (or OOM kill) that would have come later into a clean NULL now; a
+ * soft limit below it gives the program a chance to give memory back first.
+ *
+ * Checks only happen when the heap grows or a block is mapped, so a budget
+ * costs nothing on allocations served from the free list.  Mapped blocks are
+ * tracked whether or not a limit is set, so one set (or lifted) while they
+ * are live still sees them.  calloc maps blocks without the heap lock, so
+ * the limits, threshold and pressure flag are only touched atomically, and a
+ * charge reserves its bytes before comparing against the hard limit (backing
+ * out if they do not fit), so two racing charges cannot both squeeze in.
+ **/
+
+#include "malloc/budget.h"
+#include "malloc/counters.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+/* Structures */
+
+typedef struct {
+    PressureCallback    callback;
+    void *              arg;
+} PressureHandler;
+
+/* Global Variables */
+
+bool                    BudgetPressure = false;
+
+static size_t           Soft      = 0;	    /* Soft limit in bytes (0 for none) */
+static size_t           Hard      = 0;	    /* Hard limit in bytes (0 for none) */
+static size_t           Threshold = 0;	    /* Usage that next flags pressure */
+static size_t           Mapped    = 0;	    /* Bytes in blocks mapped on their own */
+static size_t           Pending   = 0;	    /* Bytes of heap growth not yet in HEAP_SIZE */
+static bool             Relieving = false;  /* Whether a thread is relieving pressure */
+static PressureHandler  Handlers[BUDGET_CALLBACKS];
+static size_t           NHandlers = 0;
+static pthread_mutex_t  Lock      = PTHREAD_MUTEX_INITIALIZER;
+
+/* Functions */
+
+/**
+ * Set the limits from MALLOC_BUDGET_SOFT and MALLOC_BUDGET_HARD (in MB), if
+ * either is set.
+ **/
+void    budget_init() {
+    const char *soft = getenv("MALLOC_BUDGET_SOFT");
+    const char *hard = getenv("MALLOC_BUDGET_HARD");
+
+    if (soft || hard) {
+        budget_set(soft ? strtoul(soft, NULL, 10) << 20 : 0, hard ? strtoul(hard, NULL, 10) << 20 : 0);
+    }
+}
+
+/**
+ * Set the limits (0 removes a limit).
+ * @param   soft    Usage past which pressure is signaled.
+ * @param   hard    Usage the heap may never grow past.
+ * @return  Whether the limits were valid (soft must not exceed hard).
+ **/
+bool    budget_set(size_t soft, size_t hard) {
+    if (soft && hard && soft > hard) {
+        return false;
+    }
+
+    __atomic_store_n(&Soft, soft, __ATOMIC_RELAXED);
+    __atomic_store_n(&Hard, hard, __ATOMIC_RELAXED);
+    __atomic_store_n(&Threshold, soft, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * Register a function to call when the soft (or hard) limit is reached.
+ * Callbacks run without any allocator lock held, so they may free (and
+ * allocate) memory.
+ * @param   callback    Function to call with usage and the limit reached.
+ * @param   arg         Argument passed through to callback.
+ * @return  Whether there was room for another callback.
+ **/
+bool    budget_register(PressureCallback callback, void *arg) {
+    bool registered = false;
+
+    pthread_mutex_lock(&Lock);
+    if (NHandlers < BUDGET_CALLBACKS) {
+        Handlers[NHandlers] = (PressureHandler){callback, arg};
+        __atomic_store_n(&NHandlers, NHandlers + 1, __ATOMIC_RELEASE);
+        registered = true;
+    }
+    pthread_mutex_unlock(&Lock);
+    return registered;
+}
+
+/**
+ * Return how much of the budget is in use.
+ **/
+size_t  budget_used() {
+    return counter_read(HEAP_SIZE) + __atomic_load_n(&Mapped, __ATOMIC_RELAXED) +
+           __atomic_load_n(&Pending, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reserve memory about to be added to the heap (or mapped) within the
+ * budget, flagging pressure past the soft limit.  Heap growth stays reserved
+ * until budget_credit hands it over to HEAP_SIZE (or gives it back).
+ * @param   bytes   Number of bytes about to be added.
+ * @param   mapped  Whether they are a block mapped on its own.
+ * @return  Whether the memory may be added (errno is ENOMEM otherwise).
+ **/
+bool    budget_charge(size_t bytes, bool mapped) {
+    size_t *charged = mapped ? &Mapped : &Pending;
+    size_t  soft    = __atomic_load_n(&Soft, __ATOMIC_RELAXED);
+    size_t  hard    = __atomic_load_n(&Hard, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(charged, bytes, __ATOMIC_RELAXED);
+    if (soft || hard) {
+        size_t used = budget_used();
+        if (hard && used > hard) {
+            __atomic_sub_fetch(charged, bytes, __ATOMIC_RELAXED);
+            __atomic_store_n(&BudgetPressure, true, __ATOMIC_RELAXED);
+            errno = ENOMEM;
+            return false;
+        }
+
+        // Only the thread that moves the threshold flags the crossing
+        size_t threshold = __atomic_load_n(&Threshold, __ATOMIC_RELAXED);
+        while (soft && used > threshold) {
+            if (__atomic_compare_exchange_n(&Threshold, &threshold, used + soft / BUDGET_STEP, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&BudgetPressure, true, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Release a charge: a mapped block that was unmapped, or heap growth that
+ * failed or has been added to HEAP_SIZE (which counts it from then on).
+ * @param   bytes   Number of bytes charged.
+ * @param   mapped  Whether they were a block mapped on its own.
+ **/
+void    budget_credit(size_t bytes, bool mapped) {
+    __atomic_sub_fetch(mapped ? &Mapped : &Pending, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Claim the pending relief (only one thread relieves pressure at a time).
+ * @return  Whether the caller should relieve pressure.
+ **/
+bool    budget_relief_begin() {
+    bool relieving = false;
+    if (!__atomic_compare_exchange_n(&Relieving, &relieving, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    __atomic_store_n(&BudgetPressure, false, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * Call every pressure callback with current usage and the limit reached.
+ **/
+void    budget_notify() {
+    size_t used  = budget_used();
+    size_t soft  = __atomic_load_n(&Soft, __ATOMIC_RELAXED);
+    size_t limit = soft && used > soft ? soft : __atomic_load_n(&Hard, __ATOMIC_RELAXED);
+    size_t count = __atomic_load_n(&NHandlers, __ATOMIC_ACQUIRE);
+
+    for (size_t i = 0; i < count; i++) {
+        Handlers[i].callback(used, limit, Handlers[i].arg);
+    }
+}
+
+/**
+ * Finish relieving pressure: once usage is back under the soft limit, the
+ * next crossing signals pressure again.
+ **/
+void    budget_relief_end() {
+    size_t soft = __atomic_load_n(&Soft, __ATOMIC_RELAXED);
+    if (budget_used() <= soft) {
+        __atomic_store_n(&Threshold, soft, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&Relieving, false, __ATOMIC_RELEASE);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -1,19 +1,198 @@
 /* counters.c: Counters */
 
 #include "malloc/block.h"
+#include "malloc/budget.h"
 #include "malloc/counters.h"
 #include "malloc/freelist.h"
+#include "malloc/guard.h"
+#include "malloc/heapmap.h"
+#include "malloc/latency.h"
+#include "malloc/lifetime.h"
+#include "malloc/lines.h"
+#include "malloc/persist.h"
+#include "malloc/profile.h"
+#include "malloc/stats.h"
+#include "malloc/trace.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 /* Global Variables */
 
-extern Block FreeList;
-size_t Counters[NCOUNTERS] = {0};
 int    DumpFD              = -1;
+bool   CountersInitialized = false;
+
+#if ACCOUNTING == ACCOUNTING_SHARDED
+
+/* Sharded Counters
+ *
+ * Each thread claims one of the Shards the first time it updates a counter and
+ * then updates it without any atomic read-modify-write.  When a thread exits,
+ * its partial sums are folded into Retired and the shard is recycled.  If more
+ * threads are alive than there are shards, the extra threads share Overflow
+ * and update it atomically.
+ *
+ * The kept counters (GROWS, SHRINKS, HEAP_SIZE) bypass the shards and live in
+ * KeptCounters, so reading them (as the budget does on every heap growth)
+ * is a single load.
+ **/
+
+__thread CounterShard *LocalShard __attribute__((tls_model("initial-exec"))) = NULL;
+size_t                 KeptCounters[NCOUNTERS] = {0};
+
+static CounterShard     Shards[COUNTER_SHARDS];
+static CounterShard     Overflow = {.shared = 1};
+static size_t           Retired[NCOUNTERS];
+static size_t           Claimed  = 0;
+static CounterShard *   Recycled[COUNTER_SHARDS];
+static size_t           NRecycled = 0;
+static pthread_mutex_t  ShardsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t    ShardsKey;
+static pthread_once_t   ShardsOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Fold the exiting thread's shard into the retired totals and recycle it.
+ * @param   arg     Pointer to the thread's shard.
+ **/
+static void counters_retire(void *arg) {
+    CounterShard *shard = arg;
+
+    pthread_mutex_lock(&ShardsLock);
+    for (size_t c = 0; c < NCOUNTERS; c++) {
+        Retired[c] += shard->counters[c];
+        shard->counters[c] = 0;
+    }
+    Recycled[NRecycled++] = shard;
+    pthread_mutex_unlock(&ShardsLock);
+
+    LocalShard = NULL;
+}
+
+/**
+ * Hold ShardsLock across fork, so the child does not inherit it locked by a
+ * thread that no longer exists.
+ **/
+static void counters_prefork() {
+    pthread_mutex_lock(&ShardsLock);
+}
+
+static void counters_postfork() {
+    pthread_mutex_unlock(&ShardsLock);
+}
+
+static void counters_key() {
+    pthread_key_create(&ShardsKey, counters_retire);
+    pthread_atfork(counters_prefork, counters_postfork, counters_postfork);
+}
+
+/**
+ * Claim a shard for the current thread (or the shared Overflow shard if they
+ * are all in use).
+ * @return  Pointer to current thread's shard.
+ **/
+CounterShard *counters_shard() {
+    CounterShard *shard = &Overflow;
+
+    pthread_mutex_lock(&ShardsLock);
+    if (NRecycled) {
+        shard = Recycled[--NRecycled];
+    } else if (Claimed < COUNTER_SHARDS) {
+        shard = &Shards[Claimed++];
+    }
+    pthread_mutex_unlock(&ShardsLock);
+
+    // Set before registering the destructor, which may itself allocate
+    LocalShard = shard;
+    if (shard != &Overflow) {
+        pthread_once(&ShardsOnce, counters_key);
+        pthread_setspecific(ShardsKey, shard);
+    }
+    return shard;
+}
+
+/**
+ * Sum all shards into a snapshot of the counters.
+ * @param   counters    Array to store summed counters in.
+ **/
+void counters_snapshot(size_t counters[NCOUNTERS]) {
+    pthread_mutex_lock(&ShardsLock);
+    for (size_t c = 0; c < NCOUNTERS; c++) {
+        size_t sum = Retired[c] + __atomic_load_n(&Overflow.counters[c], __ATOMIC_RELAXED) +
+                     __atomic_load_n(&KeptCounters[c], __ATOMIC_RELAXED);
+        for (size_t s = 0; s < Claimed; s++) {
+            sum += __atomic_load_n(&Shards[s].counters[c], __ATOMIC_RELAXED);
+        }
+        counters[c] = sum;
+    }
+    pthread_mutex_unlock(&ShardsLock);
+}
+
+/**
+ * Add saved counters (such as those of a reattached heap) to the totals.
+ * @param   counters    Array of counters to add.
+ **/
+void counters_restore(const size_t counters[NCOUNTERS]) {
+    pthread_mutex_lock(&ShardsLock);
+    for (size_t c = 0; c < NCOUNTERS; c++) {
+        if (COUNTER_KEPT(c)) {
+            __atomic_add_fetch(&KeptCounters[c], counters[c], __ATOMIC_RELAXED);
+        } else {
+            Retired[c] += counters[c];
+        }
+    }
+    pthread_mutex_unlock(&ShardsLock);
+}
+
+/**
+ * Read one counter (kept counters without taking ShardsLock).
+ * @param   counter Counter to read.
+ * @return  Current value of the counter.
+ **/
+size_t counter_read(int counter) {
+    size_t counters[NCOUNTERS];
+
+    if (COUNTER_KEPT(counter)) {
+        return __atomic_load_n(&KeptCounters[counter], __ATOMIC_RELAXED);
+    }
+    counters_snapshot(counters);
+    return counters[counter];
+}
+
+#else
+
+size_t Counters[NCOUNTERS] = {0};
+
+/**
+ * Copy the counters array into a snapshot.
+ * @param   counters    Array to store counters in.
+ **/
+void counters_snapshot(size_t counters[NCOUNTERS]) {
+    memcpy(counters, Counters, sizeof(Counters));
+}
+
+/**
+ * Add saved counters (such as those of a reattached heap) to the totals.
+ * @param   counters    Array of counters to add.
+ **/
+void counters_restore(const size_t counters[NCOUNTERS]) {
+    for (size_t c = 0; c < NCOUNTERS; c++) {
+        __atomic_add_fetch(&Counters[c], counters[c], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Read one counter.
+ * @param   counter Counter to read.
+ * @return  Current value of the counter.
+ **/
+size_t counter_read(int counter) {
+    return __atomic_load_n(&Counters[counter], __ATOMIC_RELAXED);
+}
+
+#endif
 
 /* Functions */
 
@@ -22,18 +201,33 @@ int    DumpFD              = -1;
  *
  *  1. Register the dump_counters function to run when the program terminates.
  *  2. Duplicate standard output file descriptor to the DumpFD global variable.
+ *  3. Attach the persistent heap, map the live stats page and latency
+ *     histograms, start the heap profiler, open the allocation trace, turn
+ *     on lifetime prediction, arm heap map dumps, reserve the guard page
+ *     pool, set the memory budget and carve per-thread lines (if enabled).
  *
  * Note, these actions should only be performed once regardless of how many
  * times the function is called.
  **/
 void init_counters() {
-    static bool initialized = false;
-
-    if (!initialized) {
+    if (!CountersInitialized) {
         assert(atexit(dump_counters) == 0);
-        initialized = true;
-        DumpFD      = dup(STDOUT_FILENO);
+        CountersInitialized = true;
+        DumpFD              = dup(STDOUT_FILENO);
         assert(DumpFD >= 0);
+        persist_init();
+        latency_init();
+        stats_init();
+        profile_init();
+        trace_init();
+        lifetime_init();
+        heapmap_init();
+        guard_init();
+        budget_init();
+        lines_init();
+#if ACCOUNTING == ACCOUNTING_SHARDED
+        pthread_once(&ShardsOnce, counters_key);
+#endif
     }
 }
 
@@ -42,22 +236,22 @@ void init_counters() {
  *
  *  FRAGMENTATION = Sum(internal fragments) / HeapSize * 100.0
  *
+ * Note, this uses the running free list totals, so it is O(1) and safe to call
+ * at any time (not just at exit).
+ *
  * @return  Percentage of internal fragmentation in heap.
  **/
 double  internal_fragmentation() {
-    // TODO: Implement internal fragmentation computation
-    size_t totalFree   = 0;
+    FreeStats stats;
+    size_t    heap_size = counter_read(HEAP_SIZE);
 
-    if (Counters[HEAP_SIZE] == 0)
+    if (heap_size == 0)
         return 0;
 
-    for (Block *block = FreeList.next; block != &FreeList; block = block->next){
-        totalFree += (block->capacity - block->size);
-    }
-    
-    if (totalFree == 0)
+    free_list_stats(&stats);
+    if (stats.slack == 0)
         return 0;
-    return (double)totalFree / Counters[HEAP_SIZE] * 100;
+    return (double)stats.slack / heap_size * 100;
 }
 
 /**
@@ -67,25 +261,21 @@ double  internal_fragmentation() {
  *
  * https://www.edn.com/design/systems-design/4333346/Handling-memory-fragmentation
  *
+ * Note, this uses the running free list totals, so it is O(1) and safe to call
+ * at any time (not just at exit).
+ *
  * @return  Percentage of external fragmentation in heap.
  **/
 double  external_fragmentation() {
-    // TODO: Implement external fragmentation computation
-    size_t largestFree = 0;
-    size_t totalFree   = 0;
-    
-    if (Counters[HEAP_SIZE] == 0)
-        return 0;
+    FreeStats stats;
 
-    for (Block *block = FreeList.next; block != &FreeList; block = block->next){
-        if (block->capacity > largestFree)
-            largestFree = block->capacity;
-        totalFree += block->capacity;
-    }
+    if (counter_read(HEAP_SIZE) == 0)
+        return 0;
 
-    if (totalFree == 0)
+    free_list_stats(&stats);
+    if (stats.bytes == 0)
         return 0;
-    return (1 - ((double)largestFree/totalFree)) * 100;
+    return (1 - ((double)stats.largest/stats.bytes)) * 100;
 }
 
 /**
@@ -96,25 +286,34 @@ double  external_fragmentation() {
  * of the function.
  **/
 void dump_counters() {
-    char buffer[BUFSIZ];
+    char      buffer[BUFSIZ];
+    size_t    counters[NCOUNTERS];
+    FreeStats stats;
     assert(DumpFD >= 0);
 
-    fdprintf(DumpFD, buffer, "blocks:      %lu\n"   , Counters[BLOCKS]);
-    fdprintf(DumpFD, buffer, "free blocks: %lu\n"   , free_list_length());
-    fdprintf(DumpFD, buffer, "mallocs:     %lu\n"   , Counters[MALLOCS]);
-    fdprintf(DumpFD, buffer, "frees:       %lu\n"   , Counters[FREES]);
-    fdprintf(DumpFD, buffer, "callocs:     %lu\n"   , Counters[CALLOCS]);
-    fdprintf(DumpFD, buffer, "reallocs:    %lu\n"   , Counters[REALLOCS]);
-    fdprintf(DumpFD, buffer, "reuses:      %lu\n"   , Counters[REUSES]);
-    fdprintf(DumpFD, buffer, "grows:       %lu\n"   , Counters[GROWS]);
-    fdprintf(DumpFD, buffer, "shrinks:     %lu\n"   , Counters[SHRINKS]);
-    fdprintf(DumpFD, buffer, "splits:      %lu\n"   , Counters[SPLITS]);
-    fdprintf(DumpFD, buffer, "merges:      %lu\n"   , Counters[MERGES]);
-    fdprintf(DumpFD, buffer, "requested:   %lu\n"   , Counters[REQUESTED]);
-    fdprintf(DumpFD, buffer, "heap size:   %lu\n"   , Counters[HEAP_SIZE]);
+    counters_snapshot(counters);
+    free_list_stats(&stats);
+
+    fdprintf(DumpFD, buffer, "blocks:      %lu\n"   , counters[BLOCKS]);
+    fdprintf(DumpFD, buffer, "free blocks: %lu\n"   , stats.blocks);
+    fdprintf(DumpFD, buffer, "mallocs:     %lu\n"   , counters[MALLOCS]);
+    fdprintf(DumpFD, buffer, "frees:       %lu\n"   , counters[FREES]);
+    fdprintf(DumpFD, buffer, "callocs:     %lu\n"   , counters[CALLOCS]);
+    fdprintf(DumpFD, buffer, "reallocs:    %lu\n"   , counters[REALLOCS]);
+    fdprintf(DumpFD, buffer, "reuses:      %lu\n"   , counters[REUSES]);
+    fdprintf(DumpFD, buffer, "grows:       %lu\n"   , counters[GROWS]);
+    fdprintf(DumpFD, buffer, "shrinks:     %lu\n"   , counters[SHRINKS]);
+    fdprintf(DumpFD, buffer, "splits:      %lu\n"   , counters[SPLITS]);
+    fdprintf(DumpFD, buffer, "merges:      %lu\n"   , counters[MERGES]);
+    fdprintf(DumpFD, buffer, "requested:   %lu\n"   , counters[REQUESTED]);
+    fdprintf(DumpFD, buffer, "heap size:   %lu\n"   , counters[HEAP_SIZE]);
     fdprintf(DumpFD, buffer, "internal:    %4.2lf\n", internal_fragmentation());
     fdprintf(DumpFD, buffer, "external:    %4.2lf\n", external_fragmentation());
 
+    if (Latency) {
+        latency_dump(DumpFD);
+    }
+
     close(DumpFD);
 }
 
@@ -0,0 +1,209 @@
+/* defer.c: Deferred Frees
+ *
+ * free_deferred() (and free() itself when MALLOC_DEFER is set) only pushes
+ * the pointer onto a per-thread chain, so the calling thread never waits for
+ * the heap lock, a long free list insert, or the sbrk that shrinks the heap.
+ *
+ * Every DEFER_BATCH frees, the chain is handed to a background reclaimer
+ * thread (started on first use) with one compare and swap, and the reclaimer
+ * frees whole batches at a time.  A thread's partial chain is handed off when
+ * it exits, or when defer_drain is called from it.
+ *
+ * If the reclaimer falls more than DEFER_BACKLOG frees behind (it has no CPU
+ * of its own, say), threads free in place until it catches up, so deferred
+ * memory stays bounded and no single free pays for more than itself.
+ * Whatever is still pending at exit is freed before the counters are dumped.
+ **/
+
+#include "malloc/defer.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+/* Global Variables */
+
+bool                    DeferEnabled = false;
+
+static DeferReclaimer   Reclaimer    = NULL;
+static void *           Pending      = NULL;	/* Chains handed off, not yet reclaimed */
+static size_t           Backlog      = 0;	/* Frees in Pending (approximately) */
+static bool             Started      = false;	/* Whether the reclaimer thread runs */
+static pthread_mutex_t  Lock         = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  Busy         = PTHREAD_MUTEX_INITIALIZER;	/* Held while reclaiming */
+static pthread_cond_t   Wakeup       = PTHREAD_COND_INITIALIZER;
+static pthread_key_t    ExitKey;
+
+static __thread void *  Head         = NULL;	/* This thread's chain */
+static __thread void *  Tail         = NULL;
+static __thread size_t  Length       = 0;
+static __thread bool    Registered   = false;	/* Whether exit will flush the chain */
+
+/* Functions */
+
+/**
+ * Take every chain handed off so far and free it.
+ **/
+static void     defer_reclaim() {
+    pthread_mutex_lock(&Busy);
+    void *chain = __atomic_exchange_n(&Pending, NULL, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&Backlog, 0, __ATOMIC_RELAXED);
+    if (chain) {
+        Reclaimer(chain);
+    }
+    pthread_mutex_unlock(&Busy);
+}
+
+/**
+ * Reclaim chains as they are handed off, with every signal blocked (so
+ * handlers only ever run on the program's own threads).
+ **/
+static void *   defer_reclaimer(void *arg) {
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    while (true) {
+        pthread_mutex_lock(&Lock);
+        while (!__atomic_load_n(&Pending, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&Wakeup, &Lock);
+        }
+        pthread_mutex_unlock(&Lock);
+
+        defer_reclaim();
+    }
+    return NULL;
+}
+
+/**
+ * Start the reclaimer thread if it is not running yet.
+ * @return  Whether the reclaimer thread is running.
+ **/
+static bool     defer_start() {
+    if (__atomic_load_n(&Started, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    pthread_mutex_lock(&Lock);
+    if (!Started) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, defer_reclaimer, NULL) == 0) {
+            pthread_detach(thread);
+            __atomic_store_n(&Started, true, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&Lock);
+    return Started;
+}
+
+/**
+ * Hand off the chain of an exiting thread.
+ **/
+static void     defer_exit(void *value) {
+    defer_flush();
+}
+
+/**
+ * Threads do not survive fork: a child starts its own reclaimer (for chains
+ * still pending from the parent, too) on its first hand off.
+ **/
+static void     defer_atfork_child() {
+    pthread_mutex_init(&Lock, NULL);
+    pthread_mutex_init(&Busy, NULL);
+    pthread_cond_init(&Wakeup, NULL);
+    Started = false;
+}
+
+/**
+ * Set the function that frees handed off chains, enable deferring every free
+ * if MALLOC_DEFER is set, and drain deferred frees at exit.
+ * @param   reclaimer   Function to free a chain (called without any lock).
+ **/
+void    defer_init(DeferReclaimer reclaimer) {
+    const char *enabled = getenv("MALLOC_DEFER");
+
+    Reclaimer    = reclaimer;
+    DeferEnabled = enabled && *enabled && *enabled != '0';
+    pthread_key_create(&ExitKey, defer_exit);
+    pthread_atfork(NULL, NULL, defer_atfork_child);
+
+    // Registered after init_counters, so it runs before dump_counters
+    atexit(defer_drain);
+}
+
+/**
+ * Defer a free: push the pointer onto this thread's chain (and hand the
+ * chain off once it holds DEFER_BATCH pointers), or free it right away while
+ * the reclaimer is DEFER_BACKLOG frees behind.
+ * @param   ptr     Pointer to previously allocated memory.
+ **/
+void    defer_push(void *ptr) {
+    if (__builtin_expect(__atomic_load_n(&Backlog, __ATOMIC_RELAXED) >= DEFER_BACKLOG, 0)) {
+        *(void **)ptr = NULL;
+        Reclaimer(ptr);
+        return;
+    }
+
+    *(void **)ptr = Head;
+    if (!Head) {
+        Tail = ptr;
+        if (!Registered) {
+            Registered = true;
+            pthread_setspecific(ExitKey, &Registered);
+        }
+    }
+    Head = ptr;
+
+    if (__builtin_expect(++Length >= DEFER_BATCH, 0)) {
+        defer_flush();
+    }
+}
+
+/**
+ * Hand this thread's chain to the reclaimer (or free it right away if the
+ * reclaimer thread cannot be started).
+ **/
+void    defer_flush() {
+    void * head   = Head;
+    void * tail   = Tail;
+    size_t length = Length;
+
+    if (!head) {
+        return;
+    }
+    Head   = NULL;
+    Tail   = NULL;
+    Length = 0;
+
+    if (!defer_start()) {
+        Reclaimer(head);
+        return;
+    }
+
+    void *pending = __atomic_load_n(&Pending, __ATOMIC_RELAXED);
+    do {
+        *(void **)tail = pending;
+    } while (!__atomic_compare_exchange_n(&Pending, &pending, head, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&Backlog, length, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&Lock);
+    pthread_cond_signal(&Wakeup);
+    pthread_mutex_unlock(&Lock);
+}
+
+/**
+ * Free everything deferred so far by this thread and everything handed off
+ * by any thread (waiting for the reclaimer to finish the batch it is on).
+ **/
+void    defer_drain() {
+    void *head = Head;
+    Head   = NULL;
+    Tail   = NULL;
+    Length = 0;
+
+    if (head) {
+        Reclaimer(head);
+    }
+    defer_reclaim();
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
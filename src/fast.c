@@ -0,0 +1,123 @@
+/* fast.c: Inline Allocation Fast Path (slow side)
+ *
+ * malloc_fast and free_fast (see fast.h) are inlined into programs linked
+ * against libmalloc.a.  This file decides whether threads may cache at all,
+ * registers each caching thread so its cache is handed back to the heap when
+ * it exits, and flushes caches.
+ *
+ * A full class is handed back whole, in one trip through the heap lock, and
+ * loses its room until the thread misses on it again.
+ **/
+
+#include "malloc/fast.h"
+#include "malloc/guard.h"
+#include "malloc/latency.h"
+#include "malloc/lifetime.h"
+#include "malloc/lines.h"
+#include "malloc/persist.h"
+#include "malloc/profile.h"
+#include "malloc/stats.h"
+#include "malloc/trace.h"
+
+#include <pthread.h>
+
+/* Global Variables */
+
+bool                FastEnabled = false;
+__thread FastCache  MallocCache __attribute__((tls_model("initial-exec"))) = {{0}};
+
+static pthread_key_t    ExitKey;
+static DeferReclaimer   Reclaimer  = NULL;	/* Frees a chain of blocks */
+static __thread bool    Registered = false;	/* Whether exit will flush the cache */
+
+/* Functions */
+
+/**
+ * Hand an exiting thread's cache back to the heap (leaving no room, so frees
+ * from later destructors go straight to the heap).
+ **/
+static void fast_exit(void *value) {
+    (void)value;
+    malloc_fast_flush();
+}
+
+/**
+ * Allow caching unless a feature that must see every allocation and free is
+ * enabled (called once counters are initialized).
+ * @param   reclaimer   Function that frees a chain of pointers linked
+ *                      through their first word (heap_free_chain).
+ **/
+void    fast_init(DeferReclaimer reclaimer) {
+    Reclaimer   = reclaimer;
+    FastEnabled = !Latency && !Stats && !ProfileRate && !TraceEnabled &&
+                  !LifetimeEnabled && !GuardRate && !LinesEnabled && !Persist &&
+                  pthread_key_create(&ExitKey, fast_exit) == 0;
+}
+
+/**
+ * Hand a class of the calling thread's cache back to the heap and leave it
+ * no room.
+ * @param   class   Capacity class to empty.
+ **/
+static void fast_flush_class(size_t class) {
+    void * chain = MallocCache.head[class];
+    size_t n     = 0;
+
+    for (void *data = chain; data; data = *(void **)data) {
+        n++;
+    }
+
+    MallocCache.head[class] = NULL;
+    MallocCache.room[class] = 0;
+    if (chain) {
+        // The reclaimer counts these frees again
+        COUNTER_SUB(FREES, n);
+        Reclaimer(chain);
+    }
+}
+
+/**
+ * Allocate memory malloc_fast could not serve from the cache, giving the
+ * (empty) class room, so the blocks the thread frees next are kept for it.
+ * @param   size    Amount of bytes to allocate.
+ * @return  Pointer to the requested amount of memory.
+ **/
+void *  malloc_slow(size_t size) {
+    size_t class = (size - 1) / ALIGNMENT;
+
+    if (class < FAST_CLASSES && FastEnabled) {
+        if (!Registered) {
+            Registered = true;
+            pthread_setspecific(ExitKey, &MallocCache);
+        }
+        MallocCache.room[class] = FAST_DEPTH;
+    }
+    return malloc(size);
+}
+
+/**
+ * Release memory free_fast could not cache (handing the block's class back to
+ * the heap first if it is full).
+ * @param   ptr     Pointer to previously allocated memory.
+ **/
+void    free_slow(void *ptr) {
+    if (ptr) {
+        size_t class = (BLOCK_FROM_POINTER(ptr))->capacity / ALIGNMENT - 1;
+        if (class < FAST_CLASSES && MallocCache.head[class]) {
+            fast_flush_class(class);
+        }
+    }
+    free(ptr);
+}
+
+/**
+ * Hand every block in the calling thread's cache back to the heap (for
+ * instance before measuring or trimming it).
+ **/
+void    malloc_fast_flush() {
+    for (size_t class = 0; class < FAST_CLASSES; class++) {
+        fast_flush_class(class);
+    }
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,775 @@
+/* freeindex.c: Free List Size Index
+ *
+ * Each heap region (the main heap and the long-lived region) has an index
+ * that mirrors its free blocks as two contiguous arrays (capacities and
+ * blocks) kept in free list order.  The search functions scan the capacities
+ * array with SIMD compare-and-movemask (first fit) or min/max reduction (best
+ * and worst fit) kernels, which turns the pointer chase through cold heap
+ * memory into a streaming scan.
+ *
+ * Keeping the index up to date never scans it:
+ *
+ *  - A removed entry becomes a hole (capacity 0, which no search fits), so
+ *    the others keep their order and every fit breaks ties exactly like the
+ *    list walkers.  Holes are squeezed out once they are a quarter of the
+ *    index, so scans stay within 4/3 of the free list length.
+ *  - Each free block holds its entry in the first and last word of its
+ *    data (boundary tags), so a block's own entry and those of the free
+ *    blocks on either side of it are found by reading next to its header,
+ *    with no search.  A tag is only trusted once the entry it names points
+ *    back at the block, so stale tags left in allocated memory are ignored.
+ *  - A max tree over the capacities keeps the largest free block; changing
+ *    an entry only walks up its path (O(log n)) until a node stays the same.
+ *
+ * The arrays live in an anonymous mapping outside of the heap so they do not
+ * affect any of the heap counters.  If a mapping ever fails, the index is
+ * marked broken and the free list falls back to walking the list.
+ **/
+
+#define _GNU_SOURCE
+
+#include "malloc/freeindex.h"
+#include "malloc/freelist.h"
+#include "malloc/heap.h"
+
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INDEX_X86
+#endif
+
+/* Constants */
+
+#define INDEX_INITIAL   (1<<6)		/* Entries mapped at first */
+#define INDEX_HOLES     4		/* Squeeze holes out once 1/INDEX_HOLES of the index */
+#define INDEX_NOTFOUND  ((ssize_t)-1)
+
+/* Global Variables */
+
+FreeIndex Indexes[2] = {{0}};
+
+/* Scan Kernels
+ *
+ * Each kernel returns the position of the matching capacity (otherwise
+ * INDEX_NOTFOUND) and must agree exactly with the corresponding list walker in
+ * freelist.c:
+ *
+ *  - First fit:    first position with capacity >= size.
+ *  - Best fit:     last position with the smallest capacity >= size.
+ *  - Worst fit:    first position with the largest capacity, if >= size.
+ *
+ * The vector kernels compare capacities as signed 64-bit integers, which is
+ * safe since no capacity can exceed half of the address space.
+ **/
+
+typedef ssize_t (*Scanner)(const size_t *capacities, size_t n, size_t size);
+
+static ssize_t  scan_ff_scalar(const size_t *capacities, size_t n, size_t size) {
+    for (size_t i = 0; i < n; i++) {
+        if (capacities[i] >= size)
+            return i;
+    }
+    return INDEX_NOTFOUND;
+}
+
+static ssize_t  scan_bf_scalar(const size_t *capacities, size_t n, size_t size) {
+    ssize_t best     = INDEX_NOTFOUND;
+    size_t  smallest = SIZE_MAX;
+    for (size_t i = 0; i < n; i++) {
+        if (capacities[i] >= size && capacities[i] <= smallest) {
+            smallest = capacities[i];
+            best     = i;
+        }
+    }
+    return best;
+}
+
+static ssize_t  scan_wf_scalar(const size_t *capacities, size_t n, size_t size) {
+    ssize_t worst   = INDEX_NOTFOUND;
+    size_t  largest = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (worst == INDEX_NOTFOUND || capacities[i] > largest) {
+            largest = capacities[i];
+            worst   = i;
+        }
+    }
+    return (worst != INDEX_NOTFOUND && largest >= size) ? worst : INDEX_NOTFOUND;
+}
+
+#ifdef INDEX_X86
+
+/* Reduce per-lane best fit candidates: smallest value, ties go to the later
+ * position. */
+static void     reduce_bf(const long long *values, const long long *where, size_t lanes,
+                          size_t *smallest, ssize_t *best) {
+    for (size_t l = 0; l < lanes; l++) {
+        if (where[l] < 0)
+            continue;
+        if ((size_t)values[l] < *smallest || ((size_t)values[l] == *smallest && where[l] > *best)) {
+            *smallest = values[l];
+            *best     = where[l];
+        }
+    }
+}
+
+/* Reduce per-lane worst fit candidates: largest value, ties go to the earlier
+ * position. */
+static void     reduce_wf(const long long *values, const long long *where, size_t lanes,
+                          long long *largest, ssize_t *worst) {
+    for (size_t l = 0; l < lanes; l++) {
+        if (where[l] < 0)
+            continue;
+        if (values[l] > *largest || (values[l] == *largest && where[l] < *worst)) {
+            *largest = values[l];
+            *worst   = where[l];
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static ssize_t  scan_ff_avx2(const size_t *capacities, size_t n, size_t size) {
+    const __m256i needle = _mm256_set1_epi64x((long long)size - 1);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(capacities + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(capacities + i + 4));
+        int     m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(a, needle)))
+                  | _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, needle))) << 4;
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+
+    for (; i < n; i++) {
+        if (capacities[i] >= size)
+            return i;
+    }
+    return INDEX_NOTFOUND;
+}
+
+__attribute__((target("avx2")))
+static ssize_t  scan_bf_avx2(const size_t *capacities, size_t n, size_t size) {
+    const __m256i needle = _mm256_set1_epi64x((long long)size - 1);
+    const __m256i step   = _mm256_set1_epi64x(4);
+    __m256i smallest     = _mm256_set1_epi64x(LLONG_MAX);
+    __m256i where        = _mm256_set1_epi64x(-1);
+    __m256i position     = _mm256_setr_epi64x(0, 1, 2, 3);
+    size_t  i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v    = _mm256_loadu_si256((const __m256i *)(capacities + i));
+        __m256i fits = _mm256_cmpgt_epi64(v, needle);
+        __m256i take = _mm256_andnot_si256(_mm256_cmpgt_epi64(v, smallest), fits);
+        smallest = _mm256_blendv_epi8(smallest, v, take);
+        where    = _mm256_blendv_epi8(where, position, take);
+        position = _mm256_add_epi64(position, step);
+    }
+
+    long long values[4], positions[4];
+    _mm256_storeu_si256((__m256i *)values, smallest);
+    _mm256_storeu_si256((__m256i *)positions, where);
+
+    size_t  best_size = SIZE_MAX;
+    ssize_t best      = INDEX_NOTFOUND;
+    reduce_bf(values, positions, 4, &best_size, &best);
+
+    for (; i < n; i++) {
+        if (capacities[i] >= size && capacities[i] <= best_size) {
+            best_size = capacities[i];
+            best      = i;
+        }
+    }
+    return best;
+}
+
+__attribute__((target("avx2")))
+static ssize_t  scan_wf_avx2(const size_t *capacities, size_t n, size_t size) {
+    const __m256i step   = _mm256_set1_epi64x(4);
+    __m256i largest      = _mm256_set1_epi64x(-1);
+    __m256i where        = _mm256_set1_epi64x(-1);
+    __m256i position     = _mm256_setr_epi64x(0, 1, 2, 3);
+    size_t  i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v    = _mm256_loadu_si256((const __m256i *)(capacities + i));
+        __m256i take = _mm256_cmpgt_epi64(v, largest);
+        largest  = _mm256_blendv_epi8(largest, v, take);
+        where    = _mm256_blendv_epi8(where, position, take);
+        position = _mm256_add_epi64(position, step);
+    }
+
+    long long values[4], positions[4];
+    _mm256_storeu_si256((__m256i *)values, largest);
+    _mm256_storeu_si256((__m256i *)positions, where);
+
+    long long worst_size = -1;
+    ssize_t   worst      = INDEX_NOTFOUND;
+    reduce_wf(values, positions, 4, &worst_size, &worst);
+
+    for (; i < n; i++) {
+        if ((long long)capacities[i] > worst_size) {
+            worst_size = capacities[i];
+            worst      = i;
+        }
+    }
+    return (worst != INDEX_NOTFOUND && (size_t)worst_size >= size) ? worst : INDEX_NOTFOUND;
+}
+
+__attribute__((target("sse4.2")))
+static ssize_t  scan_ff_sse42(const size_t *capacities, size_t n, size_t size) {
+    const __m128i needle = _mm_set1_epi64x((long long)size - 1);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(capacities + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(capacities + i + 2));
+        int     m = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(a, needle)))
+                  | _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(b, needle))) << 2;
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+
+    for (; i < n; i++) {
+        if (capacities[i] >= size)
+            return i;
+    }
+    return INDEX_NOTFOUND;
+}
+
+__attribute__((target("sse4.2")))
+static ssize_t  scan_bf_sse42(const size_t *capacities, size_t n, size_t size) {
+    const __m128i needle = _mm_set1_epi64x((long long)size - 1);
+    const __m128i step   = _mm_set1_epi64x(2);
+    __m128i smallest     = _mm_set1_epi64x(LLONG_MAX);
+    __m128i where        = _mm_set1_epi64x(-1);
+    __m128i position     = _mm_set_epi64x(1, 0);
+    size_t  i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m128i v    = _mm_loadu_si128((const __m128i *)(capacities + i));
+        __m128i fits = _mm_cmpgt_epi64(v, needle);
+        __m128i take = _mm_andnot_si128(_mm_cmpgt_epi64(v, smallest), fits);
+        smallest = _mm_blendv_epi8(smallest, v, take);
+        where    = _mm_blendv_epi8(where, position, take);
+        position = _mm_add_epi64(position, step);
+    }
+
+    long long values[2], positions[2];
+    _mm_storeu_si128((__m128i *)values, smallest);
+    _mm_storeu_si128((__m128i *)positions, where);
+
+    size_t  best_size = SIZE_MAX;
+    ssize_t best      = INDEX_NOTFOUND;
+    reduce_bf(values, positions, 2, &best_size, &best);
+
+    for (; i < n; i++) {
+        if (capacities[i] >= size && capacities[i] <= best_size) {
+            best_size = capacities[i];
+            best      = i;
+        }
+    }
+    return best;
+}
+
+__attribute__((target("sse4.2")))
+static ssize_t  scan_wf_sse42(const size_t *capacities, size_t n, size_t size) {
+    const __m128i step   = _mm_set1_epi64x(2);
+    __m128i largest      = _mm_set1_epi64x(-1);
+    __m128i where        = _mm_set1_epi64x(-1);
+    __m128i position     = _mm_set_epi64x(1, 0);
+    size_t  i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        __m128i v    = _mm_loadu_si128((const __m128i *)(capacities + i));
+        __m128i take = _mm_cmpgt_epi64(v, largest);
+        largest  = _mm_blendv_epi8(largest, v, take);
+        where    = _mm_blendv_epi8(where, position, take);
+        position = _mm_add_epi64(position, step);
+    }
+
+    long long values[2], positions[2];
+    _mm_storeu_si128((__m128i *)values, largest);
+    _mm_storeu_si128((__m128i *)positions, where);
+
+    long long worst_size = -1;
+    ssize_t   worst      = INDEX_NOTFOUND;
+    reduce_wf(values, positions, 2, &worst_size, &worst);
+
+    for (; i < n; i++) {
+        if ((long long)capacities[i] > worst_size) {
+            worst_size = capacities[i];
+            worst      = i;
+        }
+    }
+    return (worst != INDEX_NOTFOUND && (size_t)worst_size >= size) ? worst : INDEX_NOTFOUND;
+}
+
+#endif
+
+/* Kernel Dispatch */
+
+static struct {
+    Scanner ff;
+    Scanner bf;
+    Scanner wf;
+} Scanners = {NULL, NULL, NULL};
+
+/**
+ * Select the widest scan kernels supported by the current processor.
+ **/
+static void     free_index_dispatch() {
+    Scanner ff = scan_ff_scalar;
+    Scanner bf = scan_bf_scalar;
+    Scanner wf = scan_wf_scalar;
+
+#ifdef INDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ff = scan_ff_avx2;
+        bf = scan_bf_avx2;
+        wf = scan_wf_avx2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        ff = scan_ff_sse42;
+        bf = scan_bf_sse42;
+        wf = scan_wf_sse42;
+    }
+#endif
+
+    Scanners.bf = bf;
+    Scanners.wf = wf;
+    Scanners.ff = ff;
+}
+
+/* Storage */
+
+/**
+ * Grow (or create) the mapping backing the index arrays.
+ * @param   old         Current mapping (NULL if none).
+ * @param   old_size    Size of current mapping in bytes.
+ * @param   new_size    Desired size of mapping in bytes.
+ * @return  Pointer to new mapping (otherwise NULL on failure).
+ **/
+static void *   free_index_map(void *old, size_t old_size, size_t new_size) {
+    void *mapping;
+    if (old) {
+        mapping = mremap(old, old_size, new_size, MREMAP_MAYMOVE);
+    } else {
+        mapping = mmap(NULL, new_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    }
+    return (mapping == MAP_FAILED) ? NULL : mapping;
+}
+
+/**
+ * Return the value of a node of the max tree: nodes below span are inner
+ * nodes (node n covers nodes 2n and 2n + 1), the rest are the capacities
+ * themselves.
+ **/
+static inline size_t free_index_node(const FreeIndex *index, size_t node) {
+    return node >= index->span ? index->capacities[node - index->span] : index->largest[node];
+}
+
+/**
+ * Recompute the max tree above entries [first, last) (last > first).
+ * @param   index   Index to update.
+ * @param   first   First entry that changed.
+ * @param   last    One past the last entry that changed.
+ **/
+static void     free_index_refresh(FreeIndex *index, size_t first, size_t last) {
+    for (size_t lo = (index->span + first) / 2, hi = (index->span + last - 1) / 2; lo; lo /= 2, hi /= 2) {
+        for (size_t node = lo; node <= hi; node++) {
+            size_t left  = free_index_node(index, 2 * node);
+            size_t right = free_index_node(index, 2 * node + 1);
+            index->largest[node] = left > right ? left : right;
+        }
+    }
+}
+
+/**
+ * Update the max tree after one entry changed, stopping at the first node
+ * that keeps its value (its ancestors keep theirs too).
+ * @param   index   Index to update.
+ * @param   i       Entry that changed.
+ **/
+static void     free_index_update(FreeIndex *index, size_t i) {
+    size_t  left  = index->capacities[i & ~(size_t)1];
+    size_t  right = index->capacities[i | 1];
+    size_t  value = left > right ? left : right;
+
+    for (size_t node = (index->span + i) / 2; node; node /= 2) {
+        if (index->largest[node] == value) {
+            break;
+        }
+        index->largest[node] = value;
+
+        size_t sibling = index->largest[node ^ 1];
+        value = value > sibling ? value : sibling;
+    }
+}
+
+/**
+ * Make the max tree cover the specified number of entries (a power of two,
+ * at least 2 and no less than the length), and recompute all of it.  The
+ * tree only ever spans the entries in use, so a short free list keeps a
+ * shallow tree.
+ * @param   index   Index to update.
+ * @param   span    Number of entries covered.
+ **/
+static void     free_index_span(FreeIndex *index, size_t span) {
+    index->span = span;
+    free_index_refresh(index, 0, span);
+}
+
+/**
+ * Double the number of entries available in the index.  The capacities,
+ * blocks and max tree share one mapping (laid out in that order), so they
+ * grow together or not at all.
+ * @param   index   Index to grow.
+ * @return  Whether or not the index has room for another entry.
+ **/
+static bool     free_index_grow(FreeIndex *index) {
+    size_t  old       = index->allocated;
+    size_t  allocated = old ? old * 2 : INDEX_INITIAL;
+    size_t *arrays    = free_index_map(index->capacities, 3 * old * sizeof(size_t), 3 * allocated * sizeof(size_t));
+    if (!arrays) {
+        index->broken = true;
+        return false;
+    }
+
+    // Move the tree and the blocks up to their new offsets (in that order,
+    // since the blocks land where the tree was) and clear the entries they
+    // leave behind
+    memcpy(arrays + 2 * allocated, arrays + 2 * old, index->span * sizeof(size_t));
+    memcpy(arrays + allocated, arrays + old, old * sizeof(Block *));
+    memset(arrays + old, 0, old * sizeof(size_t));
+
+    index->capacities = arrays;
+    index->blocks     = (Block **)(arrays + allocated);
+    index->largest    = arrays + 2 * allocated;
+    index->allocated  = allocated;
+    return true;
+}
+
+/**
+ * Return the index of the region holding specified block.
+ **/
+static inline FreeIndex *free_index_of(const Block *block) {
+    return &Indexes[heap_long(block)];
+}
+
+/**
+ * Write the tags of an entry's block (its first and last data word, which
+ * are the same word when it only has room for one).
+ * @param   index   Index holding the entry.
+ * @param   i       Entry to tag.
+ **/
+static inline void  free_index_tag(FreeIndex *index, size_t i) {
+    char *data = index->blocks[i]->data;
+    *(size_t *)data = i;
+    *(size_t *)(data + index->capacities[i] - sizeof(size_t)) = i;
+}
+
+/**
+ * Return the entry named by a tag if it belongs to the specified block.
+ * @param   index   Index to check.
+ * @param   tag     Tag read from memory (may be stale or user data).
+ * @param   block   Block the tag must lead to.
+ * @return  Entry (otherwise INDEX_NOTFOUND).
+ **/
+static inline ssize_t   free_index_entry(const FreeIndex *index, size_t tag, const Block *block) {
+    return tag < index->length && index->blocks[tag] == block ? (ssize_t)tag : INDEX_NOTFOUND;
+}
+
+/**
+ * Squeeze the holes out of the index, keeping the order of the entries.
+ * @param   index   Index to compact.
+ **/
+static void     free_index_compact(FreeIndex *index) {
+    size_t length = 0;
+
+    for (size_t i = 0; i < index->length; i++) {
+        Block *block = index->blocks[i];
+        if (!block) {
+            continue;
+        }
+
+        if (i != length) {
+            index->capacities[length] = index->capacities[i];
+            index->blocks[length]     = block;
+            free_index_tag(index, length);
+        }
+        length++;
+    }
+
+    memset(index->capacities + length, 0, (index->length - length) * sizeof(size_t));
+    memset(index->blocks + length, 0, (index->length - length) * sizeof(Block *));
+    index->length = length;
+    index->holes  = 0;
+
+    size_t span = index->span;
+    while (span > 2 && span / 2 >= length) {
+        span /= 2;
+    }
+    free_index_span(index, span);
+}
+
+/* Functions */
+
+/**
+ * Return whether or not the index mirrors the free list.
+ * @return  Whether or not the index can be used in place of the free list.
+ **/
+bool    free_index_valid() {
+    return !Indexes[0].broken && !Indexes[1].broken;
+}
+
+/**
+ * Append specified block to the end of the index of its region.
+ * @param   block   Pointer to block appended to the free list.
+ **/
+void    free_index_append(Block *block) {
+    FreeIndex *index = free_index_of(block);
+    if (index->broken) {
+        return;
+    }
+
+    if (index->length == index->allocated) {
+        if (index->holes && INDEX_HOLES * index->holes >= index->length) {
+            free_index_compact(index);
+        } else if (!free_index_grow(index)) {
+            return;
+        }
+    }
+
+    // Every block the allocator frees has room for its tags
+    if (block->capacity < sizeof(size_t)) {
+        index->broken = true;
+        return;
+    }
+
+    if (index->length == index->span) {
+        free_index_span(index, index->span ? 2 * index->span : 2);
+    }
+
+    index->capacities[index->length] = block->capacity;
+    index->blocks[index->length]     = block;
+    free_index_tag(index, index->length);
+    free_index_update(index, index->length);
+    index->length++;
+}
+
+/**
+ * Rebuild the indexes from the free list (after changing many blocks at
+ * once, or to repair a broken index).
+ **/
+void    free_index_rebuild() {
+    for (size_t r = 0; r < 2; r++) {
+        FreeIndex *index = &Indexes[r];
+        if (index->length) {
+            memset(index->capacities, 0, index->length * sizeof(size_t));
+            memset(index->blocks, 0, index->length * sizeof(Block *));
+        }
+        index->length = 0;
+        index->span   = 0;
+        index->holes  = 0;
+        index->broken = false;
+    }
+
+    for (Block *curr = FreeList.next; curr != &FreeList; curr = curr->next) {
+        free_index_append(curr);
+    }
+}
+
+/**
+ * Replace old block in the index with specified block (which may be the same
+ * block with an updated capacity).  Both must be in the same region.
+ * @param   old     Pointer to block currently in the index.
+ * @param   block   Pointer to block taking its place in the free list.
+ **/
+void    free_index_replace(Block *old, Block *block) {
+    FreeIndex *index = free_index_of(old);
+    if (index->broken) {
+        return;
+    }
+
+    // Every block in the free list must be in the index
+    ssize_t i = free_index_entry(index, *(size_t *)old->data, old);
+    if (i == INDEX_NOTFOUND || block->capacity < sizeof(size_t)) {
+        index->broken = true;
+        return;
+    }
+
+    index->capacities[i] = block->capacity;
+    index->blocks[i]     = block;
+    free_index_tag(index, i);
+    free_index_update(index, i);
+}
+
+/**
+ * Remove specified block from the index, leaving a hole in its place (holes
+ * at the end are dropped right away, the rest once there are enough of them).
+ * @param   block   Pointer to block detached from the free list.
+ **/
+void    free_index_remove(Block *block) {
+    FreeIndex *index = free_index_of(block);
+    if (index->broken) {
+        return;
+    }
+
+    ssize_t i = free_index_entry(index, *(size_t *)block->data, block);
+    if (i == INDEX_NOTFOUND) {
+        index->broken = true;
+        return;
+    }
+
+    index->capacities[i] = 0;
+    index->blocks[i]     = NULL;
+    free_index_update(index, i);
+    index->holes++;
+
+    while (index->length && !index->blocks[index->length - 1]) {
+        index->length--;
+        index->holes--;
+    }
+    if (index->holes && INDEX_HOLES * index->holes >= index->length) {
+        free_index_compact(index);
+    }
+}
+
+/**
+ * Search one index using the specified scan kernel.
+ * @param   index   Index to search.
+ * @param   scanner Scan kernel to use.
+ * @param   size    Amount of memory required.
+ * @return  Pointer to existing block (otherwise NULL if none are available).
+ **/
+static Block *  free_index_search(const FreeIndex *index, Scanner scanner, size_t size) {
+    // Holes have capacity 0, so every search must need at least a byte
+    if (size > LLONG_MAX || !index->length) {
+        return NULL;
+    }
+
+    ssize_t i = scanner(index->capacities, index->length, size ? size : 1);
+    return i == INDEX_NOTFOUND ? NULL : index->blocks[i];
+}
+
+/**
+ * Search the index of each region for the first block with at least the
+ * specified size (the main heap first).
+ * @param   size    Amount of memory required.
+ * @return  Pointer to existing block (otherwise NULL if none are available).
+ **/
+Block * free_index_search_ff(size_t size) {
+    if (!Scanners.ff) {
+        free_index_dispatch();
+    }
+
+    Block *block = free_index_search(&Indexes[0], Scanners.ff, size);
+    return block ? block : free_index_search(&Indexes[1], Scanners.ff, size);
+}
+
+/**
+ * Search the index of each region for the smallest block with at least the
+ * specified size (the main heap's on a tie).
+ * @param   size    Amount of memory required.
+ * @return  Pointer to existing block (otherwise NULL if none are available).
+ **/
+Block * free_index_search_bf(size_t size) {
+    if (!Scanners.bf) {
+        free_index_dispatch();
+    }
+
+    Block *main  = free_index_search(&Indexes[0], Scanners.bf, size);
+    Block *other = free_index_search(&Indexes[1], Scanners.bf, size);
+    return !main || (other && other->capacity < main->capacity) ? other : main;
+}
+
+/**
+ * Search the index of each region for the largest block with at least the
+ * specified size (the main heap's on a tie).
+ * @param   size    Amount of memory required.
+ * @return  Pointer to existing block (otherwise NULL if none are available).
+ **/
+Block * free_index_search_wf(size_t size) {
+    if (!Scanners.wf) {
+        free_index_dispatch();
+    }
+
+    Block *main  = free_index_search(&Indexes[0], Scanners.wf, size);
+    Block *other = free_index_search(&Indexes[1], Scanners.wf, size);
+    return !main || (other && other->capacity > main->capacity) ? other : main;
+}
+
+/**
+ * Search only the index of one region (the long-lived region, or the main
+ * heap), with the compile-time fit (first fit when none is selected, as in
+ * unit builds).
+ * @param   size        Amount of memory required.
+ * @param   long_lived  Whether to search the long-lived region.
+ * @return  Pointer to existing block (otherwise NULL if none are available).
+ **/
+Block * free_index_search_region(size_t size, bool long_lived) {
+    if (!Scanners.ff) {
+        free_index_dispatch();
+    }
+
+#if	defined FIT && FIT == 1
+    return free_index_search(&Indexes[long_lived], Scanners.wf, size);
+#elif	defined FIT && FIT == 2
+    return free_index_search(&Indexes[long_lived], Scanners.bf, size);
+#else
+    return free_index_search(&Indexes[long_lived], Scanners.ff, size);
+#endif
+}
+
+/**
+ * Find the first free block (in free list order) that is physically
+ * adjacent to the specified block (either ending where it starts or starting
+ * where it ends).
+ * @param   block   Pointer to block being inserted into the free list.
+ * @return  Pointer to adjacent free block (otherwise NULL if there is none).
+ **/
+Block * free_index_adjacent(Block *block) {
+    FreeIndex *index  = free_index_of(block);
+    ssize_t    before = INDEX_NOTFOUND;
+    ssize_t    after  = INDEX_NOTFOUND;
+
+    // The word before the header is the last tag of a free block ending here
+    size_t *footer = (size_t *)block - 1;
+    if (heap_inside(footer, block) && *footer < index->length) {
+        Block *prev = index->blocks[*footer];
+        if (prev && prev->data + index->capacities[*footer] == (char *)block) {
+            before = *footer;
+        }
+    }
+
+    // The block starting at the end holds its first tag right past its header
+    Block *next = (Block *)(block->data + block->capacity);
+    if (heap_inside(next, next->data + sizeof(size_t))) {
+        after = free_index_entry(index, *(size_t *)next->data, next);
+    }
+
+    if (before != INDEX_NOTFOUND && (after == INDEX_NOTFOUND || before < after)) {
+        return index->blocks[before];
+    }
+    return after != INDEX_NOTFOUND ? index->blocks[after] : NULL;
+}
+
+/**
+ * Return the capacity of the largest free block (in O(1), from the root of
+ * each region's max tree).
+ **/
+size_t  free_index_largest() {
+    size_t largest = 0;
+    for (size_t r = 0; r < 2; r++) {
+        if (Indexes[r].span && Indexes[r].largest[1] > largest) {
+            largest = Indexes[r].largest[1];
+        }
+    }
+    return largest;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
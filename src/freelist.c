@@ -6,11 +6,48 @@
  **/
 
 #include "malloc/counters.h"
+#include "malloc/freeindex.h"
 #include "malloc/freelist.h"
+#include "malloc/heap.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define PURGE_PAGES 256	/* Pages checked for residency at a time */
+
+/* Structures */
+
+typedef struct {
+    Block * prev;	/* Last free block visited (NULL after one in use) */
+    size_t  merges;	/* Number of merges so far */
+} Coalescing;
 
 /* Global Variables */
 
-Block FreeList = {-1, -1, &FreeList, &FreeList};
+Block     FreeList      = {-1, -1, &FreeList, &FreeList};
+FreeStats FreeListStats = {0, 0, 0, 0};
+
+/* Running Totals
+ *
+ * FreeListStats is updated whenever a block enters or leaves the free list (or
+ * changes capacity while on it), so the metrics can be queried without walking
+ * the list.  The largest free block comes from the free index, which keeps a
+ * max tree over the capacities of each region.
+ **/
+
+static void free_stats_add(size_t capacity, size_t size) {
+    FreeListStats.blocks++;
+    FreeListStats.bytes += capacity;
+    FreeListStats.slack += capacity - size;
+}
+
+static void free_stats_sub(size_t capacity, size_t size) {
+    FreeListStats.blocks--;
+    FreeListStats.bytes -= capacity;
+    FreeListStats.slack -= capacity - size;
+}
 
 /* Functions */
 
@@ -83,7 +120,8 @@ Block * free_list_search_wf(size_t size) {
  * Search for an existing block in free list with at least the specified size.
  *
  * Note, this is a wrapper function that calls one of the three algorithms
- * above based on the compile-time setting.
+ * above based on the compile-time setting (scanning the free index instead of
+ * walking the list whenever the index is valid).
  *
  * @param   size    Amount of memory required.
  * @return  Pointer to existing block (otherwise NULL if none are available).
@@ -91,19 +129,87 @@ Block * free_list_search_wf(size_t size) {
 Block * free_list_search(size_t size) {
     Block * block = NULL;
 #if	defined FIT && FIT == 0
-    block = free_list_search_ff(size);
+    block = free_index_valid() ? free_index_search_ff(size) : free_list_search_ff(size);
 #elif	defined FIT && FIT == 1
-    block = free_list_search_wf(size);
+    block = free_index_valid() ? free_index_search_wf(size) : free_list_search_wf(size);
 #elif	defined FIT && FIT == 2
-    block = free_list_search_bf(size);
+    block = free_index_valid() ? free_index_search_bf(size) : free_list_search_bf(size);
 #endif
 
     if (block) {
-        Counters[REUSES]++;
+        COUNTER_INC(REUSES);
     }
     return block;
 }
 
+/**
+ * Return the better of the best candidate so far and the current block for
+ * a request of the specified size, under the compile-time fit (first fit when
+ * none is selected, as in unit builds).
+ **/
+static Block *free_list_better(Block *best, Block *curr, size_t size) {
+    if (curr->capacity < size) {
+        return best;
+    }
+#if	defined FIT && FIT == 1
+    return !best || curr->capacity > best->capacity ? curr : best;
+#elif	defined FIT && FIT == 2
+    return !best || curr->capacity <= best->capacity ? curr : best;
+#else
+    return best ? best : curr;
+#endif
+}
+
+/**
+ * Search for an existing block with at least the specified size in only one
+ * region: the long-lived region, or the rest of the heap.  This keeps
+ * lifetime segregation intact both ways (long-lived objects reuse holes in
+ * their region before growing it, short-lived ones never take its holes).
+ *
+ * Each region has its own index, so this is a single vector scan.
+ * @param   size        Amount of memory required.
+ * @param   long_lived  Whether to search the long-lived region.
+ * @return  Pointer to existing block (otherwise NULL if none are available).
+ **/
+Block * free_list_search_region(size_t size, bool long_lived) {
+    Block *best = NULL;
+
+    if (free_index_valid()) {
+        best = free_index_search_region(size, long_lived);
+    } else {
+        for (Block *curr = FreeList.next; curr != &FreeList; curr = curr->next) {
+            if (heap_long(curr) == long_lived) {
+                best = free_list_better(best, curr, size);
+            }
+        }
+    }
+
+    if (best) {
+        COUNTER_INC(REUSES);
+    }
+    return best;
+}
+
+/**
+ * Find the first block in free list that is physically adjacent to the
+ * specified block.
+ * @param   block   Pointer to block being inserted into free list.
+ * @return  Pointer to adjacent free block (otherwise NULL if there is none).
+ **/
+static Block *free_list_adjacent(Block *block) {
+    if (free_index_valid()) {
+        return free_index_adjacent(block);
+    }
+
+    for (Block *dst = FreeList.next; dst != &FreeList; dst = dst->next) {
+        if ((intptr_t)dst->data + dst->capacity == (intptr_t)block ||
+            (intptr_t)block->data + block->capacity == (intptr_t)dst) {
+            return dst;
+        }
+    }
+    return NULL;
+}
+
 /**
  * Insert specified block into free list.
  *
@@ -116,35 +222,259 @@ Block * free_list_search(size_t size) {
  * @param   block   Pointer to block to insert into free list.
  **/
 void	free_list_insert(Block *block) {
-    // TODO: Implement free list insertions
-    //Block *temp;
-    for (Block *dst = FreeList.next; dst != &FreeList; dst = dst->next){
-        //temp = dst;
-        Block *temp = dst;
-
+    Block *dst = free_list_adjacent(block);
+    if (dst) {
         // Merge specified block to existing block
+        size_t capacity = dst->capacity;
         if (block_merge(dst, block)){
-            return;           
+            free_stats_sub(capacity, dst->size);
+            free_stats_add(dst->capacity, dst->size);
+            free_index_replace(dst, dst);
+            return;
         }
 
         // Merge current block into specified block
         else if (block_merge(block, dst)){
-            block->prev = temp->prev;
-            block->next = temp->next;
+            block->prev = dst->prev;
+            block->next = dst->next;
             dst->prev->next = block;
             dst->next->prev = block;
+            free_stats_sub(dst->capacity, dst->size);
+            free_stats_add(block->capacity, block->size);
+            free_index_replace(dst, block);
             return;
         }
     }
 
     // Add the block to the end of the free list
+    free_list_append(block);
+}
+
+/**
+ * Add specified block to the end of the free list without trying to merge it
+ * (for blocks known not to be adjacent to any free block).
+ * @param   block   Pointer to block to append to free list.
+ **/
+void	free_list_append(Block *block) {
     Block *tail = FreeList.prev;
     tail->next = block;
     FreeList.prev = block;
     block->next = &FreeList;
     block->prev = tail;
+    free_stats_add(block->capacity, block->size);
+    free_index_append(block);
+}
 
-    return;
+/**
+ * Detach specified block from free list so it can be reused by an allocation
+ * of the specified size.
+ *
+ * Any excess capacity is split off into a new free block that takes the place
+ * of the detached block in the free list.
+ * @param   block   Pointer to block in free list.
+ * @param   size    Amount of memory required.
+ * @return  Pointer to detached block.
+ **/
+Block * free_list_detach(Block *block, size_t size) {
+    Block *next = block->next;
+
+    free_stats_sub(block->capacity, block->size);
+    block = block_split(block, size);
+    if (block->next != next) {
+        free_stats_add(block->next->capacity, block->next->size);
+        free_index_replace(block, block->next);
+    } else {
+        free_index_remove(block);
+    }
+
+    return block_detach(block);
+}
+
+/**
+ * Remove specified block from free list as is (without splitting it).
+ * @param   block   Pointer to block in free list.
+ * @return  Pointer to detached block.
+ **/
+static Block *  free_list_remove(Block *block) {
+    free_stats_sub(block->capacity, block->size);
+    free_index_remove(block);
+    return block_detach(block);
+}
+
+/**
+ * Merge a free block into the free block right before it (heap_walk visitor
+ * for free_list_consolidate).  The walk goes on from the merged block's old
+ * header, which is left intact, so it still reaches the next block.
+ * @param   block       Block being visited.
+ * @param   allocated   Whether the block is in use.
+ * @param   arg         Coalescing state (last free block and merges so far).
+ * @return  Always true (visit every block).
+ **/
+static bool     free_list_coalesce(Block *block, bool allocated, void *arg) {
+    Coalescing *state = arg;
+    Block *     prev  = state->prev;
+
+    // Per-thread lines blocks are never on the free list
+    if (allocated || heap_lines(block)) {
+        state->prev = NULL;
+        return true;
+    }
+
+    // The index is rebuilt once at the end instead of on every merge
+    if (prev && (char *)prev->data + prev->capacity == (char *)block) {
+        size_t capacity = prev->capacity;
+        free_stats_sub(block->capacity, block->size);
+        block_detach(block);
+        block_merge(prev, block);
+        free_stats_sub(capacity, prev->size);
+        free_stats_add(prev->capacity, prev->size);
+        state->merges++;
+        return true;
+    }
+
+    state->prev = block;
+    return true;
+}
+
+/**
+ * Merge every run of adjacent free blocks into one (free_list_insert only
+ * merges a freed block with one neighbour, so runs can stay split).
+ * @return  Number of merges.
+ **/
+size_t  free_list_consolidate() {
+    Coalescing state = {NULL, 0};
+
+    heap_walk(free_list_coalesce, &state);
+    if (state.merges) {
+        free_index_rebuild();
+    }
+    return state.merges;
+}
+
+/**
+ * Return the free block at the top of a region, if any.
+ * @param   grow        Function that moves the region break.
+ * @param   long_lived  Whether the region is the long-lived one.
+ * @return  Free block ending at the region break (otherwise NULL).
+ **/
+static Block *  free_list_top(void *(*grow)(intptr_t), bool long_lived) {
+    for (Block *curr = FreeList.next; curr != &FreeList; curr = curr->next) {
+        if (heap_long(curr) == long_lived && (char *)curr->data + curr->capacity == grow(0)) {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Give free blocks at the top of a region back to the system (see
+ * free_list_trim).
+ * @param   long_lived  Whether to trim the long-lived region (else the main heap).
+ * @param   pad         Bytes of free capacity to leave at the top.
+ * @return  Number of bytes removed from the region.
+ **/
+static size_t   free_list_trim_region(bool long_lived, size_t pad) {
+    void *(*grow)(intptr_t) = long_lived ? heap_sbrk_long : heap_sbrk;
+    size_t released = 0;
+    Block *top;
+
+    while ((top = free_list_top(grow, long_lived))) {
+        if (pad) {
+            // Shrink the top block down to the pad (done once it fits)
+            if (top->capacity <= pad) {
+                break;
+            }
+
+            size_t excess = top->capacity - pad;
+            free_stats_sub(top->capacity, top->size);
+            top->capacity = pad;
+            free_stats_add(top->capacity, top->size);
+            free_index_replace(top, top);
+            grow(-(intptr_t)excess);
+
+            COUNTER_INC(SHRINKS);
+            COUNTER_SUB(HEAP_SIZE, excess);
+            released += excess;
+            break;
+        }
+
+        size_t allocated = sizeof(Block) + top->capacity;
+        free_list_remove(top);
+        grow(-(intptr_t)allocated);
+
+        COUNTER_DEC(BLOCKS);
+        COUNTER_INC(SHRINKS);
+        COUNTER_SUB(HEAP_SIZE, allocated);
+        released += allocated;
+    }
+
+    return released;
+}
+
+/**
+ * Give free blocks at the top of the heap and of the long-lived region back
+ * to the system by moving each break down over them.  Repeats until the top
+ * block is in use, since adjacent free blocks are not always merged.
+ * @param   pad     Bytes of free capacity to leave at the top of each region
+ *                  (the top block shrinks to this instead of going away).
+ * @return  Number of bytes removed from the heap.
+ **/
+size_t  free_list_trim(size_t pad) {
+    pad = ALIGN(pad);
+    return free_list_trim_region(false, pad) + free_list_trim_region(true, pad);
+}
+
+/**
+ * Return how many bytes of a page aligned range are resident.
+ * @param   start   Start of the range.
+ * @param   end     End of the range.
+ * @param   page    Page size.
+ * @return  Resident bytes (the whole range if residency is unknown).
+ **/
+static size_t   free_list_resident(uintptr_t start, uintptr_t end, uintptr_t page) {
+    unsigned char pages[PURGE_PAGES];
+    size_t        resident = 0;
+
+    while (start < end) {
+        size_t n = (end - start) / page < PURGE_PAGES ? (end - start) / page : PURGE_PAGES;
+        if (mincore((void *)start, n * page, pages) < 0) {
+            return resident + (end - start);
+        }
+        for (size_t i = 0; i < n; i++) {
+            resident += (pages[i] & 1) * page;
+        }
+        start += n * page;
+    }
+
+    return resident;
+}
+
+/**
+ * Drop the whole pages inside every free block (MADV_DONTNEED), so they no
+ * longer count against the resident set until they are reused.  Blocks stay
+ * in the free list; their headers and the free index's tags (the first and
+ * last data word) are left alone.  Pages already dropped (by an earlier
+ * purge, or never touched) are skipped and not counted again.
+ * @return  Number of bytes dropped.
+ **/
+size_t  free_list_purge() {
+    uintptr_t page    = getpagesize();
+    size_t    dropped = 0;
+
+    for (Block *curr = FreeList.next; curr != &FreeList; curr = curr->next) {
+        uintptr_t start = ((uintptr_t)curr->data + sizeof(size_t) + page - 1) & ~(page - 1);
+        uintptr_t end   = ((uintptr_t)curr->data + curr->capacity - sizeof(size_t)) & ~(page - 1);
+        if (end <= start) {
+            continue;
+        }
+
+        size_t resident = free_list_resident(start, end, page);
+        if (resident && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+            dropped += resident;
+        }
+    }
+
+    return dropped;
 }
 
 /**
@@ -159,4 +489,25 @@ size_t  free_list_length() {
     return length;
 }
 
+/**
+ * Fill in running totals for the free list.
+ *
+ * Unlike free_list_length, this does not walk the list (unless the index
+ * could not be mapped, when the largest free block has to be found by hand).
+ * @param   stats   Pointer to structure to fill in.
+ **/
+void    free_list_stats(FreeStats *stats) {
+    *stats = FreeListStats;
+
+    if (free_index_valid()) {
+        stats->largest = free_index_largest();
+    } else {
+        stats->largest = 0;
+        for (Block *curr = FreeList.next; curr != &FreeList; curr = curr->next) {
+            if (curr->capacity > stats->largest)
+                stats->largest = curr->capacity;
+        }
+    }
+}
+
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,355 @@
+/* guard.c: Sampled Guard Page Allocations
+ *
+ * When MALLOC_GUARD=N is set in the environment, about one allocation in N
+ * (of at most a page, less the block header) is served from a pool of guard
+ * page isolated slots instead of the heap (see guard.h for the layout).  The
+ * sampling costs one thread local decrement per malloc and one compare per
+ * free, so it can be left on in production, and catches:
+ *
+ *  - Overflows past the end of a block (fault on the next guard page, or a
+ *    corrupted fill between the request and the aligned end, found at free).
+ *  - Underflows that overwrite the block header (found at free).
+ *  - Use after free (fault on the inaccessible freed slot).
+ *  - Double and invalid frees (found at free).
+ *
+ * Each is reported on stderr with the allocation (and free) call sites, then
+ * the process is killed by the fault (SIGSEGV) or abort (SIGABRT), so core
+ * dumps and crash handlers still see it.  MALLOC_GUARD_SLOTS sets how many
+ * sampled allocations can be live at once (beyond that, samples are served
+ * by the heap as usual).
+ **/
+
+#include "malloc/block.h"
+#include "malloc/guard.h"
+
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define GUARD_REPORT_MAX    512	/* Longest report (longer ones are cut short) */
+
+/* Structures */
+
+typedef enum {
+    SLOT_UNUSED,	/* Never handed out */
+    SLOT_ALLOCATED,	/* Holds a live allocation */
+    SLOT_FREED,		/* Freed (and inaccessible) */
+} SlotState;
+
+typedef struct {
+    char *      data;	    /* Start of allocation */
+    size_t      size;	    /* Bytes requested */
+    uintptr_t   malloc_site;/* Return address of the allocating call */
+    uintptr_t   free_site;  /* Return address of the freeing call */
+    SlotState   state;
+} GuardSlot;
+
+/* Global Variables */
+
+size_t              GuardRate      = 0;
+uintptr_t           GuardStart     = 0;
+size_t              GuardLength    = 0;
+__thread int32_t    GuardCountdown = 0;
+
+static __thread uint64_t    Random   = 0;
+static GuardSlot            Slots[GUARD_SLOTS_MAX];
+static size_t               NSlots   = 0;
+static size_t               Next     = 0;	/* Next slot to try */
+static size_t               PageSize = 0;
+static struct sigaction     Previous[2];	/* SIGSEGV and SIGBUS handlers */
+
+/* Functions */
+
+/**
+ * Return page holding slot.
+ **/
+static char *   guard_slot_page(size_t slot) {
+    return (char *)GuardStart + (2 * slot + 1) * PageSize;
+}
+
+/**
+ * Append a string to a report (stopping short of its end).
+ * @param   buffer  Report being formatted.
+ * @param   length  Bytes of buffer used so far.
+ * @param   string  String to append.
+ * @return  Bytes of buffer used after appending.
+ **/
+static size_t   guard_append(char *buffer, size_t length, const char *string) {
+    while (*string && length < GUARD_REPORT_MAX) {
+        buffer[length++] = *string++;
+    }
+    return length;
+}
+
+/**
+ * Append a number to a report, in decimal or (0x prefixed) hexadecimal.
+ * @param   buffer  Report being formatted.
+ * @param   length  Bytes of buffer used so far.
+ * @param   number  Number to append.
+ * @param   base    10 or 16.
+ * @return  Bytes of buffer used after appending.
+ **/
+static size_t   guard_append_number(char *buffer, size_t length, uintptr_t number, unsigned base) {
+    char  digits[2 * sizeof(number) + 3];
+    char *start = digits + sizeof(digits) - 1;
+
+    *start = 0;
+    do {
+        *--start = "0123456789abcdef"[number % base];
+        number  /= base;
+    } while (number);
+
+    if (base == 16) {
+        *--start = 'x';
+        *--start = '0';
+    }
+    return guard_append(buffer, length, start);
+}
+
+/**
+ * Report an error on stderr.  Only formats into the stack by hand and calls
+ * write(2) (snprintf is not async-signal-safe), so it is safe in the fault
+ * handler and with the heap lock held.
+ * @param   error   Kind of error.
+ * @param   addr    Address accessed or freed.
+ * @param   slot    Slot the error was found in (NULL if none).
+ **/
+static void     guard_report(const char *error, uintptr_t addr, const GuardSlot *slot) {
+    char   buffer[GUARD_REPORT_MAX];
+    size_t length = 0;
+
+    length = guard_append(buffer, length, "malloc guard: ");
+    length = guard_append(buffer, length, error);
+    length = guard_append(buffer, length, " at ");
+    length = guard_append_number(buffer, length, addr, 16);
+    length = guard_append(buffer, length, " (pid ");
+    length = guard_append_number(buffer, length, getpid(), 10);
+    length = guard_append(buffer, length, ")\n");
+
+    if (slot && slot->state != SLOT_UNUSED) {
+        uintptr_t data = (uintptr_t)slot->data;
+        uintptr_t end  = data + slot->size;
+        const char *where = addr < data ? " bytes before " : addr >= end ? " bytes past " : " bytes into ";
+        size_t      delta = addr < data ? data - addr : addr >= end ? addr - end : addr - data;
+
+        length = guard_append(buffer, length, "    ");
+        length = guard_append_number(buffer, length, delta, 10);
+        length = guard_append(buffer, length, where);
+        length = guard_append_number(buffer, length, slot->size, 10);
+        length = guard_append(buffer, length, "-byte allocation at ");
+        length = guard_append_number(buffer, length, data, 16);
+        length = guard_append(buffer, length, "\n    allocated by ");
+        length = guard_append_number(buffer, length, slot->malloc_site, 16);
+        length = guard_append(buffer, length, "\n");
+        if (slot->state == SLOT_FREED) {
+            length = guard_append(buffer, length, "    freed by ");
+            length = guard_append_number(buffer, length, slot->free_site, 16);
+            length = guard_append(buffer, length, "\n");
+        }
+    }
+
+    if (write(STDERR_FILENO, buffer, length) < 0) {
+        /* Nothing left to report to */
+    }
+}
+
+/**
+ * Report faults in the pool; pass everything else on to the previous
+ * handler.  Once reported, the previous handler is restored and the faulting
+ * access retried, so the process dies (or is handled) as it would have
+ * without the guard.
+ **/
+static void     guard_fault(int signum, siginfo_t *info, void *context) {
+    struct sigaction *previous = &Previous[signum == SIGBUS];
+    uintptr_t         addr     = (uintptr_t)info->si_addr;
+
+    if (GUARD_OWNS(addr)) {
+        size_t     page = (addr - GuardStart) / PageSize;
+        GuardSlot *slot = NULL;
+
+        if (page % 2) {
+            /* Slot page: only freed (or never used) slots are inaccessible */
+            slot = &Slots[page / 2];
+            guard_report(slot->state == SLOT_FREED ? "use-after-free" : "wild access", addr, slot);
+        } else {
+            /* Guard page: blame the slot whose end runs into it, else the next one */
+            GuardSlot *left  = page > 0 ? &Slots[page / 2 - 1] : NULL;
+            GuardSlot *right = page / 2 < NSlots ? &Slots[page / 2] : NULL;
+            if (left && left->state != SLOT_UNUSED) {
+                slot = left;
+                guard_report(left->state == SLOT_FREED ? "use-after-free" : "heap-buffer-overflow", addr, slot);
+            } else {
+                slot = right;
+                guard_report("heap-buffer-underflow", addr, slot);
+            }
+        }
+
+        sigaction(signum, previous, NULL);
+        return;
+    }
+
+    if (previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(signum, info, context);
+    } else if (previous->sa_handler == SIG_DFL || previous->sa_handler == SIG_IGN) {
+        sigaction(signum, previous, NULL);
+    } else {
+        previous->sa_handler(signum);
+    }
+}
+
+/**
+ * Enable guarded sampling if MALLOC_GUARD is set:
+ *
+ *  1. Reserve the pool with every page inaccessible.
+ *  2. Install the fault handler for SIGSEGV and SIGBUS.
+ *  3. Publish the pool, which turns on GUARD_SAMPLE and GUARD_OWNS.
+ **/
+void    guard_init() {
+    const char *rate  = getenv("MALLOC_GUARD");
+    const char *slots = getenv("MALLOC_GUARD_SLOTS");
+
+    if (!rate || strtoul(rate, NULL, 10) == 0) {
+        return;
+    }
+
+    NSlots = GUARD_SLOTS;
+    if (slots && strtoul(slots, NULL, 10) > 0) {
+        NSlots = strtoul(slots, NULL, 10);
+        NSlots = NSlots < GUARD_SLOTS_MAX ? NSlots : GUARD_SLOTS_MAX;
+    }
+
+    PageSize      = getpagesize();
+    size_t length = (2 * NSlots + 1) * PageSize;
+    void * pool   = mmap(NULL, length, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (pool == MAP_FAILED) {
+        return;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_fault;
+    action.sa_flags     = SA_SIGINFO|SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &Previous[0]);
+    sigaction(SIGBUS,  &action, &Previous[1]);
+
+    GuardStart  = (uintptr_t)pool;
+    GuardLength = length;
+    GuardRate   = strtoul(rate, NULL, 10);
+}
+
+/**
+ * Restart the calling thread's countdown once it runs out (slow path of
+ * GUARD_SAMPLE).  Countdowns are uniform in [1, 2 * GuardRate - 1], so one
+ * allocation in GuardRate is sampled on average, without a fixed stride a
+ * program could fall into step with.
+ * @return  Whether the allocation should be sampled (false for a thread's
+ *          first allocation, which only starts its countdown).
+ **/
+bool    guard_sample() {
+    bool expired = GuardCountdown == 0;
+
+    if (!Random) {
+        Random = ((uintptr_t)&Random * 0x9E3779B97F4A7C15ULL) | 1;
+    }
+    Random ^= Random << 13;
+    Random ^= Random >> 7;
+    Random ^= Random << 17;
+
+    GuardCountdown = 1 + Random % (2 * GuardRate - 1);
+    return expired;
+}
+
+/**
+ * Serve an allocation from a free slot, with its block header in front and
+ * its aligned end against the next guard page.
+ * @param   size    Number of bytes requested.
+ * @param   site    Return address of the allocating call.
+ * @return  Pointer to zeroed memory (NULL if too large or no slot is free).
+ **/
+void *  guard_malloc(size_t size, uintptr_t site) {
+    size_t capacity = ALIGN(size);
+    if (!GuardLength || capacity + sizeof(Block) > PageSize) {
+        return NULL;
+    }
+
+    size_t n = 0;
+    while (n < NSlots && Slots[(Next + n) % NSlots].state == SLOT_ALLOCATED) {
+        n++;
+    }
+    if (n == NSlots) {
+        return NULL;
+    }
+
+    size_t index = (Next + n) % NSlots;
+    char * page  = guard_slot_page(index);
+    if (mprotect(page, PageSize, PROT_READ|PROT_WRITE) < 0) {
+        return NULL;
+    }
+    Next = index + 1;
+
+    // Freed slot pages were dropped, so the whole page reads back zero
+    Block *block    = (Block *)(page + PageSize - capacity - sizeof(Block));
+    block->capacity = capacity;
+    block->size     = size;
+    block->prev     = block;
+    block->next     = block;
+    memset(block->data + size, GUARD_PATTERN, capacity - size);
+
+    GuardSlot *slot   = &Slots[index];
+    slot->data        = block->data;
+    slot->size        = size;
+    slot->malloc_site = site;
+    slot->free_site   = 0;
+    slot->state       = SLOT_ALLOCATED;
+    return block->data;
+}
+
+/**
+ * Return a slot to the pool, checking the free is valid and the block was
+ * not written outside its bounds (reporting and aborting otherwise).  The
+ * slot page is dropped and made inaccessible, so later use faults.
+ * @param   ptr     Pointer in the pool.
+ * @param   site    Return address of the freeing call.
+ * @return  Number of bytes that were requested.
+ **/
+size_t  guard_free(void *ptr, uintptr_t site) {
+    size_t     page = ((uintptr_t)ptr - GuardStart) / PageSize;
+    GuardSlot *slot = page % 2 ? &Slots[page / 2] : NULL;
+
+    if (!slot || slot->state == SLOT_UNUSED || slot->data != ptr) {
+        guard_report("invalid free", (uintptr_t)ptr, slot);
+        abort();
+    }
+
+    if (slot->state == SLOT_FREED) {
+        guard_report("double-free", (uintptr_t)ptr, slot);
+        abort();
+    }
+
+    Block *block = BLOCK_FROM_POINTER(ptr);
+    if (block->capacity != ALIGN(slot->size) || block->size != slot->size ||
+        block->prev != block || block->next != block) {
+        guard_report("heap-buffer-underflow (block header overwritten)", (uintptr_t)block, slot);
+        abort();
+    }
+
+    for (size_t i = slot->size; i < block->capacity; i++) {
+        if ((unsigned char)block->data[i] != GUARD_PATTERN) {
+            guard_report("heap-buffer-overflow (found at free)", (uintptr_t)&block->data[i], slot);
+            abort();
+        }
+    }
+
+    char *start = guard_slot_page(page / 2);
+    madvise(start, PageSize, MADV_DONTNEED);
+    mprotect(start, PageSize, PROT_NONE);
+    slot->free_site = site;
+    slot->state     = SLOT_FREED;
+    return slot->size;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
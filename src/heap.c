@@ -0,0 +1,349 @@
+/* heap.c: Heap Backend */
+
+#include "malloc/block.h"
+#include "malloc/heap.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Heap Region Structure
+ *
+ * A reserved range of address space with an emulated break.  The main heap
+ * uses one in huge page and persistent mode; predicted long-lived objects
+ * always get one.
+ **/
+
+typedef struct {
+    char *  start;	/* Start of reserved address space */
+    char *  brk;	/* Emulated program break */
+    char *  limit;	/* End of reserved address space */
+    char *  resident;	/* End of pages that may be backed */
+    char *  dirty;	/* End of memory that may hold old data */
+    char *  fresh;	/* Start of zero memory from last grow */
+    size_t  granule;	/* Granularity memory is handed back in */
+    char *  backed;	/* End of file data under a private file mapping */
+} HeapRegion;
+
+/* Global Variables */
+
+static enum {
+    HEAP_UNKNOWN,
+    HEAP_BRK,
+    HEAP_HUGEPAGE,
+    HEAP_PERSIST,
+}                   Backend = HEAP_UNKNOWN;
+
+static HeapRegion   Main    = {0};	/* Heap (only start, brk, dirty and fresh in brk mode) */
+static HeapRegion   Long    = {0};	/* Region for long-lived objects */
+static HeapRegion   Lines   = {0};	/* Region of per-thread chunks */
+
+/* Functions */
+
+/**
+ * Reserve a region aligned to its granule:
+ *
+ *  1. Map the reservation (plus one granule of slack) with MAP_NORESERVE,
+ *     so only touched memory is ever committed.
+ *  2. Unmap the unaligned head and tail.
+ *  3. Mark the region MADV_HUGEPAGE when the granule is a huge page.
+ *
+ * @param   region  Region to set up.
+ * @param   reserve Number of bytes of address space to reserve.
+ * @param   granule Alignment and release granularity (page or huge page).
+ * @return  Whether or not the region was set up.
+ **/
+static bool     heap_reserve(HeapRegion *region, size_t reserve, size_t granule) {
+    size_t length = reserve + granule;
+    char * start  = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        return false;
+    }
+
+    char *aligned = (char *)(((uintptr_t)start + granule - 1) & ~(granule - 1));
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    if (aligned + reserve < start + length) {
+        munmap(aligned + reserve, (start + length) - (aligned + reserve));
+    }
+
+    if (granule == HUGEPAGE_SIZE) {
+        madvise(aligned, reserve, MADV_HUGEPAGE);
+    }
+
+    region->start    = aligned;
+    region->brk      = aligned;
+    region->resident = aligned;
+    region->limit    = aligned + reserve;
+    region->granule  = granule;
+    return true;
+}
+
+/**
+ * Select backend on first use (falling back to sbrk if the region cannot be
+ * reserved).
+ **/
+static void     heap_init() {
+    const char *enabled = getenv("MALLOC_HUGEPAGE");
+    const char *reserve = getenv("MALLOC_HUGEPAGE_RESERVE");
+
+    Backend = HEAP_BRK;
+    if (!enabled || !*enabled || *enabled == '0') {
+        return;
+    }
+
+    size_t bytes = HUGEPAGE_RESERVE;
+    if (reserve && strtoul(reserve, NULL, 10) > 0) {
+        bytes = strtoul(reserve, NULL, 10) << 20;
+        bytes = (bytes + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+    }
+
+    if (heap_reserve(&Main, bytes, HUGEPAGE_SIZE)) {
+        Backend = HEAP_HUGEPAGE;
+    }
+}
+
+/**
+ * Use part of a private file mapping as the heap (see persist.c).  Must
+ * happen before the heap is first used.
+ * @param   start   Start of the heap.
+ * @param   brk     Current break (end of the heap's blocks).
+ * @param   limit   End of the mapping.
+ * @return  Whether or not the heap now lives in the mapping.
+ **/
+bool    heap_attach(void *start, void *brk, void *limit) {
+    uintptr_t page = getpagesize();
+
+    if (Backend != HEAP_UNKNOWN) {
+        return false;
+    }
+
+    // The file holds old data up to the page holding the break, zero after
+    Main.start    = start;
+    Main.brk      = brk;
+    Main.limit    = limit;
+    Main.granule  = page;
+    Main.resident = (char *)(((uintptr_t)brk + page - 1) & ~(page - 1));
+    Main.backed   = Main.resident;
+    Main.dirty    = Main.resident;
+    Main.fresh    = Main.resident;
+
+    Backend = HEAP_PERSIST;
+    return true;
+}
+
+/**
+ * Return whether the heap is backed by a persistent heap file.
+ **/
+bool    heap_persistent() {
+    return Backend == HEAP_PERSIST;
+}
+
+/**
+ * Return whether the heap is backed by the huge page region.
+ **/
+bool    heap_hugepage() {
+    if (Backend == HEAP_UNKNOWN) {
+        heap_init();
+    }
+    return Backend == HEAP_HUGEPAGE;
+}
+
+/**
+ * Track which part of a region is known to be zero after moving the break:
+ * memory the region never reached before is zero, as is memory the kernel
+ * took back on a shrink (pages past the new break, or released huge pages).
+ * @param   region      Region whose break moved.
+ * @param   previous    Break before the move.
+ * @param   current     Break after the move.
+ * @param   reclaimed   Start of memory the kernel has reclaimed (or will zero).
+ **/
+static void     heap_dirty(HeapRegion *region, char *previous, char *current, char *reclaimed) {
+    if (current > previous) {
+        region->fresh = region->dirty > previous ? region->dirty : previous;
+        region->dirty = region->dirty > current ? region->dirty : current;
+    } else if (region->dirty > reclaimed) {
+        region->dirty = reclaimed;
+    }
+}
+
+/**
+ * Return start of the zero-filled tail of memory returned by the last grow
+ * (at or after the previous break).  Only meaningful right after heap_sbrk
+ * grew the heap, with the heap lock still held.
+ **/
+void *  heap_fresh() {
+    return Main.fresh;
+}
+
+/**
+ * Move the emulated break of a region by the specified increment.
+ *
+ * When the break falls more than a granule below the end of the backed
+ * pages, the whole granules past the break (rounded up, plus one granule of
+ * hysteresis) are released, so alternating grows and shrinks around a
+ * boundary do not thrash.
+ * @param   region      Region to grow or shrink.
+ * @param   increment   Number of bytes to grow (or shrink when negative).
+ * @return  Previous break (otherwise SBRK_FAILURE).
+ **/
+static void *   heap_region_sbrk(HeapRegion *region, intptr_t increment) {
+    char * previous = region->brk;
+    size_t granule  = region->granule;
+
+    if ((increment > 0 && increment > region->limit - region->brk) ||
+        (increment < 0 && -increment > region->brk - region->start)) {
+        return SBRK_FAILURE;
+    }
+
+    region->brk += increment;
+    if (region->brk > region->resident) {
+        region->resident = (char *)(((uintptr_t)region->brk + granule - 1) & ~(granule - 1));
+    }
+
+    char *keep = (char *)(((uintptr_t)region->brk + granule - 1) & ~(granule - 1)) + granule;
+    if (keep < region->resident) {
+        madvise(keep, region->resident - keep, MADV_DONTNEED);
+        region->resident = keep;
+    }
+
+    // Released pages of a file mapping read back the file (zero past its data)
+    heap_dirty(region, previous, region->brk, region->resident > region->backed ? region->resident : region->backed);
+    return previous;
+}
+
+/**
+ * Move the heap break by the specified increment.
+ * @param   increment   Number of bytes to grow (or shrink when negative).
+ * @return  Previous break (otherwise SBRK_FAILURE).
+ **/
+void *  heap_sbrk(intptr_t increment) {
+    if (heap_hugepage() || heap_persistent()) {
+        return heap_region_sbrk(&Main, increment);
+    }
+
+    char *previous = sbrk(increment);
+    if (previous != SBRK_FAILURE) {
+        if (!Main.start) {
+            Main.start = previous;
+        }
+
+        uintptr_t page = getpagesize();
+        char *    end  = previous + increment;
+        Main.brk = end;
+        heap_dirty(&Main, previous, end, (char *)(((uintptr_t)end + page - 1) & ~(page - 1)));
+    }
+    return previous;
+}
+
+/**
+ * Move the break of the long-lived region by the specified increment
+ * (reserving the region on first use).  A persistent heap has no long-lived
+ * region, so everything it allocates is saved with it.
+ * @param   increment   Number of bytes to grow (or shrink when negative).
+ * @return  Previous break (otherwise SBRK_FAILURE).
+ **/
+void *  heap_sbrk_long(intptr_t increment) {
+    if (heap_persistent()) {
+        return SBRK_FAILURE;
+    }
+    if (!Long.start && !heap_reserve(&Long, LONG_RESERVE, heap_hugepage() ? HUGEPAGE_SIZE : (size_t)getpagesize())) {
+        return SBRK_FAILURE;
+    }
+    return heap_region_sbrk(&Long, increment);
+}
+
+/**
+ * Return whether pointer lies in the long-lived region.
+ * @param   ptr     Pointer to check.
+ **/
+bool    heap_long(const void *ptr) {
+    return (const char *)ptr >= Long.start && (const char *)ptr < Long.brk;
+}
+
+/**
+ * Return whether a range lies below the break of the main heap or of the
+ * long-lived region (so it can be read without faulting).
+ * @param   start   Start of the range.
+ * @param   end     End of the range.
+ **/
+bool    heap_inside(const void *start, const void *end) {
+    const char *first = start;
+    const char *last  = end;
+    return (first >= Main.start && last <= Main.brk) || (first >= Long.start && last <= Long.brk);
+}
+
+/**
+ * Move the break of the per-thread lines region by the specified increment
+ * (reserving the region on first use, aligned to LINES_CHUNK so a chunk can
+ * be found from any block in it).  Like the long-lived region, a persistent
+ * heap has none.
+ * @param   increment   Number of bytes to grow (or shrink when negative).
+ * @return  Previous break (otherwise SBRK_FAILURE).
+ **/
+void *  heap_sbrk_lines(intptr_t increment) {
+    if (heap_persistent()) {
+        return SBRK_FAILURE;
+    }
+    if (!Lines.start && !heap_reserve(&Lines, LINES_RESERVE, heap_hugepage() ? HUGEPAGE_SIZE : LINES_CHUNK)) {
+        return SBRK_FAILURE;
+    }
+    return heap_region_sbrk(&Lines, increment);
+}
+
+/**
+ * Return whether pointer lies in the per-thread lines region.
+ * @param   ptr     Pointer to check.
+ **/
+bool    heap_lines(const void *ptr) {
+    return (const char *)ptr >= Lines.start && (const char *)ptr < Lines.brk;
+}
+
+/**
+ * Visit the blocks between start and end in address order.
+ * @param   start   Address of first block.
+ * @param   end     End of last block.
+ * @param   visitor Function to call for each block.
+ * @param   arg     Argument passed through to visitor.
+ * @return  Whether or not the walk reached end (false if the visitor stopped
+ *          it or a corrupt header did).
+ **/
+static bool     heap_walk_range(char *start, char *end, HeapVisitor visitor, void *arg) {
+    char *curr = start;
+    while (curr && curr + sizeof(Block) <= end) {
+        Block *block = (Block *)curr;
+        if (!block->capacity || block->capacity > (size_t)(end - curr) - sizeof(Block)) {
+            return false;
+        }
+
+        if (!visitor(block, block->next == block && block->prev == block, arg)) {
+            return false;
+        }
+        curr += sizeof(Block) + block->capacity;
+    }
+    return true;
+}
+
+/**
+ * Visit every block in the main heap, the long-lived region and the chunks
+ * of the lines region.
+ * @param   visitor Function to call for each block (returns false to stop).
+ * @param   arg     Argument passed through to visitor.
+ * @return  Whether or not every block was visited.
+ **/
+bool    heap_walk(HeapVisitor visitor, void *arg) {
+    char *end = Backend == HEAP_BRK ? sbrk(0) : Main.brk;
+    if (!heap_walk_range(Main.start, end, visitor, arg) ||
+        !heap_walk_range(Long.start, Long.brk, visitor, arg)) {
+        return false;
+    }
+
+    for (char *chunk = Lines.start; chunk && chunk < Lines.brk; chunk += LINES_CHUNK) {
+        if (!heap_walk_range(chunk + LINES_HEADER, chunk + LINES_CHUNK, visitor, arg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,173 @@
+/* heapmap.c: Heap Block Map Dumps
+ *
+ * When MALLOC_HEAPMAP is set in the environment, a map of every block in the
+ * heap (address, capacity, requested size and whether it is in use) is
+ * written to:
+ *
+ *      $MALLOC_HEAPMAP_FILE.NNNN.map   (default malloc-heap.<pid>.NNNN.map)
+ *
+ * at exit and whenever the signal in MALLOC_HEAPMAP_SIGNAL is received (the
+ * dump happens on the next allocator call, with the heap lock held, so it is
+ * a consistent snapshot of a live process).  bin/heapmap renders the maps.
+ **/
+
+#include "malloc/heap.h"
+#include "malloc/heapmap.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define HEAPMAP_BUFFER  128	    /* Records written at once */
+
+/* Structures */
+
+typedef struct {
+    int             fd;
+    size_t          length;
+    bool            failed;
+    HeapMapRecord   records[HEAPMAP_BUFFER];
+} HeapMapWriter;
+
+/* Global Variables */
+
+volatile sig_atomic_t   HeapMapRequested = 0;
+
+static bool             Enabled          = false;
+static char             Prefix[256]      = {0};
+static unsigned         Sequence         = 0;
+
+/* Functions */
+
+/**
+ * Request a heap map from a signal handler.
+ **/
+static void     heapmap_signal(int signum) {
+    HeapMapRequested = 1;
+}
+
+/**
+ * Write final heap map when the program terminates.
+ **/
+static void     heapmap_exit() {
+    heapmap_dump_next();
+}
+
+/**
+ * Enable heap maps if MALLOC_HEAPMAP is set:
+ *
+ *  1. Set the output file prefix.
+ *  2. Install the dump signal handler (if MALLOC_HEAPMAP_SIGNAL is set).
+ *  3. Register the final dump at exit.
+ **/
+void    heapmap_init() {
+    const char *enabled = getenv("MALLOC_HEAPMAP");
+    const char *file    = getenv("MALLOC_HEAPMAP_FILE");
+    const char *signum  = getenv("MALLOC_HEAPMAP_SIGNAL");
+
+    if (!enabled || !*enabled || *enabled == '0') {
+        return;
+    }
+    Enabled = true;
+
+    if (file && *file) {
+        snprintf(Prefix, sizeof(Prefix), "%s", file);
+    } else {
+        snprintf(Prefix, sizeof(Prefix), HEAPMAP_PREFIX, getpid());
+    }
+
+    if (signum && atoi(signum) > 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = heapmap_signal;
+        action.sa_flags   = SA_RESTART;
+        sigaction(atoi(signum), &action, NULL);
+    }
+
+    atexit(heapmap_exit);
+}
+
+/**
+ * Write buffered records to the map file.
+ * @param   writer  Writer to flush.
+ **/
+static void     heapmap_flush(HeapMapWriter *writer) {
+    size_t bytes = writer->length * sizeof(HeapMapRecord);
+    if (writer->length && write(writer->fd, writer->records, bytes) != (ssize_t)bytes) {
+        writer->failed = true;
+    }
+    writer->length = 0;
+}
+
+/**
+ * Buffer the record for one block (heap_walk visitor).
+ **/
+static bool     heapmap_visit(Block *block, bool allocated, void *arg) {
+    HeapMapWriter *writer = arg;
+    HeapMapRecord *record = &writer->records[writer->length++];
+
+    record->address   = (uintptr_t)block;
+    record->capacity  = block->capacity;
+    record->size      = block->size;
+    record->allocated = allocated;
+    record->reserved  = 0;
+
+    if (writer->length == HEAPMAP_BUFFER) {
+        heapmap_flush(writer);
+    }
+    return !writer->failed;
+}
+
+/**
+ * Write a map of the heap to the specified file (the caller holds the heap
+ * lock, or no other thread is allocating).
+ * @param   path    Path of file to write.
+ * @return  Whether or not the map was written.
+ **/
+bool    heapmap_dump(const char *path) {
+    HeapMapWriter   writer = {.fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)};
+    HeapMapHeader   header = {HEAPMAP_MAGIC, HEAPMAP_VERSION, getpid()};
+    struct timespec now;
+
+    if (writer.fd < 0) {
+        return false;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    header.timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    if (write(writer.fd, &header, sizeof(header)) != sizeof(header)) {
+        close(writer.fd);
+        return false;
+    }
+
+    header.complete = heap_walk(heapmap_visit, &writer);
+    heapmap_flush(&writer);
+    if (pwrite(writer.fd, &header.complete, sizeof(header.complete), offsetof(HeapMapHeader, complete)) < 0) {
+        writer.failed = true;
+    }
+
+    close(writer.fd);
+    return !writer.failed;
+}
+
+/**
+ * Write a heap map with the next sequence number.
+ **/
+void    heapmap_dump_next() {
+    char path[sizeof(Prefix) + 16];
+
+    HeapMapRequested = 0;
+    if (!Enabled) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s.%04u.map", Prefix, Sequence++);
+    heapmap_dump(path);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,186 @@
+/* latency.c: Per-Call Latency Histograms
+ *
+ * When MALLOC_LATENCY is set in the environment, every call to malloc, free,
+ * realloc and calloc is timed with the cycle counter and recorded in a
+ * log-linear histogram for its operation and for its power of two size class.
+ * Percentiles are added to the dump_counters output and the live stats page.
+ **/
+
+#include "malloc/counters.h"
+#include "malloc/latency.h"
+#include "malloc/stats.h"
+
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Global Variables */
+
+LatencyTable *  Latency = NULL;
+
+const char *    OperationNames[NOPERATIONS] = {
+    "malloc",
+    "free",
+    "realloc",
+    "calloc",
+};
+
+/* Functions */
+
+/**
+ * Map the latency histograms if MALLOC_LATENCY is enabled.
+ **/
+void        latency_init() {
+    const char *enabled = getenv("MALLOC_LATENCY");
+
+    if (!enabled || !*enabled || *enabled == '0') {
+        return;
+    }
+
+    LatencyTable *table = mmap(NULL, sizeof(LatencyTable), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (table != MAP_FAILED) {
+        Latency = table;
+    }
+}
+
+/**
+ * Read the cycle counter (or a nanosecond clock where there is none).
+ * @return  Current time in cycles.
+ **/
+uint64_t    latency_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * Map a value to its log-linear histogram bucket.
+ * @param   value   Sample value.
+ * @return  Bucket index.
+ **/
+size_t      latency_bucket(uint64_t value) {
+    if (value < (1<<LATENCY_SUBBITS)) {
+        return value;
+    }
+
+    size_t exponent = 63 - __builtin_clzll(value);
+    if (exponent >= LATENCY_MAXBITS) {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    return ((exponent - LATENCY_SUBBITS + 1) << LATENCY_SUBBITS)
+         + ((value >> (exponent - LATENCY_SUBBITS)) & ((1<<LATENCY_SUBBITS) - 1));
+}
+
+/**
+ * Map a histogram bucket to the largest value it holds.
+ * @param   bucket  Bucket index.
+ * @return  Largest value recorded in bucket.
+ **/
+uint64_t    latency_value(size_t bucket) {
+    if (bucket < (1<<LATENCY_SUBBITS)) {
+        return bucket;
+    }
+
+    size_t   exponent = (bucket >> LATENCY_SUBBITS) + LATENCY_SUBBITS - 1;
+    uint64_t mantissa = (1<<LATENCY_SUBBITS) | (bucket & ((1<<LATENCY_SUBBITS) - 1));
+    return ((mantissa + 1) << (exponent - LATENCY_SUBBITS)) - 1;
+}
+
+/**
+ * Add a sample to a histogram.
+ * @param   histogram   Histogram to update.
+ * @param   elapsed     Sample value.
+ **/
+static void     latency_add(Histogram *histogram, uint64_t elapsed) {
+    __atomic_fetch_add(&histogram->buckets[latency_bucket(elapsed)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (elapsed > max && !__atomic_compare_exchange_n(&histogram->max, &max, elapsed, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Record the latency of one call.
+ * @param   operation   Operation that was timed (OP_MALLOC, ...).
+ * @param   size        Number of bytes involved in the call.
+ * @param   elapsed     Cycles spent in the call.
+ **/
+void        latency_record(int operation, size_t size, uint64_t elapsed) {
+    latency_add(&Latency->operations[operation], elapsed);
+    latency_add(&Latency->classes[operation][STATS_CLASS(size)], elapsed);
+}
+
+/**
+ * Compute p50, p99 and p99.9 of a histogram.
+ * @param   histogram   Histogram to examine.
+ * @param   percentiles Structure to store percentiles in.
+ **/
+void        latency_percentiles(const Histogram *histogram, Percentiles *percentiles) {
+    uint64_t count   = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    uint64_t max     = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    uint64_t targets[3] = {
+        (count * 500  + 999) / 1000,
+        (count * 990  + 999) / 1000,
+        (count * 999  + 999) / 1000,
+    };
+    uint64_t results[3] = {0, 0, 0};
+    uint64_t seen    = 0;
+    size_t   target  = 0;
+
+    for (size_t b = 0; b < LATENCY_BUCKETS && target < 3 && count; b++) {
+        seen += __atomic_load_n(&histogram->buckets[b], __ATOMIC_RELAXED);
+        while (target < 3 && seen >= targets[target]) {
+            uint64_t value  = latency_value(b);
+            results[target] = value < max ? value : max;
+            target++;
+        }
+    }
+
+    percentiles->p50  = results[0];
+    percentiles->p99  = results[1];
+    percentiles->p999 = results[2];
+}
+
+/**
+ * Write percentiles for every operation and size class to file descriptor.
+ * @param   fd      File descriptor to write to.
+ **/
+void        latency_dump(int fd) {
+    char        buffer[BUFSIZ];
+    Percentiles p;
+
+    fdprintf(fd, buffer, "latency:     p50 / p99 / p99.9 (cycles)\n");
+    for (int op = 0; op < NOPERATIONS; op++) {
+        const Histogram *histogram = &Latency->operations[op];
+        if (!histogram->count) {
+            continue;
+        }
+
+        latency_percentiles(histogram, &p);
+        fdprintf(fd, buffer, "  %-10s %lu / %lu / %lu (n=%lu, max=%lu)\n",
+            OperationNames[op], p.p50, p.p99, p.p999, histogram->count, histogram->max);
+
+        for (size_t c = 0; c < LATENCY_CLASSES; c++) {
+            histogram = &Latency->classes[op][c];
+            if (!histogram->count) {
+                continue;
+            }
+
+            latency_percentiles(histogram, &p);
+            fdprintf(fd, buffer, "    <= %-8lu %lu / %lu / %lu (n=%lu)\n",
+                c ? 1UL<<c : 1UL, p.p50, p.p99, p.p999, histogram->count);
+        }
+    }
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,130 @@
+/* lifetime.c: Object Lifetime Prediction
+ *
+ * When MALLOC_LIFETIME is set, allocations are keyed by call site and size
+ * class, and a sample of them is followed from malloc to free to learn which
+ * keys produce long-lived objects.  Objects predicted to be long-lived are
+ * placed in a separate region (see heap_sbrk_long), so they do not end up
+ * between short-lived ones, pin holes, and keep block_release from trimming
+ * the top of the heap.
+ *
+ * Lifetimes are measured in allocations rather than time, so prediction does
+ * not depend on how fast the program runs (or a trace is replayed).
+ **/
+
+#include "malloc/lifetime.h"
+#include "malloc/ptrmap.h"
+#include "malloc/stats.h"
+
+/* Structures */
+
+typedef struct {
+    uint32_t    shorts;	    /* Sampled objects freed young */
+    uint32_t    longs;	    /* Sampled objects that survived a ring cycle */
+} LifetimeSite;
+
+typedef struct {
+    void *      ptr;	    /* Sampled object (NULL once freed) */
+    uint32_t    key;	    /* Prediction table entry */
+} LifetimeSample;
+
+/* Global Variables */
+
+bool                    LifetimeEnabled = false;
+
+static LifetimeSite     Sites[LIFETIME_SITES];
+static LifetimeSample   Ring[LIFETIME_RING];
+static size_t           Next    = 0;	    /* Next ring slot */
+static size_t           Clock   = 0;	    /* Number of allocations */
+static PtrMap           Samples = {0};	    /* Sampled object -> ring slot */
+
+/* Functions */
+
+/**
+ * Enable lifetime prediction if MALLOC_LIFETIME is set.
+ **/
+void    lifetime_init() {
+    const char *enabled = getenv("MALLOC_LIFETIME");
+    LifetimeEnabled = enabled && *enabled && *enabled != '0';
+}
+
+/**
+ * Map call site and size class to prediction table entry.
+ **/
+static uint32_t lifetime_key(uintptr_t site, size_t size) {
+    uint64_t hash = ((uint64_t)site + STATS_CLASS(size) * 0x9E3779B97F4A7C15ULL) * 0xBF58476D1CE4E5B9ULL;
+    return (hash >> 40) & (LIFETIME_SITES - 1);
+}
+
+/**
+ * Record outcome of one sampled object.
+ **/
+static void     lifetime_outcome(uint32_t key, bool long_lived) {
+    LifetimeSite *entry = &Sites[key];
+
+    if (long_lived) {
+        entry->longs++;
+    } else {
+        entry->shorts++;
+    }
+
+    if (entry->longs + entry->shorts >= LIFETIME_DECAY) {
+        entry->longs  /= 2;
+        entry->shorts /= 2;
+    }
+}
+
+/**
+ * Predict whether an allocation will be long-lived.
+ * @param   site    Return address of the allocation call.
+ * @param   size    Number of bytes requested.
+ * @return  Whether the allocation should go in the long-lived region.
+ **/
+bool    lifetime_predict(uintptr_t site, size_t size) {
+    const LifetimeSite *entry = &Sites[lifetime_key(site, size)];
+    return entry->longs >= LIFETIME_EVIDENCE && entry->longs > entry->shorts;
+}
+
+/**
+ * Count allocation and sample one in every LIFETIME_PERIOD.  The ring slot
+ * being reused settles its previous sample as long-lived if still live.
+ * @param   ptr     Pointer returned to caller.
+ * @param   site    Return address of the allocation call.
+ * @param   size    Number of bytes requested.
+ **/
+void    lifetime_malloc(void *ptr, uintptr_t site, size_t size) {
+    if (++Clock % LIFETIME_PERIOD) {
+        return;
+    }
+
+    LifetimeSample *sample = &Ring[Next];
+    Next = (Next + 1) % LIFETIME_RING;
+
+    if (sample->ptr) {
+        ptr_map_remove(&Samples, sample->ptr, NULL);
+        lifetime_outcome(sample->key, true);
+    }
+
+    if (ptr_map_insert(&Samples, ptr, sample - Ring)) {
+        sample->ptr = ptr;
+        sample->key = lifetime_key(site, size);
+    } else {
+        sample->ptr = NULL;
+    }
+}
+
+/**
+ * Settle sample as short-lived if the freed object was being followed.
+ * @param   ptr     Pointer being freed.
+ **/
+void    lifetime_free(void *ptr) {
+    uint64_t slot;
+
+    if (!Samples.length || !ptr_map_remove(&Samples, ptr, &slot)) {
+        return;
+    }
+
+    Ring[slot].ptr = NULL;
+    lifetime_outcome(Ring[slot].key, false);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
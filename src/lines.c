@@ -0,0 +1,193 @@
+/* lines.c: Per-Thread Cache Line Regions
+ *
+ * When MALLOC_LINES is set, blocks of up to LINES_MAX bytes are not split
+ * off free blocks anywhere in the heap (where the neighbours on the same
+ * cache line may belong to any thread), but carved from chunks of a region
+ * of their own (see heap_sbrk_lines), one thread per chunk:
+ *
+ *  - A thread's small objects are packed densely, header after header.
+ *  - Freed blocks go back to the free lists of the thread that owns their
+ *    chunk (whoever frees them), so a line never changes hands.
+ *  - A thread that exits leaves its slot (chunks and free lists) to the next
+ *    new thread.
+ *
+ * Each chunk is always completely tiled by blocks (the uncarved tail is a
+ * free block too), so heap_walk can step through it like the heap.
+ **/
+
+#include "malloc/budget.h"
+#include "malloc/counters.h"
+#include "malloc/lines.h"
+
+#include <pthread.h>
+
+/* Global Variables */
+
+bool                        LinesEnabled = false;
+
+static LinesOwner           Owners[LINES_OWNERS];
+static pthread_key_t        ExitKey;
+static __thread LinesOwner *Local        = NULL;
+
+/* Functions */
+
+/**
+ * Give up the slot of an exiting thread.
+ **/
+static void         lines_exit(void *value) {
+    LinesOwner *owner = value;
+    __atomic_store_n(&owner->used, false, __ATOMIC_RELEASE);
+    Local = NULL;
+}
+
+/**
+ * Only the forking thread survives fork, so every other slot is free again
+ * in the child.
+ **/
+static void         lines_atfork_child() {
+    for (size_t i = 0; i < LINES_OWNERS; i++) {
+        if (&Owners[i] != Local) {
+            Owners[i].used = false;
+        }
+    }
+}
+
+/**
+ * Enable per-thread carving if MALLOC_LINES is set.
+ **/
+void    lines_init() {
+    const char *enabled = getenv("MALLOC_LINES");
+
+    LinesEnabled = enabled && *enabled && *enabled != '0';
+    if (LinesEnabled) {
+        pthread_key_create(&ExitKey, lines_exit);
+        pthread_atfork(NULL, NULL, lines_atfork_child);
+    }
+}
+
+/**
+ * Take a free slot for the calling thread.
+ * @return  Slot now owned by the thread (NULL if all are taken).
+ **/
+static LinesOwner * lines_adopt() {
+    for (size_t i = 0; i < LINES_OWNERS; i++) {
+        if (!__atomic_load_n(&Owners[i].used, __ATOMIC_ACQUIRE)) {
+            Owners[i].used = true;
+            Local          = &Owners[i];
+            pthread_setspecific(ExitKey, Local);
+            return Local;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Return free list a block of specified capacity belongs on (blocks larger
+ * than LINES_MAX, from the end of a chunk, still serve LINES_MAX requests).
+ **/
+static Block **     lines_class(LinesOwner *owner, size_t capacity) {
+    size_t class = (capacity < LINES_MAX ? capacity : LINES_MAX) / ALIGNMENT - 1;
+    return &owner->free[class];
+}
+
+/**
+ * Push block onto a free list (free blocks are not self-linked).
+ **/
+static void         lines_push(LinesOwner *owner, Block *block) {
+    Block **list = lines_class(owner, block->capacity);
+    block->next = *list;
+    block->prev = NULL;
+    *list       = block;
+}
+
+/**
+ * Start a new chunk for owner (the rest of its current chunk goes on its free
+ * lists).
+ * @return  Whether a chunk could be added.
+ **/
+static bool         lines_grow(LinesOwner *owner) {
+    if (!budget_charge(LINES_CHUNK, false)) {
+        return false;
+    }
+
+    char *chunk = heap_sbrk_lines(LINES_CHUNK);
+    if (chunk == SBRK_FAILURE) {
+        budget_credit(LINES_CHUNK, false);
+        return false;
+    }
+
+    if (owner->tail) {
+        lines_push(owner, owner->tail);
+    }
+
+    ((LinesChunk *)chunk)->owner = owner - Owners;
+
+    Block *tail    = (Block *)(chunk + LINES_HEADER);
+    tail->capacity = LINES_CHUNK - LINES_HEADER - sizeof(Block);
+    tail->size     = 0;
+    tail->prev     = NULL;
+    tail->next     = NULL;
+    owner->tail    = tail;
+
+    COUNTER_ADD(HEAP_SIZE, LINES_CHUNK);
+    budget_credit(LINES_CHUNK, false);
+    COUNTER_INC(BLOCKS);
+    COUNTER_INC(GROWS);
+    return true;
+}
+
+/**
+ * Allocate a block for the calling thread from its own chunks:
+ *
+ *  1. Reuse a freed block of the same capacity class.
+ *  2. Otherwise carve one off the front of the current chunk's tail (adding
+ *  a chunk if the tail is too small).
+ *
+ * @param   capacity    Aligned capacity required (at most LINES_MAX).
+ * @return  Allocated (self-linked) block, or NULL to fall back to the heap.
+ **/
+Block * lines_allocate(size_t capacity) {
+    LinesOwner *owner = Local ? Local : lines_adopt();
+    if (!owner) {
+        return NULL;
+    }
+
+    Block **list  = lines_class(owner, capacity);
+    Block * block = *list;
+    if (block) {
+        *list = block->next;
+    } else {
+        if ((!owner->tail || owner->tail->capacity < capacity) && !lines_grow(owner)) {
+            return NULL;
+        }
+
+        block = owner->tail;
+        if (block->capacity >= capacity + sizeof(Block) + ALIGNMENT) {
+            Block *tail    = (Block *)(block->data + capacity);
+            tail->capacity = block->capacity - capacity - sizeof(Block);
+            tail->size     = 0;
+            tail->prev     = NULL;
+            tail->next     = NULL;
+            block->capacity = capacity;
+            owner->tail     = tail;
+            COUNTER_INC(BLOCKS);
+        } else {
+            owner->tail = NULL;
+        }
+    }
+
+    block->prev = block;
+    block->next = block;
+    return block;
+}
+
+/**
+ * Return a carved block to the free lists of the thread that owns its chunk.
+ * @param   block   Block from lines_allocate.
+ **/
+void    lines_free(Block *block) {
+    LinesChunk *chunk = (LinesChunk *)((uintptr_t)block & ~(LINES_CHUNK - 1));
+    lines_push(&Owners[chunk->owner], block);
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,289 @@
+/* persist.c: File-Backed Persistent Heap
+ *
+ * When MALLOC_PERSIST names a file, the heap is a private mapping of that file
+ * at PERSIST_BASE (see persist.h), so a restarted process can reattach to the
+ * heap saved by its predecessor, and to everything reachable from
+ * persist_root, without rebuilding any of it.
+ *
+ * Only one process may own a heap file at a time (it is locked with flock),
+ * and only the owner (not its forked children) writes the heap back.
+ **/
+
+#define _GNU_SOURCE
+
+#include "malloc/freelist.h"
+#include "malloc/heap.h"
+#include "malloc/persist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Global Variables */
+
+PersistHeader * Persist   = NULL;
+
+static int      PersistFD = -1;
+static pid_t    Owner     = 0;
+
+/* Functions */
+
+/**
+ * Write all of buffer to the heap file at the specified offset.
+ * @param   fd      File descriptor of the heap file.
+ * @param   buffer  Data to write.
+ * @param   length  Number of bytes to write.
+ * @param   offset  File offset to write at.
+ * @return  Whether or not everything was written.
+ **/
+static bool persist_write(int fd, const void *buffer, size_t length, off_t offset) {
+    const char *data = buffer;
+    while (length) {
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data   += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+/**
+ * Relink the free list saved by the last owner: the saved chain is appended
+ * block by block, which also rebuilds the free index and running totals.
+ * @param   header  Header of the attached heap.
+ **/
+static void persist_relink(PersistHeader *header) {
+    for (Block *block = header->free_next; block && block != header->sentinel;) {
+        Block *next = block->next;
+        free_list_append(block);
+        block = next;
+    }
+
+    counters_restore(header->counters);
+}
+
+/**
+ * Find where the well-formed blocks at the start of the heap end, walking it
+ * block by block up to limit.
+ * @param   header  Header of the attached heap.
+ * @param   limit   Address the walk must not go past.
+ * @return  End of the last well-formed block (the heap start if none).
+ **/
+static char *persist_extent(PersistHeader *header, char *limit) {
+    char *curr = (char *)header + PERSIST_HEADER;
+
+    while (curr + sizeof(Block) <= limit) {
+        Block *block = (Block *)curr;
+        if (block->capacity == 0 || block->capacity != ALIGN(block->capacity) ||
+            block->capacity > (size_t)(limit - curr) - sizeof(Block)) {
+            break;
+        }
+        curr += sizeof(Block) + block->capacity;
+    }
+
+    return curr;
+}
+
+/**
+ * Rebuild the free list of a heap whose last sync did not complete by walking
+ * it block by block (allocated blocks are the self-linked ones).
+ * @param   header  Header of the attached heap.
+ * @param   brk     End of the heap, as found by persist_extent.
+ **/
+static void persist_rebuild(PersistHeader *header, char *brk) {
+    char * start = (char *)header + PERSIST_HEADER;
+    size_t counters[NCOUNTERS] = {0};
+
+    for (char *curr = start; curr < brk;) {
+        Block *block = (Block *)curr;
+        if (block->next != block) {
+            free_list_append(block);
+        }
+        counters[BLOCKS]++;
+        curr += sizeof(Block) + block->capacity;
+    }
+
+    counters[HEAP_SIZE] = brk - start;
+    counters_restore(counters);
+}
+
+/**
+ * Attach to (or create) the heap file named by MALLOC_PERSIST:
+ *
+ *  1. Open and lock the file; an existing file must carry a valid header.
+ *  2. Size a new file (MALLOC_PERSIST_SIZE MB, or PERSIST_RESERVE) and
+ *     write its header.
+ *  3. Map it privately at PERSIST_BASE and hand the heap part to heap.c.
+ *     The saved break must lie inside the file; if it does not, or the
+ *     last sync did not complete, the heap ends after its last well-formed
+ *     block instead.
+ *  4. Restore the free list and counters (relinking the saved chain after a
+ *     completed sync, otherwise walking the heap).
+ *  5. Register persist_sync at exit.
+ *
+ * If any step fails, the regular heap is used instead.
+ **/
+void persist_init() {
+    const char *  path = getenv("MALLOC_PERSIST");
+    const char *  size = getenv("MALLOC_PERSIST_SIZE");
+    PersistHeader saved;
+    struct stat   st;
+
+    if (!path || !*path || Persist) {
+        return;
+    }
+
+    int fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    if (flock(fd, LOCK_EX|LOCK_NB) < 0 || fstat(fd, &st) < 0) {
+        goto failure;
+    }
+
+    bool   fresh   = st.st_size == 0;
+    size_t reserve = PERSIST_RESERVE;
+    if (fresh) {
+        if (size && strtoul(size, NULL, 10) > 0) {
+            reserve = (strtoul(size, NULL, 10) << 20) + PERSIST_HEADER;
+        }
+
+        memset(&saved, 0, sizeof(saved));
+        saved.magic   = PERSIST_MAGIC;
+        saved.version = PERSIST_VERSION;
+        saved.clean   = 1;
+        saved.base    = PERSIST_BASE;
+        saved.reserve = reserve;
+        saved.brk     = PERSIST_BASE + PERSIST_HEADER;
+        if (ftruncate(fd, reserve) < 0 || !persist_write(fd, &saved, sizeof(saved), 0)) {
+            goto failure;
+        }
+    } else {
+        if (pread(fd, &saved, sizeof(saved), 0) != sizeof(saved) ||
+            saved.magic   != PERSIST_MAGIC   ||
+            saved.version != PERSIST_VERSION ||
+            saved.base    != PERSIST_BASE    ||
+            saved.reserve != (size_t)st.st_size ||
+            saved.reserve <= PERSIST_HEADER) {
+            goto failure;
+        }
+        reserve = saved.reserve;
+    }
+
+    PersistHeader *header = mmap((void *)PERSIST_BASE, reserve, PROT_READ|PROT_WRITE,
+                                 MAP_PRIVATE|MAP_FIXED_NOREPLACE, fd, 0);
+    if (header == MAP_FAILED) {
+        goto failure;
+    }
+    if (header != (void *)PERSIST_BASE) {
+        munmap(header, reserve);
+        goto failure;
+    }
+
+    char *base   = (char *)header;
+    char *brk    = (char *)header->brk;
+    bool  inside = brk >= base + PERSIST_HEADER && brk <= base + reserve &&
+                   (uintptr_t)brk == ALIGN((uintptr_t)brk);
+    bool  clean  = header->clean && inside;
+    if (!clean) {
+        brk = persist_extent(header, inside ? brk : base + reserve);
+    }
+
+    if (!heap_attach(base + PERSIST_HEADER, brk, base + reserve)) {
+        munmap(header, reserve);
+        goto failure;
+    }
+
+    if (clean) {
+        persist_relink(header);
+    } else {
+        persist_rebuild(header, brk);
+    }
+    Persist   = header;
+    PersistFD = fd;
+    Owner     = getpid();
+
+    atexit(persist_sync);
+    return;
+
+failure:
+    close(fd);
+}
+
+/**
+ * Write the heap back to its file so the next owner can attach to it:
+ *
+ *  1. Mark the file unclean, so an interrupted sync is detected.
+ *  2. Write the heap up to the break, punch out stale data past it and
+ *     flush all of it to disk.
+ *  3. Record the break, free list and counters, mark the file clean and
+ *     flush the header, so a clean header never describes data the disk
+ *     does not hold yet.
+ *
+ * Runs at exit in the owning process; it may also be called at any point
+ * where no other thread is using the allocator.
+ **/
+void persist_sync() {
+    if (!Persist || getpid() != Owner) {
+        return;
+    }
+
+    char *    base  = (char *)Persist;
+    char *    brk   = heap_sbrk(0);
+    uintptr_t page  = getpagesize();
+    size_t    used  = ((brk - base) + page - 1) & ~(page - 1);
+    uint32_t  clean = 0;
+
+    if (!persist_write(PersistFD, &clean, sizeof(clean), offsetof(PersistHeader, clean)) ||
+        !persist_write(PersistFD, base + PERSIST_HEADER, brk - base - PERSIST_HEADER, PERSIST_HEADER)) {
+        return;
+    }
+    if (used < Persist->reserve) {
+        fallocate(PersistFD, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, used, Persist->reserve - used);
+    }
+    if (fdatasync(PersistFD) < 0) {
+        return;
+    }
+
+    Persist->brk       = (uintptr_t)brk;
+    Persist->free_next = FreeList.next == &FreeList ? NULL : FreeList.next;
+    Persist->sentinel  = &FreeList;
+    Persist->clean     = 1;
+    counters_snapshot(Persist->counters);
+    if (persist_write(PersistFD, Persist, sizeof(PersistHeader), 0)) {
+        fdatasync(PersistFD);
+    }
+}
+
+/**
+ * Return application root object stored in the heap (NULL if none was set or
+ * the heap is not persistent).
+ **/
+void *  persist_root() {
+    return Persist ? Persist->root : NULL;
+}
+
+/**
+ * Store application root object, the entry point to data a restarted process
+ * should find again.
+ * @param   root    Pointer to memory allocated from the persistent heap.
+ **/
+void    persist_set_root(void *root) {
+    if (Persist) {
+        Persist->root = root;
+    }
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
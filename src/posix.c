@@ -1,112 +1,428 @@
 /* posix.c: POSIX API Implementation */
 
+#include "malloc/budget.h"
 #include "malloc/counters.h"
+#include "malloc/defer.h"
+#include "malloc/fast.h"
 #include "malloc/freelist.h"
+#include "malloc/guard.h"
+#include "malloc/heap.h"
+#include "malloc/heapmap.h"
+#include "malloc/latency.h"
+#include "malloc/lifetime.h"
+#include "malloc/lines.h"
+#include "malloc/profile.h"
+#include "malloc/sizeclass.h"
+#include "malloc/stats.h"
+#include "malloc/trace.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
+/* Global Variables */
+
+/* Heap Lock
+ *
+ * The free list, its index and the regions were written for one thread, and
+ * sharded counters only pay off once several threads call in at the same
+ * time, so every change to the heap happens under this one lock.  Work that
+ * does not touch the heap (counters, latency timing, deferred-free queues,
+ * pressure callbacks) stays outside of it.
+ **/
+static pthread_mutex_t HeapLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Functions */
+
+static void heap_lock()   { pthread_mutex_lock(&HeapLock); }
+static void heap_unlock() { pthread_mutex_unlock(&HeapLock); }
+
 /**
- * Allocate specified amount memory.
+ * Hold the heap lock across fork, so the child never inherits a heap that
+ * another thread was in the middle of modifying.
+ **/
+__attribute__((constructor))
+static void heap_atfork() {
+    pthread_atfork(heap_lock, heap_unlock, heap_unlock);
+}
+
+/**
+ * Give free memory back to the system (with the heap lock held):
+ *
+ *  1. Merge every run of adjacent free blocks.
+ *  2. Trim free blocks off the top of the heap (leaving pad bytes).
+ *  3. Drop the pages inside the remaining free blocks.
+ *
+ * @param   pad     Bytes of free space to keep at the top of the heap.
+ * @return  Number of bytes trimmed or dropped.
+ **/
+static size_t heap_trim(size_t pad) {
+    free_list_consolidate();
+    size_t released = free_list_trim(pad);
+    return released + free_list_purge();
+}
+
+/**
+ * Relieve memory pressure flagged by the budget (with the heap lock not held):
+ * call the pressure callbacks, so caches can free entries, then trim the heap.
+ **/
+static void heap_relieve() {
+    if (!budget_relief_begin()) {
+        return;
+    }
+
+    budget_notify();
+
+    heap_lock();
+    heap_trim(0);
+    heap_unlock();
+
+    budget_relief_end();
+}
+
+/**
+ * Allocate specified amount memory (untimed), in a single attempt.
  * @param   size    Amount of bytes to allocate.
+ * @param   dirty   Where to store how many leading bytes may hold old data
+ *                  (may be NULL); memory past that is known to be zero.
+ * @param   site    Return address of the public call (for lifetime
+ *                  prediction).
  * @return  Pointer to the requested amount of memory.
  **/
-void *malloc(size_t size) {
+static void *heap_malloc_once(size_t size, size_t *dirty, uintptr_t site) {
     // Initialize counters
-    init_counters();
+    INIT_COUNTERS();
 
     // Handle empty size
     if (!size) {
         return NULL;
     }
 
+    // Serve a sample of allocations from guard page isolated slots
+    if (GUARD_SAMPLE()) {
+        heap_lock();
+        void *data = guard_malloc(size, site);
+        if (data) {
+            STATS_MALLOC(size);
+            STATS_PUBLISH();
+        }
+        heap_unlock();
+
+        if (data) {
+            if (dirty) {
+                *dirty = 0;
+            }
+            COUNTER_INC(MALLOCS);
+            COUNTER_ADD(REQUESTED, size);
+            return data;
+        }
+    }
+
+    // Round up to a size class, so freed blocks fit later requests exactly
+#ifdef SIZE_CLASSES
+    size_t capacity = size_class_round(size);
+#else
+    size_t capacity = size;
+#endif
+
     // TODO: Search free list for any available block with matching size
-    Block *block = free_list_search(size);
-    if (block){
-        block = block_split(block, size);
-        block = block_detach(block);
+    heap_lock();
+    HEAPMAP_CHECK();
+
+    // Carve small blocks from the calling thread's own cache lines, and keep
+    // predicted long-lived and other objects in free blocks of their own region
+    Block *carved     = LinesEnabled && capacity <= LINES_MAX ? lines_allocate(ALIGN(capacity)) : NULL;
+    bool   long_lived = !carved && LifetimeEnabled && lifetime_predict(site, size);
+    Block *block      = carved ? carved :
+                        LifetimeEnabled ? free_list_search_region(capacity, long_lived) :
+                        free_list_search(capacity);
+
+    if (carved) {
+        if (dirty) {
+            *dirty = size;
+        }
+    }
+
+    else if (block){
+        block = free_list_detach(block, capacity);
+        if (dirty) {
+            *dirty = size;
+        }
+    }
+
+    else if (long_lived && (block = block_allocate_long(capacity))) {
+        if (dirty) {
+            *dirty = size;
+        }
     }
     
     else{
-        block = block_allocate(size);
-        if (!block)
-            return NULL;
+        block = block_allocate(capacity);
+        if (block && dirty) {
+            size_t used = (char *)heap_fresh() - block->data;
+            *dirty = (char *)heap_fresh() <= block->data ? 0 : (used < size ? used : size);
+        }
     }
 
     // Could not find free block or allocate a block, so just return NULL
     if (!block) {
+        heap_unlock();
         return NULL;
     }
 
+    // Record the requested size (the block may be a larger class)
+    block->size = size;
+
     // Check if allocated block makes sense
     assert(block->capacity >= block->size);
     assert(block->size     == size);
     assert(block->next     == block);
     assert(block->prev     == block);
 
+    if (LifetimeEnabled) {
+        lifetime_malloc(block->data, site, size);
+    }
+
+    STATS_MALLOC(size);
+    STATS_PUBLISH();
+    heap_unlock();
+
+    if (__atomic_load_n(&BudgetPressure, __ATOMIC_RELAXED)) {
+        heap_relieve();
+    }
+
     // Update counters
-    Counters[MALLOCS]++;
-    Counters[REQUESTED] += size;
+    COUNTER_INC(MALLOCS);
+    COUNTER_ADD(REQUESTED, size);
 
     // Return data address associated with block
     return block->data;
 }
 
 /**
- * Release previously allocated memory.
+ * Allocate specified amount memory (untimed).  When the budget's hard limit
+ * stops the heap from growing, relieve the pressure that flags (callbacks,
+ * then trimming) and try once more, since that may have made room.
+ * @param   size    Amount of bytes to allocate.
+ * @param   dirty   Where to store how many leading bytes may hold old data
+ *                  (may be NULL); memory past that is known to be zero.
+ * @param   site    Return address of the public call (for lifetime
+ *                  prediction).
+ * @return  Pointer to the requested amount of memory.
+ **/
+static void *heap_malloc(size_t size, size_t *dirty, uintptr_t site) {
+    void *data = heap_malloc_once(size, dirty, site);
+    if (!data && __atomic_load_n(&BudgetPressure, __ATOMIC_RELAXED)) {
+        heap_relieve();
+        data = heap_malloc_once(size, dirty, site);
+    }
+    return data;
+}
+
+/**
+ * Release previously allocated memory with the heap lock held.
  * @param   ptr     Pointer to previously allocated memory.
+ * @param   site    Return address of the public call.
  **/
-void free(void *ptr) {
-    if (!ptr) {
+static void heap_free_locked(void *ptr, uintptr_t site) {
+    HEAPMAP_CHECK();
+
+    // Sampled allocations go back to the guard pool
+    if (GUARD_OWNS(ptr)) {
+        size_t size = guard_free(ptr, site);
+        STATS_FREE(size);
+        STATS_PUBLISH();
         return;
     }
 
-    // Update counters
-    Counters[FREES]++;
-
     // TODO: Try to release block, otherwise insert it into the free list
     Block *block = BLOCK_FROM_POINTER(ptr);
-    if (!block_release(block))
+    if (LifetimeEnabled) {
+        lifetime_free(ptr);
+    }
+    STATS_FREE(block->size);
+    if (heap_lines(ptr))
+        lines_free(block);
+    else if (!block_unmap(block) && !block_release(block))
         free_list_insert(block);
+    STATS_PUBLISH();
+}
+
+/**
+ * Release previously allocated memory (untimed).
+ * @param   ptr     Pointer to previously allocated memory.
+ * @param   site    Return address of the public call.
+ **/
+static void heap_free(void *ptr, uintptr_t site) {
+    if (!ptr) {
+        return;
+    }
+
+    // Update counters
+    COUNTER_INC(FREES);
+
+    heap_lock();
+    heap_free_locked(ptr, site);
+    heap_unlock();
 
     // Return pointer to previously allocated memory
 }
 
 /**
- * Allocate memory with specified number of elements and with each element set
- * to 0.
- * @param   nmemb   Number of elements.
- * @param   size    Size of each element.
- * @return  Pointer to requested amount of memory.
+ * Release a chain of deferred frees (see defer.c) or of blocks flushed from a
+ * thread cache (see fast.c), taking the heap lock once
+ * per DEFER_BATCH blocks, so allocating threads are never shut out for long.
+ * @param   chain   Pointers chained through their first word.
  **/
-void *calloc(size_t nmemb, size_t size) {
-    // TODO: Implement calloc
-    // Counters[CALLOCS]++;
-    char *data = malloc(nmemb * size);
-    bzero(data, nmemb*size);
-    Counters[CALLOCS]++;
+static void heap_free_chain(void *chain) {
+    size_t n = 0;
+
+    heap_lock();
+    while (chain) {
+        void *next = *(void **)chain;
+        COUNTER_INC(FREES);
+        heap_free_locked(chain, 0);
+        chain = next;
+
+        if (++n % DEFER_BATCH == 0) {
+            heap_unlock();
+            heap_lock();
+        }
+    }
+    heap_unlock();
+}
+
+/**
+ * Initialize counters (and every feature enabled in the environment) when the
+ * library is loaded, so allocations do not have to, then set up deferred
+ * frees and the thread caches of the fast path.
+ **/
+__attribute__((constructor))
+static void heap_init() {
+    init_counters();
+    defer_init(heap_free_chain);
+    fast_init(heap_free_chain);
+}
+
+/**
+ * Allocate specified amount memory.
+ * @param   size    Amount of bytes to allocate.
+ * @return  Pointer to the requested amount of memory.
+ **/
+void *malloc(size_t size) {
+    LATENCY_BEGIN();
+    void *data = heap_malloc(size, NULL, (uintptr_t)__builtin_return_address(0));
+    PROFILE_MALLOC(data, size);
+    TRACE_RECORD(OP_MALLOC, data, 0, size);
+    LATENCY_END(OP_MALLOC, size);
     return data;
 }
 
 /**
- * Reallocate memory with specified size.
+ * Release previously allocated memory (timed), now or later.
+ * @param   ptr     Pointer to previously allocated memory.
+ * @param   site    Return address of the public call.
+ * @param   defer   Whether to leave the work to the reclaimer thread.
+ **/
+static inline void heap_free_timed(void *ptr, uintptr_t site, bool defer) {
+    size_t size = (Latency && ptr && !GUARD_OWNS(ptr)) ? (BLOCK_FROM_POINTER(ptr))->size : 0;
+    LATENCY_BEGIN();
+    PROFILE_FREE(ptr);
+    uint32_t old = TRACE_FORGET(ptr);
+    // Guarded blocks are checked at free, so the report names the right caller
+    if (defer && ptr && !GUARD_OWNS(ptr)) {
+        defer_push(ptr);
+    } else {
+        heap_free(ptr, site);
+    }
+    if (ptr) {
+        TRACE_RECORD(OP_FREE, NULL, old, 0);
+    }
+    LATENCY_END(OP_FREE, size);
+}
+
+/**
+ * Release previously allocated memory (deferred when MALLOC_DEFER is set).
+ * @param   ptr     Pointer to previously allocated memory.
+ **/
+void free(void *ptr) {
+    heap_free_timed(ptr, (uintptr_t)__builtin_return_address(0), DeferEnabled);
+}
+
+/**
+ * Release previously allocated memory later: the pointer is pushed onto a
+ * per-thread chain in constant time, and a background reclaimer thread does
+ * the free list inserts and heap trimming in batches.
+ * @param   ptr     Pointer to previously allocated memory.
+ **/
+void free_deferred(void *ptr) {
+    heap_free_timed(ptr, (uintptr_t)__builtin_return_address(0), true);
+}
+
+/**
+ * Allocate zeroed memory (untimed):
+ *
+ *  1. Large requests get their own anonymous mapping, which is already zero
+ *  (except with a persistent heap, where everything stays in the heap file).
+ *  A mapping the hard limit refused is tried once more after relief.
+ *  2. Otherwise only clear the part of the block that may hold old data
+ *  (recycled blocks are cleared in full; fresh heap memory is left alone).
+ *
+ * @param   size    Amount of bytes to allocate.
+ * @param   site    Return address of the public call.
+ * @return  Pointer to requested amount of zeroed memory.
+ **/
+static void *heap_calloc(size_t size, uintptr_t site) {
+    INIT_COUNTERS();
+    if (size >= MMAP_THRESHOLD && !heap_persistent()) {
+        Block *block = block_map(size);
+        if (__atomic_load_n(&BudgetPressure, __ATOMIC_RELAXED)) {
+            heap_relieve();
+            block = block ? block : block_map(size);
+        }
+        if (!block) {
+            return NULL;
+        }
+
+        heap_lock();
+        STATS_MALLOC(size);
+        STATS_PUBLISH();
+        heap_unlock();
+
+        COUNTER_INC(MALLOCS);
+        COUNTER_ADD(REQUESTED, size);
+        return block->data;
+    }
+
+    size_t dirty = 0;
+    char * data  = heap_malloc(size, &dirty, site);
+    if (data && dirty) {
+        memset(data, 0, dirty);
+    }
+    return data;
+}
+
+/**
+ * Reallocate memory with specified size (untimed).
  * @param   ptr     Pointer to previously allocated memory.
  * @param   size    Amount of bytes to allocate.
+ * @param   site    Return address of the public call.
  * @return  Pointer to requested amount of memory.
  **/
-void *realloc(void *ptr, size_t size) {
+static void *heap_realloc(void *ptr, size_t size, uintptr_t site) {
     // TODO: Implement realloc
-    Counters[REALLOCS]++;
+    COUNTER_INC(REALLOCS);
     Block *blockptr = BLOCK_FROM_POINTER(ptr);
     void *newptr;
 
     if(size==0){
-        free(ptr);
+        heap_free(ptr, site);
         return NULL;
     }
 
     else if (!ptr){
-        return malloc(size);
+        return heap_malloc(size, NULL, site);
     }
 
     else if (size <= blockptr->size){
@@ -115,11 +431,11 @@ void *realloc(void *ptr, size_t size) {
     
     else{
         // This copies old size into newptr. There is still size-oldsize left as added memory.
-        newptr = malloc(size);
+        newptr = heap_malloc(size, NULL, site);
         if (newptr){
-            if (!memcpy(newptr, blockptr, blockptr->size))
+            if (!memcpy(newptr, ptr, blockptr->size))
                 return NULL;
-            free(ptr);
+            heap_free(ptr, site);
         }
         else
             return NULL;
@@ -128,4 +444,171 @@ void *realloc(void *ptr, size_t size) {
     return newptr;
 }
 
+/**
+ * Allocate memory with specified number of elements and with each element set
+ * to 0.
+ * @param   nmemb   Number of elements.
+ * @param   size    Size of each element.
+ * @return  Pointer to requested amount of memory (NULL if nmemb * size
+ *          overflows).
+ **/
+void *calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    LATENCY_BEGIN();
+    void *data = heap_calloc(total, (uintptr_t)__builtin_return_address(0));
+    if (data) {
+        COUNTER_INC(CALLOCS);
+    }
+    PROFILE_MALLOC(data, total);
+    TRACE_RECORD(OP_CALLOC, data, 0, total);
+    LATENCY_END(OP_CALLOC, total);
+    return data;
+}
+
+/**
+ * Reallocate memory with specified size.
+ * @param   ptr     Pointer to previously allocated memory.
+ * @param   size    Amount of bytes to allocate.
+ * @return  Pointer to requested amount of memory.
+ **/
+void *realloc(void *ptr, size_t size) {
+    LATENCY_BEGIN();
+    // Forget the old object first, so a thread reusing its address once it
+    // is released is never confused with it
+    uint64_t sample = PROFILE_FREE(ptr);
+    uint32_t old    = TRACE_FORGET(ptr);
+    void *data = heap_realloc(ptr, size, (uintptr_t)__builtin_return_address(0));
+    if (!data && size) {
+        // Failed, so the old object is still live
+        PROFILE_RESTORE(ptr, sample);
+        TRACE_RESTORE(ptr, old);
+    } else {
+        PROFILE_MALLOC(data, size);
+        TRACE_RECORD(OP_REALLOC, data, old, size);
+    }
+    LATENCY_END(OP_REALLOC, size);
+    return data;
+}
+
+/**
+ * Set the heap memory budget (see budget.h); 0 removes a limit.
+ * @param   soft    Usage past which pressure callbacks run and free memory
+ *                  is given back.
+ * @param   hard    Usage past which allocations fail with ENOMEM.
+ * @return  0 on success, otherwise -1 (EINVAL if soft exceeds hard).
+ **/
+int malloc_set_budget(size_t soft, size_t hard) {
+    INIT_COUNTERS();
+    if (!budget_set(soft, hard)) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Register a function to call (with no allocator lock held) when memory use
+ * crosses the soft limit, or an allocation hits the hard limit.
+ * @param   callback    Function to call with usage and the limit reached.
+ * @param   arg         Argument passed through to callback.
+ * @return  0 on success, otherwise -1 (ENOSPC if there are too many).
+ **/
+int malloc_register_pressure(PressureCallback callback, void *arg) {
+    if (!budget_register(callback, arg)) {
+        errno = ENOSPC;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Give as much free memory back to the system as possible (for instance at a
+ * quiet point after dropping a cache):
+ *
+ *  1. Finish deferred frees and flush the calling thread's fast path cache.
+ *  2. Merge all adjacent free blocks, trim the top of the heap down to pad
+ *  bytes of free space and drop the pages inside the remaining free blocks.
+ *
+ * @param   pad     Bytes of free space to keep at the top of the heap.
+ * @return  Number of bytes trimmed from the heap or dropped from free blocks.
+ **/
+size_t malloc_release(size_t pad) {
+    INIT_COUNTERS();
+    defer_drain();
+    malloc_fast_flush();
+
+    heap_lock();
+    HEAPMAP_CHECK();
+    size_t released = heap_trim(pad);
+    heap_unlock();
+    return released;
+}
+
+/**
+ * Give free memory back to the system (as glibc's malloc_trim).
+ * @param   pad     Bytes of free space to keep at the top of the heap.
+ * @return  1 if any memory was given back, otherwise 0.
+ **/
+int malloc_trim(size_t pad) {
+    return malloc_release(pad) > 0;
+}
+
+/**
+ * Stop all allocation (until malloc_enable), so the heap can be iterated.
+ **/
+void malloc_disable() {
+    heap_lock();
+}
+
+/**
+ * Resume allocation after malloc_disable.
+ **/
+void malloc_enable() {
+    heap_unlock();
+}
+
+/* Iteration state for malloc_iterate */
+typedef struct {
+    uintptr_t   base;
+    uintptr_t   end;
+    void      (*callback)(uintptr_t ptr, size_t size, void *arg);
+    void *      arg;
+} IterateRange;
+
+/**
+ * Report an allocated block in range (heap_walk visitor).
+ **/
+static bool malloc_iterate_visit(Block *block, bool allocated, void *arg) {
+    IterateRange *range = arg;
+    uintptr_t     data  = (uintptr_t)block->data;
+
+    if (allocated && data >= range->base && data < range->end) {
+        range->callback(data, block->capacity, range->arg);
+    }
+    return true;
+}
+
+/**
+ * Call callback with the address and usable size of every allocation whose
+ * data starts in [base, base + size), walking the heap in address order.
+ *
+ * As with bionic, the caller must call malloc_disable first and
+ * malloc_enable afterwards, and callback must not allocate.  Free blocks can
+ * be seen with heap_walk (or in a MALLOC_HEAPMAP dump).
+ * @param   base        Start of address range.
+ * @param   size        Length of address range.
+ * @param   callback    Function to call for each allocation.
+ * @param   arg         Argument passed through to callback.
+ * @return  0 if the whole heap was walked, otherwise -1.
+ **/
+int malloc_iterate(uintptr_t base, size_t size, void (*callback)(uintptr_t ptr, size_t size, void *arg), void *arg) {
+    IterateRange range = {base, base + size < base ? UINTPTR_MAX : base + size, callback, arg};
+    return heap_walk(malloc_iterate_visit, &range) ? 0 : -1;
+}
+
 /* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,355 @@
+/* profile.c: Sampling Heap Profiler
+ *
+ * When MALLOC_PROFILE is set in the environment (to the mean number of bytes
+ * between samples, or 1 for the default of PROFILE_RATE), each thread draws
+ * exponentially distributed byte intervals and records a stack trace for the
+ * allocation that crosses the end of each interval.  This samples roughly one
+ * allocation per MALLOC_PROFILE bytes with a probability proportional to its
+ * size, so a small, fixed overhead still finds the call sites that own most of
+ * the heap.
+ *
+ * Sampled objects are tracked until freed, and a profile in the legacy
+ * gperftools heap format (readable by pprof) is written to:
+ *
+ *      $MALLOC_PROFILE_FILE.NNNN.heap   (default malloc-heap.<pid>.NNNN.heap)
+ *
+ * at exit and whenever the signal in MALLOC_PROFILE_SIGNAL is received (the
+ * dump happens on the next allocator call, never inside the handler).
+ **/
+
+#include "malloc/counters.h"
+#include "malloc/profile.h"
+#include "malloc/ptrmap.h"
+
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define PROFILE_STACKS  (1<<12)	    /* Initial number of stacks */
+#define PROFILE_ID_BITS 24	    /* Bits of object value used for stack id */
+
+/* Global Variables */
+
+size_t                  ProfileRate = 0;
+
+static pthread_mutex_t  ProfileLock   = PTHREAD_MUTEX_INITIALIZER;
+static ProfileStack *   Stacks        = NULL;	/* Distinct sampled stacks */
+static size_t           NStacks       = 0;
+static size_t           AllocatedStacks = 0;
+static PtrMap           StackIndex    = {0};	/* Stack hash -> stack id + 1 */
+static PtrMap           Objects       = {0};	/* Sampled object -> size and stack id */
+static size_t           Live          = 0;	/* Number of live sampled objects */
+static char             Prefix[256]   = {0};
+static unsigned         Sequence      = 0;
+
+static volatile sig_atomic_t DumpRequested = 0;
+
+static __thread int64_t  UntilSample __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t Seed        __attribute__((tls_model("initial-exec"))) = 0;
+static __thread bool     Sampling    __attribute__((tls_model("initial-exec"))) = false;
+
+/* Functions */
+
+/**
+ * Draw the number of bytes until the next sample from an exponential
+ * distribution with mean ProfileRate.
+ * @return  Number of bytes until next sample.
+ **/
+static int64_t  profile_interval() {
+    Seed ^= Seed >> 12;
+    Seed ^= Seed << 25;
+    Seed ^= Seed >> 27;
+
+    double uniform = (double)(((Seed * 0x2545F4914F6CDD1DULL) >> 11) + 1) / (double)(1ULL<<53);
+    double bytes   = -log(uniform) * ProfileRate;
+    return bytes < 1.0 ? 1 : (int64_t)bytes;
+}
+
+/**
+ * Request a profile dump from a signal handler.
+ **/
+static void     profile_signal(int signum) {
+    DumpRequested = 1;
+}
+
+/**
+ * Write a profile with the next sequence number.
+ **/
+static void     profile_dump_next() {
+    char path[sizeof(Prefix) + 16];
+    snprintf(path, sizeof(path), "%s.%04u.heap", Prefix, Sequence++);
+    profile_dump(path);
+}
+
+/**
+ * Write final profile when the program terminates.
+ **/
+static void     profile_exit() {
+    Sampling = true;
+    profile_dump_next();
+}
+
+static void     profile_lock()   { pthread_mutex_lock(&ProfileLock); }
+static void     profile_unlock() { pthread_mutex_unlock(&ProfileLock); }
+
+/**
+ * Enable the profiler if MALLOC_PROFILE is set:
+ *
+ *  1. Set the sampling rate and the output file prefix.
+ *  2. Install the dump signal handler (if MALLOC_PROFILE_SIGNAL is set).
+ *  3. Call backtrace once, so its lazy initialization (which allocates)
+ *     happens here rather than while sampling.
+ **/
+void    profile_init() {
+    const char *rate   = getenv("MALLOC_PROFILE");
+    const char *file   = getenv("MALLOC_PROFILE_FILE");
+    const char *signum = getenv("MALLOC_PROFILE_SIGNAL");
+
+    if (!rate || !*rate || *rate == '0') {
+        return;
+    }
+
+    size_t bytes = strtoul(rate, NULL, 10);
+    ProfileRate  = bytes > 1 ? bytes : PROFILE_RATE;
+
+    if (file && *file) {
+        snprintf(Prefix, sizeof(Prefix), "%s", file);
+    } else {
+        snprintf(Prefix, sizeof(Prefix), PROFILE_PREFIX, getpid());
+    }
+
+    if (signum && atoi(signum) > 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = profile_signal;
+        action.sa_flags   = SA_RESTART;
+        sigaction(atoi(signum), &action, NULL);
+    }
+
+    void *frames[PROFILE_DEPTH];
+    Sampling = true;
+    backtrace(frames, PROFILE_DEPTH);
+    Sampling = false;
+
+    atexit(profile_exit);
+    pthread_atfork(profile_lock, profile_unlock, profile_unlock);
+}
+
+/**
+ * Find or add stack (must hold ProfileLock).
+ * @param   frames  Return addresses.
+ * @param   depth   Number of return addresses.
+ * @return  Stack id (otherwise -1 if out of memory).
+ **/
+static ssize_t  profile_stack(void **frames, size_t depth) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001b3ULL;
+    }
+
+    /* Probe successive keys until a matching or unused one is found */
+    uint64_t key = hash | 1;
+    for (uint64_t id; ptr_map_lookup(&StackIndex, (void *)key, &id); key += 2) {
+        ProfileStack *stack = &Stacks[id];
+        if (stack->depth == depth && !memcmp(stack->frames, frames, depth * sizeof(void *))) {
+            return id;
+        }
+    }
+
+    if (NStacks == AllocatedStacks) {
+        size_t allocated = AllocatedStacks ? 2 * AllocatedStacks : PROFILE_STACKS;
+        if (allocated > (1UL<<PROFILE_ID_BITS)) {   // Ids must fit in their bits
+            return -1;
+        }
+
+        ProfileStack *stacks = mmap(NULL, allocated * sizeof(ProfileStack), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (stacks == MAP_FAILED) {
+            return -1;
+        }
+        if (Stacks) {
+            memcpy(stacks, Stacks, NStacks * sizeof(ProfileStack));
+            munmap(Stacks, AllocatedStacks * sizeof(ProfileStack));
+        }
+        Stacks          = stacks;
+        AllocatedStacks = allocated;
+    }
+
+    if (!ptr_map_insert(&StackIndex, (void *)key, NStacks)) {
+        return -1;
+    }
+
+    ProfileStack *stack = &Stacks[NStacks];
+    stack->hash  = key;
+    stack->depth = depth;
+    memcpy(stack->frames, frames, depth * sizeof(void *));
+    return NStacks++;
+}
+
+/**
+ * Account for allocation and sample it once the thread's byte interval runs
+ * out.
+ * @param   ptr     Pointer returned to the caller.
+ * @param   size    Number of bytes requested.
+ **/
+void    profile_malloc(void *ptr, size_t size) {
+    if (Sampling) {
+        return;
+    }
+
+    if (__builtin_expect(DumpRequested, 0)) {
+        DumpRequested = 0;
+        Sampling = true;
+        profile_dump_next();
+        Sampling = false;
+    }
+
+    if (__builtin_expect(!Seed, 0)) {
+        Seed        = ((uintptr_t)&Seed ^ (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL) | 1;
+        UntilSample = profile_interval();
+    }
+
+    UntilSample -= size;
+    if (UntilSample > 0) {
+        return;
+    }
+
+    Sampling    = true;
+    UntilSample = profile_interval();
+
+    void *frames[PROFILE_DEPTH + PROFILE_SKIP];
+    int   depth = backtrace(frames, PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+
+    profile_lock();
+    ssize_t id = depth > 0 ? profile_stack(frames + PROFILE_SKIP, depth) : -1;
+    if (id >= 0 && ptr_map_insert(&Objects, ptr, ((uint64_t)size << PROFILE_ID_BITS) | id)) {
+        Stacks[id].allocs++;
+        Stacks[id].alloc_bytes += size;
+        __atomic_store_n(&Live, Live + 1, __ATOMIC_RELAXED);
+    }
+    profile_unlock();
+
+    Sampling = false;
+}
+
+/**
+ * Stop tracking object if it was sampled.
+ * @param   ptr     Pointer being freed.
+ * @return  Size and stack of the sample (0 if the object was not sampled),
+ *          for profile_restore.
+ **/
+uint64_t profile_free(void *ptr) {
+    if (Sampling) {
+        return 0;
+    }
+
+    if (__builtin_expect(DumpRequested, 0)) {
+        DumpRequested = 0;
+        Sampling = true;
+        profile_dump_next();
+        Sampling = false;
+    }
+
+    if (!__atomic_load_n(&Live, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    uint64_t value = 0;
+    profile_lock();
+    if (ptr_map_remove(&Objects, ptr, &value)) {
+        ProfileStack *stack = &Stacks[value & ((1UL<<PROFILE_ID_BITS) - 1)];
+        stack->frees++;
+        stack->free_bytes += value >> PROFILE_ID_BITS;
+        __atomic_store_n(&Live, Live - 1, __ATOMIC_RELAXED);
+    }
+    profile_unlock();
+    return value;
+}
+
+/**
+ * Track an object again after profile_free, because it was not released
+ * after all (a failed realloc).
+ * @param   ptr     Pointer that is still allocated.
+ * @param   sample  Value returned by profile_free.
+ **/
+void    profile_restore(void *ptr, uint64_t sample) {
+    profile_lock();
+    if (ptr_map_insert(&Objects, ptr, sample)) {
+        ProfileStack *stack = &Stacks[sample & ((1UL<<PROFILE_ID_BITS) - 1)];
+        stack->frees--;
+        stack->free_bytes -= sample >> PROFILE_ID_BITS;
+        __atomic_store_n(&Live, Live + 1, __ATOMIC_RELAXED);
+    }
+    profile_unlock();
+}
+
+/**
+ * Write heap profile in the legacy gperftools heap format:
+ *
+ *  heap profile: LIVE: LIVE_BYTES [ALLOCS: ALLOC_BYTES] @ heap_v2/RATE
+ *  LIVE: LIVE_BYTES [ALLOCS: ALLOC_BYTES] @ 0xADDR 0xADDR ...
+ *  ...
+ *
+ *  MAPPED_LIBRARIES:
+ *  (contents of /proc/self/maps)
+ *
+ * Counts are raw samples; pprof scales them by the heap_v2 rate.
+ * @param   path    Path of file to write.
+ * @return  Whether or not the profile was written.
+ **/
+bool    profile_dump(const char *path) {
+    char buffer[BUFSIZ];
+    int  fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    profile_lock();
+    uint64_t live = 0, live_bytes = 0, allocs = 0, alloc_bytes = 0;
+    for (size_t i = 0; i < NStacks; i++) {
+        live        += Stacks[i].allocs - Stacks[i].frees;
+        live_bytes  += Stacks[i].alloc_bytes - Stacks[i].free_bytes;
+        allocs      += Stacks[i].allocs;
+        alloc_bytes += Stacks[i].alloc_bytes;
+    }
+
+    fdprintf(fd, buffer, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%lu\n",
+        live, live_bytes, allocs, alloc_bytes, ProfileRate);
+
+    for (size_t i = 0; i < NStacks; i++) {
+        ProfileStack *stack  = &Stacks[i];
+        size_t        length = snprintf(buffer, sizeof(buffer), "%lu: %lu [%lu: %lu] @",
+            stack->allocs - stack->frees, stack->alloc_bytes - stack->free_bytes,
+            stack->allocs, stack->alloc_bytes);
+
+        for (size_t f = 0; f < stack->depth && length < sizeof(buffer) - 24; f++) {
+            length += snprintf(buffer + length, sizeof(buffer) - length, " %p", stack->frames[f]);
+        }
+        buffer[length++] = '\n';
+        write(fd, buffer, length);
+    }
+    profile_unlock();
+
+    fdprintf(fd, buffer, "\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        ssize_t nread;
+        while ((nread = read(maps, buffer, sizeof(buffer))) > 0) {
+            write(fd, buffer, nread);
+        }
+        close(maps);
+    }
+
+    close(fd);
+    return true;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,177 @@
+/* ptrmap.c: Pointer Hash Map
+ *
+ * Linear probing with backward shift deletion, so there are no tombstones and
+ * lookups never degrade after many insert/remove cycles.  The table doubles
+ * once it is half full.
+ **/
+
+#include "malloc/ptrmap.h"
+
+#include <sys/mman.h>
+
+/* Constants */
+
+#define PTR_MAP_INITIAL (1<<10)
+
+/* Functions */
+
+/**
+ * Hash pointer to a slot position.
+ * @param   key     Pointer to hash.
+ * @param   mask    Table capacity minus one.
+ * @return  Home slot of pointer.
+ **/
+static size_t   ptr_map_slot(uintptr_t key, size_t mask) {
+    return (size_t)(((uint64_t)key >> 3) * 0x9E3779B97F4A7C15ULL >> 17) & mask;
+}
+
+/**
+ * Map a table of the specified number of slots and rehash existing entries
+ * into it.
+ * @param   map         Pointer to map.
+ * @param   capacity    Number of slots in new table.
+ * @return  Whether or not the table was resized.
+ **/
+static bool     ptr_map_resize(PtrMap *map, size_t capacity) {
+    PtrEntry *entries = mmap(NULL, capacity * sizeof(PtrEntry), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (entries == MAP_FAILED) {
+        return false;
+    }
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (!map->entries[i].key) {
+            continue;
+        }
+
+        size_t slot = ptr_map_slot(map->entries[i].key, capacity - 1);
+        while (entries[slot].key) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        entries[slot] = map->entries[i];
+    }
+
+    if (map->entries) {
+        munmap(map->entries, map->capacity * sizeof(PtrEntry));
+    }
+
+    map->entries  = entries;
+    map->capacity = capacity;
+    return true;
+}
+
+/**
+ * Insert pointer into map (or update its value if already present).
+ * @param   map     Pointer to map.
+ * @param   key     Pointer to insert (must not be NULL).
+ * @param   value   Value to associate with pointer.
+ * @return  Whether or not the pointer was stored.
+ **/
+bool    ptr_map_insert(PtrMap *map, const void *key, uint64_t value) {
+    if (2 * (map->length + 1) > map->capacity) {
+        if (!ptr_map_resize(map, map->capacity ? 2 * map->capacity : PTR_MAP_INITIAL)) {
+            return false;
+        }
+    }
+
+    size_t mask = map->capacity - 1;
+    size_t slot = ptr_map_slot((uintptr_t)key, mask);
+    while (map->entries[slot].key && map->entries[slot].key != (uintptr_t)key) {
+        slot = (slot + 1) & mask;
+    }
+
+    if (!map->entries[slot].key) {
+        map->entries[slot].key = (uintptr_t)key;
+        map->length++;
+    }
+    map->entries[slot].value = value;
+    return true;
+}
+
+/**
+ * Find slot holding pointer.
+ * @param   map     Pointer to map.
+ * @param   key     Pointer to find.
+ * @return  Slot position (otherwise map capacity).
+ **/
+static size_t   ptr_map_find(const PtrMap *map, uintptr_t key) {
+    if (!map->length) {
+        return map->capacity;
+    }
+
+    size_t mask = map->capacity - 1;
+    for (size_t slot = ptr_map_slot(key, mask); map->entries[slot].key; slot = (slot + 1) & mask) {
+        if (map->entries[slot].key == key) {
+            return slot;
+        }
+    }
+    return map->capacity;
+}
+
+/**
+ * Lookup value associated with pointer.
+ * @param   map     Pointer to map.
+ * @param   key     Pointer to lookup.
+ * @param   value   Where to store value (may be NULL).
+ * @return  Whether or not the pointer is in the map.
+ **/
+bool    ptr_map_lookup(const PtrMap *map, const void *key, uint64_t *value) {
+    size_t slot = ptr_map_find(map, (uintptr_t)key);
+    if (slot == map->capacity) {
+        return false;
+    }
+
+    if (value) {
+        *value = map->entries[slot].value;
+    }
+    return true;
+}
+
+/**
+ * Remove pointer from map, shifting back any entries that probed past it.
+ * @param   map     Pointer to map.
+ * @param   key     Pointer to remove.
+ * @param   value   Where to store removed value (may be NULL).
+ * @return  Whether or not the pointer was in the map.
+ **/
+bool    ptr_map_remove(PtrMap *map, const void *key, uint64_t *value) {
+    size_t slot = ptr_map_find(map, (uintptr_t)key);
+    if (slot == map->capacity) {
+        return false;
+    }
+
+    if (value) {
+        *value = map->entries[slot].value;
+    }
+
+    size_t mask = map->capacity - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; map->entries[next].key; next = (next + 1) & mask) {
+        size_t home = ptr_map_slot(map->entries[next].key, mask);
+        /* Move entry into hole unless its home lies cyclically in (hole, next] */
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            map->entries[hole] = map->entries[next];
+            hole = next;
+        }
+    }
+
+    map->entries[hole].key   = 0;
+    map->entries[hole].value = 0;
+    map->length--;
+    return true;
+}
+
+/**
+ * Remove all entries and release the table.
+ * @param   map     Pointer to map.
+ **/
+void    ptr_map_clear(PtrMap *map) {
+    if (map->entries) {
+        munmap(map->entries, map->capacity * sizeof(PtrEntry));
+    }
+
+    map->entries  = NULL;
+    map->length   = 0;
+    map->capacity = 0;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,178 @@
+/* stats.c: Live Statistics Page
+ *
+ * When MALLOC_STATS is set in the environment, the allocator publishes its
+ * counters, free list totals and per size class statistics to a page mapped
+ * from /dev/shm/malloc-heap.<pid>.  Updates are guarded by a seqlock, so
+ * readers (such as bin/heapstat) can attach at any time without pausing the
+ * allocating process.
+ *
+ * MALLOC_STATS_INTERVAL controls how many allocator operations happen between
+ * publishes (the page is always published at exit).
+ *
+ * A forked child publishes to a page of its own, which its inherited atexit
+ * handler removes.  A child that leaves with _exit (or execs a program that
+ * does not use this allocator) skips that handler and leaves its page behind
+ * in /dev/shm; bin/heapstat reports such pages as stale (their pid no longer
+ * exists), and they can be removed by hand.
+ **/
+
+#include "malloc/freelist.h"
+#include "malloc/stats.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Global Variables */
+
+StatsPage *     Stats = NULL;
+
+static SizeClassStats   Classes[STATS_CLASSES];
+static size_t           Interval = STATS_INTERVAL;
+static size_t           Pending  = 0;
+static char             Path[64] = {0};
+
+/* Functions */
+
+/**
+ * Publish final statistics and remove the stats page when the program
+ * terminates.
+ **/
+static void stats_cleanup() {
+    if (Stats) {
+        stats_publish(true);
+        unlink(Path);
+    }
+}
+
+/**
+ * Give a forked child its own stats page rather than writing to its parent's.
+ **/
+static void stats_atfork_child() {
+    Stats = NULL;
+    stats_init();
+}
+
+/**
+ * Map and initialize the stats page if MALLOC_STATS is enabled:
+ *
+ *  1. Create /dev/shm/malloc-heap.<pid> and size it to hold a StatsPage.
+ *  2. Map it shared and fill in the identification header.
+ *  3. Register cleanup at exit and re-initialization in forked children.
+ **/
+void stats_init() {
+    static bool registered = false;
+    const char *enabled    = getenv("MALLOC_STATS");
+    const char *interval   = getenv("MALLOC_STATS_INTERVAL");
+
+    if (!enabled || !*enabled || *enabled == '0') {
+        return;
+    }
+
+    if (interval && strtoul(interval, NULL, 10) > 0) {
+        Interval = strtoul(interval, NULL, 10);
+    }
+
+    snprintf(Path, sizeof(Path), STATS_PATH, getpid());
+    int fd = open(Path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    if (ftruncate(fd, sizeof(StatsPage)) < 0) {
+        close(fd);
+        unlink(Path);
+        return;
+    }
+
+    StatsPage *page = mmap(NULL, sizeof(StatsPage), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        unlink(Path);
+        return;
+    }
+
+    page->version = STATS_VERSION;
+    page->pid     = getpid();
+    __atomic_store_n(&page->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    Stats = page;
+
+    if (!registered) {
+        registered = true;
+        atexit(stats_cleanup);
+        pthread_atfork(NULL, NULL, stats_atfork_child);
+    }
+
+    stats_publish(true);
+}
+
+/**
+ * Fill in the statistics portion of a page with the current allocator state.
+ * @param   page    Pointer to page to fill in.
+ **/
+void stats_snapshot(StatsPage *page) {
+    struct timespec now;
+    FreeStats       free;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    free_list_stats(&free);
+
+    page->timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    counters_snapshot((size_t *)page->counters);
+
+    page->free_blocks  = free.blocks;
+    page->free_bytes   = free.bytes;
+    page->free_slack   = free.slack;
+    page->largest_free = free.largest;
+    memcpy(page->classes, Classes, sizeof(Classes));
+
+    for (int op = 0; Latency && op < NOPERATIONS; op++) {
+        latency_percentiles(&Latency->operations[op], &page->latency[op]);
+    }
+}
+
+/**
+ * Publish current statistics to the stats page.
+ *
+ * Unless forced, this only happens once every Interval calls.
+ * @param   force   Whether or not to publish regardless of the interval.
+ **/
+void stats_publish(bool force) {
+    if (!Stats || (!force && ++Pending < Interval)) {
+        return;
+    }
+    Pending = 0;
+
+    uint64_t sequence = Stats->sequence;
+    __atomic_store_n(&Stats->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    stats_snapshot(Stats);
+
+    __atomic_store_n(&Stats->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record a successful allocation in its size class.
+ * @param   size    Number of bytes requested.
+ **/
+void stats_malloc(size_t size) {
+    SizeClassStats *class = &Classes[STATS_CLASS(size)];
+    class->mallocs++;
+    class->live += size;
+}
+
+/**
+ * Record a free in the size class of the original allocation.
+ * @param   size    Number of bytes originally requested.
+ **/
+void stats_free(size_t size) {
+    SizeClassStats *class = &Classes[STATS_CLASS(size)];
+    class->frees++;
+    class->live -= size;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,172 @@
+/* trace.c: Allocation Trace Recording
+ *
+ * When MALLOC_TRACE is set to a path, every call to malloc, free, calloc and
+ * realloc is appended to a compact binary trace (see trace.h) that bin/replay
+ * can run against any build.  Records are buffered and written in batches; the
+ * buffer is flushed at exit.
+ *
+ * Pointers are mapped to object ids with a pointer map.  Objects are forgotten
+ * before they are released, so another thread reusing the address can never
+ * be confused with the old object.
+ **/
+
+#include "malloc/ptrmap.h"
+#include "malloc/trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Global Variables */
+
+bool                    TraceEnabled = false;
+
+static pthread_mutex_t  TraceLock    = PTHREAD_MUTEX_INITIALIZER;
+static int              TraceFD      = -1;
+static PtrMap           TraceObjects = {0};	/* Pointer -> object id */
+static uint32_t         NextObject   = 1;
+static uint16_t         NextThread   = 0;
+static uint64_t         TraceStart   = 0;
+static TraceRecord      Buffer[TRACE_BUFFER];
+static size_t           Buffered     = 0;
+
+static __thread uint32_t Thread __attribute__((tls_model("initial-exec"))) = 0;
+
+/* Functions */
+
+static uint64_t trace_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Write buffered records to the trace file (must hold TraceLock).
+ **/
+static void     trace_flush() {
+    if (Buffered && write(TraceFD, Buffer, Buffered * sizeof(TraceRecord)) < 0) {
+        TraceEnabled = false;
+    }
+    Buffered = 0;
+}
+
+/**
+ * Flush and close the trace when the program terminates.
+ **/
+static void     trace_exit() {
+    pthread_mutex_lock(&TraceLock);
+    trace_flush();
+    TraceEnabled = false;
+    close(TraceFD);
+    pthread_mutex_unlock(&TraceLock);
+}
+
+static void     trace_lock()   { pthread_mutex_lock(&TraceLock); }
+static void     trace_unlock() { pthread_mutex_unlock(&TraceLock); }
+
+/**
+ * Stop tracing in forked children, which would otherwise interleave their
+ * records with their parent's.
+ **/
+static void     trace_atfork_child() {
+    Buffered     = 0;
+    TraceEnabled = false;
+    pthread_mutex_unlock(&TraceLock);
+}
+
+/**
+ * Open the trace file named by MALLOC_TRACE and write its header.
+ **/
+void        trace_init() {
+    const char *path = getenv("MALLOC_TRACE");
+
+    if (!path || !*path) {
+        return;
+    }
+
+    TraceFD = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (TraceFD < 0) {
+        return;
+    }
+
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, getpid()};
+    if (write(TraceFD, &header, sizeof(header)) != sizeof(header)) {
+        close(TraceFD);
+        return;
+    }
+
+    TraceStart   = trace_now();
+    TraceEnabled = true;
+    atexit(trace_exit);
+    pthread_atfork(trace_lock, trace_unlock, trace_atfork_child);
+}
+
+/**
+ * Forget object about to be released.
+ * @param   ptr     Pointer passed to free or realloc.
+ * @return  Object id of pointer (0 if it was never traced).
+ **/
+uint32_t    trace_forget(void *ptr) {
+    uint64_t id = 0;
+
+    trace_lock();
+    ptr_map_remove(&TraceObjects, ptr, &id);
+    trace_unlock();
+    return id;
+}
+
+/**
+ * Remember object again after trace_forget, because it was not released
+ * after all (a failed realloc).
+ * @param   ptr     Pointer that is still allocated.
+ * @param   id      Object id returned by trace_forget.
+ **/
+void        trace_restore(void *ptr, uint32_t id) {
+    trace_lock();
+    ptr_map_insert(&TraceObjects, ptr, id);
+    trace_unlock();
+}
+
+/**
+ * Append record for completed call.
+ * @param   operation   Operation that completed (OP_MALLOC, ...).
+ * @param   ptr         Pointer returned by the call (NULL for free).
+ * @param   old         Object id returned by trace_forget (free, realloc).
+ * @param   size        Number of bytes requested.
+ **/
+void        trace_record(int operation, void *ptr, uint32_t old, size_t size) {
+    uint64_t timestamp = trace_now();
+
+    trace_lock();
+    if (!TraceEnabled) {
+        trace_unlock();
+        return;
+    }
+
+    if (!Thread) {
+        Thread = ++NextThread;
+    }
+
+    uint32_t id = 0;
+    if (ptr && ptr_map_insert(&TraceObjects, ptr, NextObject)) {
+        id = NextObject++;
+    }
+
+    TraceRecord *record = &Buffer[Buffered++];
+    memset(record, 0, sizeof(TraceRecord));
+    record->timestamp = timestamp - TraceStart;
+    record->size      = size;
+    record->id        = id;
+    record->old       = old;
+    record->thread    = Thread - 1;
+    record->operation = operation;
+
+    if (Buffered == TRACE_BUFFER) {
+        trace_flush();
+    }
+    trace_unlock();
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
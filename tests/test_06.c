@@ -0,0 +1,23 @@
+/* test_06.c: a failed realloc leaves the old object live */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    char * p0 = malloc(64);
+    memset(p0, 'x', 64);
+
+    // Too large for any heap: fails and must not release (or forget) p0
+    char * p1 = realloc(p0, SIZE_MAX / 2);
+    assert(p1 == NULL);
+    assert(p0[63] == 'x');
+
+    free(p0);
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -2,9 +2,15 @@
 
 #include "malloc/block.h"
 #include "malloc/counters.h"
+#include "malloc/freelist.h"
+#include "malloc/heap.h"
+#include "malloc/heapmap.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <string.h>
+#include <unistd.h>
 
 /* Functions */
 
@@ -16,15 +22,15 @@ int test_00_block_allocate() {
     assert(b0->size == s0);
     assert(b0->prev == b0);
     assert(b0->next == b0);
-    assert(Counters[HEAP_SIZE] == ALIGN(sizeof(Block) + s0));
-    assert(Counters[BLOCKS] == 1);
-    assert(Counters[GROWS] == 1);
+    assert(counter_read(HEAP_SIZE) == ALIGN(sizeof(Block) + s0));
+    assert(counter_read(BLOCKS) == 1);
+    assert(counter_read(GROWS) == 1);
 
     Block *b1 = block_allocate(LONG_MAX);
     assert(b1 == NULL);
-    assert(Counters[HEAP_SIZE] == ALIGN(sizeof(Block) + s0));
-    assert(Counters[BLOCKS] == 1);
-    assert(Counters[GROWS] == 1);
+    assert(counter_read(HEAP_SIZE) == ALIGN(sizeof(Block) + s0));
+    assert(counter_read(BLOCKS) == 1);
+    assert(counter_read(GROWS) == 1);
     return EXIT_SUCCESS;
 }
 
@@ -33,19 +39,19 @@ int test_01_block_release() {
     Block *b0 = block_allocate(s0);
     assert(b0);
     assert(block_release(b0) == false);
-    assert(Counters[BLOCKS] == 1);
-    assert(Counters[GROWS] == 1);
-    assert(Counters[SHRINKS] == 0);
-    assert(Counters[HEAP_SIZE] == ALIGN(sizeof(Block) + s0));
+    assert(counter_read(BLOCKS) == 1);
+    assert(counter_read(GROWS) == 1);
+    assert(counter_read(SHRINKS) == 0);
+    assert(counter_read(HEAP_SIZE) == ALIGN(sizeof(Block) + s0));
 
     size_t s1 = TRIM_THRESHOLD;
     Block *b1 = block_allocate(s1);
     assert(b1);
     assert(block_release(b1) == true);
-    assert(Counters[BLOCKS] == 1);
-    assert(Counters[GROWS] == 2);
-    assert(Counters[SHRINKS] == 1);
-    assert(Counters[HEAP_SIZE] == ALIGN(sizeof(Block) + s0));
+    assert(counter_read(BLOCKS) == 1);
+    assert(counter_read(GROWS) == 2);
+    assert(counter_read(SHRINKS) == 1);
+    assert(counter_read(HEAP_SIZE) == ALIGN(sizeof(Block) + s0));
 
     return EXIT_SUCCESS;
 }
@@ -81,12 +87,12 @@ int test_03_block_merge() {
     assert(b1);
 
     assert(block_merge(b1, b0) == false);
-    assert(Counters[MERGES] == 0);
-    assert(Counters[BLOCKS] == 2);
+    assert(counter_read(MERGES) == 0);
+    assert(counter_read(BLOCKS) == 2);
 
     assert(block_merge(b0, b1) == true);
-    assert(Counters[MERGES] == 1);
-    assert(Counters[BLOCKS] == 1);
+    assert(counter_read(MERGES) == 1);
+    assert(counter_read(BLOCKS) == 1);
     return EXIT_SUCCESS;
 }
 
@@ -96,18 +102,105 @@ int test_04_block_split() {
     assert(b0);
 
     assert(block_split(b0, s0) == b0);
-    assert(Counters[SPLITS] == 0);
-    assert(Counters[BLOCKS] == 1);
+    assert(counter_read(SPLITS) == 0);
+    assert(counter_read(BLOCKS) == 1);
 
     size_t s1 = 50;
     assert(block_split(b0, s1) != NULL);
-    assert(Counters[SPLITS] == 1);
-    assert(Counters[BLOCKS] == 2);
+    assert(counter_read(SPLITS) == 1);
+    assert(counter_read(BLOCKS) == 2);
     assert(b0->next->capacity == (ALIGN(s0) - ALIGN(s1) - sizeof(Block)));
     assert(b0->next->prev == b0);
     return EXIT_SUCCESS;
 }
 
+int test_05_block_map() {
+    size_t s0 = MMAP_THRESHOLD;
+    Block *b0 = block_map(s0);
+
+    assert(b0);
+    assert(b0->capacity & BLOCK_MAPPED);
+    assert((b0->capacity & ~BLOCK_MAPPED) >= ALIGN(s0));
+    assert(b0->size == s0);
+    assert(b0->prev == b0);
+    assert(b0->next == b0);
+    for (size_t i = 0; i < s0; i++) {
+        assert(b0->data[i] == 0);
+    }
+    assert(counter_read(HEAP_SIZE) == 0);
+    assert(counter_read(BLOCKS) == 0);
+
+    /* Fresh heap memory is known to be zero past the new block header */
+    Block *b1 = block_allocate(100);
+    assert(b1);
+    assert((char *)heap_fresh() <= b1->data);
+    assert(block_unmap(b1) == false);
+
+    assert(block_unmap(b0) == true);
+    return EXIT_SUCCESS;
+}
+
+/* Heap walk visitor recording up to 8 blocks */
+typedef struct {
+    size_t  count;
+    Block * blocks[8];
+    bool    allocated[8];
+} Walk;
+
+static bool walk_visit(Block *block, bool allocated, void *arg) {
+    Walk *walk = arg;
+    if (walk->count == 8) {
+        return false;
+    }
+    walk->blocks[walk->count]    = block;
+    walk->allocated[walk->count] = allocated;
+    walk->count++;
+    return true;
+}
+
+int test_06_heap_walk() {
+    Block *b0 = block_allocate(100);
+    Block *b1 = block_allocate(200);
+    Block *b2 = block_allocate(300);
+    assert(b0 && b1 && b2);
+    free_list_insert(b1);
+
+    /* Every block in address order, free ones included */
+    Walk walk = {0};
+    assert(heap_walk(walk_visit, &walk) == true);
+    assert(walk.count == 3);
+    assert(walk.blocks[0] == b0 && walk.allocated[0] == true);
+    assert(walk.blocks[1] == b1 && walk.allocated[1] == false);
+    assert(walk.blocks[2] == b2 && walk.allocated[2] == true);
+
+    /* A visitor can stop the walk */
+    for (size_t i = 0; i < 8; i++) {
+        assert(block_allocate(16));
+    }
+    memset(&walk, 0, sizeof(walk));
+    assert(heap_walk(walk_visit, &walk) == false);
+    assert(walk.count == 8);
+
+    /* A heap map holds one record per block */
+    char path[] = "/tmp/unit_block.XXXXXX";
+    int  fd     = mkstemp(path);
+    assert(fd >= 0);
+    assert(heapmap_dump(path) == true);
+
+    HeapMapHeader header;
+    HeapMapRecord records[16];
+    assert(read(fd, &header, sizeof(header)) == sizeof(header));
+    assert(header.magic == HEAPMAP_MAGIC && header.complete);
+    assert(read(fd, records, sizeof(records)) == 11 * sizeof(HeapMapRecord));
+    assert(records[1].address == (uintptr_t)b1);
+    assert(records[1].capacity == b1->capacity);
+    assert(records[1].allocated == false);
+    assert(records[2].size == 300 && records[2].allocated == true);
+    close(fd);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
 /* Main execution */
 
 int main(int argc, char *argv[]) {
@@ -119,6 +212,8 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    2. Test block_detach\n");
         fprintf(stderr, "    3. Test block_merge\n");
         fprintf(stderr, "    4. Test block_split\n");
+        fprintf(stderr, "    5. Test block_map\n");
+        fprintf(stderr, "    6. Test heap_walk\n");
         return EXIT_FAILURE;
     }
 
@@ -131,6 +226,8 @@ int main(int argc, char *argv[]) {
         case 2:  status = test_02_block_detach(); break;
         case 3:  status = test_03_block_merge(); break;
         case 4:  status = test_04_block_split(); break;
+        case 5:  status = test_05_block_map(); break;
+        case 6:  status = test_06_heap_walk(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 
@@ -0,0 +1,193 @@
+/* unit_budget.c: Unit tests for the heap memory budget */
+
+#include "malloc/block.h"
+#include "malloc/budget.h"
+#include "malloc/counters.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define KB      (1UL<<10)
+#define THREADS 8
+
+/* Global Variables */
+
+size_t  Calls = 0;
+size_t  Used  = 0;
+size_t  Limit = 0;
+
+/* Functions */
+
+void pressure(size_t used, size_t limit, void *arg) {
+    Calls++;
+    Used  = used;
+    Limit = limit;
+    assert(arg == &Calls);
+}
+
+int test_00_budget_hard() {
+    assert(budget_set(0, 64 * KB));
+
+    // Growing past the hard limit fails cleanly
+    size_t n = 0;
+    while (block_allocate(KB)) {
+        n++;
+    }
+    assert(errno == ENOMEM);
+    assert(BudgetPressure);
+    assert(n > 0 && counter_read(HEAP_SIZE) <= 64 * KB);
+    assert(counter_read(HEAP_SIZE) + sizeof(Block) + KB > 64 * KB);
+    assert(budget_used() == counter_read(HEAP_SIZE));
+
+    // Lifting the limit lets the heap grow again
+    assert(budget_set(0, 0));
+    assert(block_allocate(KB));
+    return EXIT_SUCCESS;
+}
+
+int test_01_budget_soft() {
+    assert(budget_register(pressure, &Calls));
+    assert(budget_set(32 * KB, 0));
+
+    // Crossing the soft limit flags pressure, without failing
+    while (counter_read(HEAP_SIZE) <= 32 * KB) {
+        assert(!BudgetPressure);
+        assert(block_allocate(KB));
+    }
+    assert(BudgetPressure);
+
+    // One thread relieves it at a time, and callbacks see usage and limit
+    assert(budget_relief_begin());
+    assert(!BudgetPressure);
+    assert(!budget_relief_begin());
+    budget_notify();
+    budget_relief_end();
+    assert(Calls == 1);
+    assert(Used == counter_read(HEAP_SIZE) && Limit == 32 * KB);
+
+    // Pressure is flagged again only after growing another step
+    assert(block_allocate(KB));
+    assert(!BudgetPressure);
+    while (counter_read(HEAP_SIZE) <= Used + 32 * KB / BUDGET_STEP) {
+        assert(block_allocate(KB));
+    }
+    assert(BudgetPressure);
+    return EXIT_SUCCESS;
+}
+
+int test_02_budget_mapped() {
+    assert(budget_set(0, 256 * KB));
+
+    // Mapped blocks are charged to the budget and credited when unmapped
+    assert(block_map(512 * KB) == NULL);
+    Block *block = block_map(128 * KB);
+    assert(block);
+    assert(budget_used() >= counter_read(HEAP_SIZE) + 128 * KB);
+    assert(block_map(128 * KB) == NULL);
+
+    assert(block_unmap(block));
+    assert(budget_used() == counter_read(HEAP_SIZE));
+    return EXIT_SUCCESS;
+}
+
+int test_03_budget_invalid() {
+    assert(!budget_set(2 * KB, KB));
+    assert(budget_set(KB, 2 * KB));
+    assert(budget_set(KB, 0));
+
+    for (size_t i = 0; i < BUDGET_CALLBACKS; i++) {
+        assert(budget_register(pressure, &Calls));
+    }
+    assert(!budget_register(pressure, &Calls));
+    return EXIT_SUCCESS;
+}
+
+int test_04_budget_unset() {
+    // Blocks mapped before a limit is set are charged all the same
+    Block *block = block_map(128 * KB);
+    assert(block);
+    assert(budget_used() >= counter_read(HEAP_SIZE) + 128 * KB);
+    assert(budget_set(0, 256 * KB));
+    assert(block_map(128 * KB) == NULL);
+    assert(block_unmap(block));
+    assert(budget_used() == counter_read(HEAP_SIZE));
+
+    // Blocks unmapped after the limit is lifted are credited all the same
+    block = block_map(128 * KB);
+    assert(block);
+    assert(budget_set(0, 0));
+    assert(block_unmap(block));
+    assert(budget_used() == counter_read(HEAP_SIZE));
+
+    assert(budget_set(0, 256 * KB));
+    assert(block_map(128 * KB));
+    return EXIT_SUCCESS;
+}
+
+void *mapper(void *arg) {
+    size_t n = 0;
+    while (block_map(64 * KB)) {
+        n++;
+    }
+    return (void *)n;
+}
+
+int test_05_budget_race() {
+    pthread_t threads[THREADS];
+    size_t    page   = getpagesize();
+    size_t    each   = (sizeof(Block) + 64 * KB + page - 1) & ~(page - 1);
+    size_t    mapped = 0;
+    assert(budget_set(0, counter_read(HEAP_SIZE) + 1024 * KB));
+
+    // Charges racing without the heap lock never overshoot the hard limit
+    for (size_t i = 0; i < THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, mapper, NULL) == 0);
+    }
+    for (size_t i = 0; i < THREADS; i++) {
+        void *n;
+        assert(pthread_join(threads[i], &n) == 0);
+        mapped += (size_t)n;
+    }
+
+    assert(mapped == 1024 * KB / each);
+    assert(budget_used() == counter_read(HEAP_SIZE) + mapped * each);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test budget_hard\n");
+        fprintf(stderr, "    1. Test budget_soft\n");
+        fprintf(stderr, "    2. Test budget_mapped\n");
+        fprintf(stderr, "    3. Test budget_invalid\n");
+        fprintf(stderr, "    4. Test budget_unset\n");
+        fprintf(stderr, "    5. Test budget_race\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_budget_hard(); break;
+        case 1:  status = test_01_budget_soft(); break;
+        case 2:  status = test_02_budget_mapped(); break;
+        case 3:  status = test_03_budget_invalid(); break;
+        case 4:  status = test_04_budget_unset(); break;
+        case 5:  status = test_05_budget_race(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,200 @@
+/* unit_defer.c: Unit tests for deferred frees */
+
+#include "malloc/defer.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define THREADS     4
+#define OBJECTS     10000
+
+/* Structures */
+
+typedef struct {
+    void *      link;	    /* Used by the deferred chain */
+    size_t      reclaimed;  /* Number of times reclaimed */
+} Object;
+
+/* Global Variables */
+
+size_t      Reclaimed    = 0;
+pthread_t   ReclaimedBy;
+
+/* Functions */
+
+/**
+ * Count reclaimed objects (stands in for heap_free_chain).
+ **/
+void reclaim(void *chain) {
+    while (chain) {
+        Object *object = chain;
+        chain = object->link;
+        object->reclaimed++;
+        ReclaimedBy = pthread_self();
+        __atomic_add_fetch(&Reclaimed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Wait (up to a second) for the reclaimer to reach the expected count.
+ **/
+size_t wait_for(size_t expected) {
+    for (size_t i = 0; i < 1000 && __atomic_load_n(&Reclaimed, __ATOMIC_RELAXED) < expected; i++) {
+        usleep(1000);
+    }
+    return __atomic_load_n(&Reclaimed, __ATOMIC_RELAXED);
+}
+
+/**
+ * Exit with whether everything deferred was reclaimed by the time the
+ * handlers registered before defer_init run (as dump_counters is).
+ **/
+void check_reclaimed() {
+    _exit(Reclaimed == DEFER_BATCH - 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+void *push_objects(void *arg) {
+    Object *objects = arg;
+    for (size_t i = 0; i < OBJECTS; i++) {
+        defer_push(&objects[i]);
+    }
+    return NULL;
+}
+
+void *push_few(void *arg) {
+    Object *objects = arg;
+    for (size_t i = 0; i < 10; i++) {
+        defer_push(&objects[i]);
+    }
+    return NULL;
+}
+
+int test_00_defer_drain() {
+    static Object objects[DEFER_BATCH - 1];
+    defer_init(reclaim);
+
+    /* A partial chain stays with its thread */
+    for (size_t i = 0; i < DEFER_BATCH - 1; i++) {
+        defer_push(&objects[i]);
+    }
+    usleep(10000);
+    assert(Reclaimed == 0);
+
+    defer_drain();
+    assert(Reclaimed == DEFER_BATCH - 1);
+    for (size_t i = 0; i < DEFER_BATCH - 1; i++) {
+        assert(objects[i].reclaimed == 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_01_defer_reclaimer() {
+    static Object objects[DEFER_BATCH];
+    defer_init(reclaim);
+
+    /* A full chain is handed to the reclaimer thread */
+    for (size_t i = 0; i < DEFER_BATCH; i++) {
+        defer_push(&objects[i]);
+    }
+    assert(wait_for(DEFER_BATCH) == DEFER_BATCH);
+    assert(!pthread_equal(ReclaimedBy, pthread_self()));
+    for (size_t i = 0; i < DEFER_BATCH; i++) {
+        assert(objects[i].reclaimed == 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_02_defer_exit() {
+    static Object objects[10];
+    defer_init(reclaim);
+
+    /* An exiting thread hands off its partial chain */
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, push_few, objects) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(wait_for(10) == 10);
+    for (size_t i = 0; i < 10; i++) {
+        assert(objects[i].reclaimed == 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_03_defer_threads() {
+    static Object objects[THREADS][OBJECTS];
+    pthread_t     threads[THREADS];
+    defer_init(reclaim);
+
+    /* Every object from every thread is reclaimed exactly once */
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_create(&threads[t], NULL, push_objects, objects[t]) == 0);
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+
+    defer_drain();
+    assert(Reclaimed == THREADS * OBJECTS);
+    for (size_t t = 0; t < THREADS; t++) {
+        for (size_t i = 0; i < OBJECTS; i++) {
+            assert(objects[t][i].reclaimed == 1);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_04_defer_atexit() {
+    static Object objects[DEFER_BATCH - 1];
+
+    /* A chain still deferred at exit is drained before earlier handlers */
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        atexit(check_reclaimed);
+        defer_init(reclaim);
+        for (size_t i = 0; i < DEFER_BATCH - 1; i++) {
+            defer_push(&objects[i]);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test defer_drain\n");
+        fprintf(stderr, "    1. Test defer_reclaimer\n");
+        fprintf(stderr, "    2. Test defer_exit\n");
+        fprintf(stderr, "    3. Test defer_threads\n");
+        fprintf(stderr, "    4. Test defer_atexit\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_defer_drain(); break;
+        case 1:  status = test_01_defer_reclaimer(); break;
+        case 2:  status = test_02_defer_exit(); break;
+        case 3:  status = test_03_defer_threads(); break;
+        case 4:  status = test_04_defer_atexit(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,172 @@
+/* unit_fast.c: Unit tests for the inline allocation fast path */
+
+#include "malloc/block.h"
+#include "malloc/counters.h"
+#include "malloc/fast.h"
+#include "malloc/lines.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+/* Global Variables */
+
+size_t  Reclaimed = 0;
+
+/* Functions */
+
+/**
+ * Count reclaimed blocks (stands in for heap_free_chain).
+ **/
+void reclaim(void *chain) {
+    while (chain) {
+        chain = *(void **)chain;
+        Reclaimed++;
+    }
+}
+
+/**
+ * Give the calling thread's class for size room (by missing in malloc_fast).
+ **/
+void make_room(size_t size) {
+    void *data = malloc_fast(size);
+    assert(data);
+    free(data);
+}
+
+void *cache_and_exit(void *arg) {
+    Block **blocks = arg;
+    make_room(ALIGNMENT);
+    for (size_t i = 0; i < 4; i++) {
+        free_fast(blocks[i]->data);
+    }
+    return NULL;
+}
+
+int test_00_fast_reuse() {
+    fast_init(reclaim);
+    assert(FastEnabled);
+
+    Block *block = block_allocate(2 * ALIGNMENT);
+    assert(block);
+    make_room(2 * ALIGNMENT);
+
+    // A freed block is cached and handed back out for the same class
+    size_t frees = counter_read(FREES);
+    free_fast(block->data);
+    assert(counter_read(FREES) == frees + 1);
+    assert(MallocCache.head[1] == block->data);
+    assert(MallocCache.room[1] == FAST_DEPTH - 1);
+
+    size_t mallocs = counter_read(MALLOCS);
+    assert(malloc_fast(2 * ALIGNMENT - 3) == block->data);
+    assert(block->size == 2 * ALIGNMENT - 3);
+    assert(counter_read(MALLOCS) == mallocs + 1);
+    assert(MallocCache.room[1] == FAST_DEPTH);
+    assert(Reclaimed == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_01_fast_classes() {
+    fast_init(reclaim);
+
+    Block *small = block_allocate(ALIGNMENT);
+    Block *large = block_allocate(FAST_MAX + ALIGNMENT);
+    assert(small && large);
+    make_room(ALIGNMENT);
+    make_room(2 * ALIGNMENT);
+
+    // Blocks only serve sizes that fit their class
+    free_fast(small->data);
+    assert(MallocCache.head[0] == small->data);
+    assert(MallocCache.head[1] == NULL);
+
+    // Blocks larger than FAST_MAX are never cached
+    assert(large->capacity / ALIGNMENT - 1 >= FAST_CLASSES);
+    for (size_t class = 0; class < FAST_CLASSES; class++) {
+        assert(MallocCache.head[class] != large->data);
+    }
+
+    // Classes without room (no miss yet) do not cache
+    assert(MallocCache.room[2] == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_02_fast_flush() {
+    fast_init(reclaim);
+    make_room(ALIGNMENT);
+
+    // A class takes FAST_DEPTH blocks and then has no room left
+    for (size_t i = 0; i < FAST_DEPTH; i++) {
+        Block *block = block_allocate(ALIGNMENT);
+        assert(block);
+        free_fast(block->data);
+    }
+    assert(MallocCache.room[0] == 0);
+
+    // Flushing hands every cached block back (counted as freed once)
+    size_t frees = counter_read(FREES);
+    malloc_fast_flush();
+    assert(Reclaimed == FAST_DEPTH);
+    assert(counter_read(FREES) == frees - FAST_DEPTH);
+    assert(MallocCache.head[0] == NULL && MallocCache.room[0] == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_03_fast_disabled() {
+    // Features that must see every free turn caching off
+    LinesEnabled = true;
+    fast_init(reclaim);
+    assert(!FastEnabled);
+
+    make_room(ALIGNMENT);
+    assert(MallocCache.room[0] == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_04_fast_exit() {
+    Block *   blocks[4];
+    pthread_t thread;
+    fast_init(reclaim);
+
+    for (size_t i = 0; i < 4; i++) {
+        assert((blocks[i] = block_allocate(ALIGNMENT)));
+    }
+
+    // An exiting thread hands its cache back
+    assert(pthread_create(&thread, NULL, cache_and_exit, blocks) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(Reclaimed == 4);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test fast_reuse\n");
+        fprintf(stderr, "    1. Test fast_classes\n");
+        fprintf(stderr, "    2. Test fast_flush\n");
+        fprintf(stderr, "    3. Test fast_disabled\n");
+        fprintf(stderr, "    4. Test fast_exit\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_fast_reuse(); break;
+        case 1:  status = test_01_fast_classes(); break;
+        case 2:  status = test_02_fast_flush(); break;
+        case 3:  status = test_03_fast_disabled(); break;
+        case 4:  status = test_04_fast_exit(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
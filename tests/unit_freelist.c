@@ -2,10 +2,14 @@
 
 #include "malloc/block.h"
 #include "malloc/counters.h"
+#include "malloc/freeindex.h"
 #include "malloc/freelist.h"
+#include "malloc/heap.h"
 
 #include <assert.h>
 #include <limits.h>
+#include <string.h>
+#include <unistd.h>
 
 /* Externals */
 
@@ -74,8 +78,8 @@ int test_03_free_list_insert() {
     assert(FreeList.next == b0);
     assert(b0->prev == &FreeList);
     assert(b0->next == &FreeList);
-    assert(Counters[MERGES] == 1);
-    assert(Counters[BLOCKS] == 1);
+    assert(counter_read(MERGES) == 1);
+    assert(counter_read(BLOCKS) == 1);
     assert(b0->capacity == ALIGN(100) + sizeof(Block) + ALIGN(100));
 
     return EXIT_SUCCESS;
@@ -95,6 +99,280 @@ int test_04_free_list_length() {
     return EXIT_SUCCESS;
 }
 
+int test_05_free_index_search() {
+    const size_t n = 100;
+
+    // Insert non-adjacent blocks of assorted sizes (separated by used blocks)
+    for (size_t i = 0; i < n; i++) {
+        Block *b = block_allocate((i * 37) % 500 + 1);
+        assert(b);
+        assert(block_allocate(1));
+        free_list_insert(b);
+    }
+    assert(free_index_valid());
+    assert(Indexes[0].length == n);
+    assert(free_list_length() == n);
+
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t s = 1; s <= 520; s++) {
+            assert(free_index_search_ff(s) == free_list_search_ff(s));
+            assert(free_index_search_bf(s) == free_list_search_bf(s));
+            assert(free_index_search_wf(s) == free_list_search_wf(s));
+        }
+
+        // Detach blocks (with and without splitting) and check again
+        for (size_t s = 8; s <= 480; s += 24) {
+            Block *b = free_index_search_bf(s);
+            if (b) {
+                free_list_detach(b, s);
+            }
+        }
+        assert(Indexes[0].length - Indexes[0].holes == free_list_length());
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int test_06_free_list_stats() {
+    Block *blocks[64];
+
+    // Allocate runs of adjacent blocks so inserts both append and merge
+    for (size_t i = 0; i < 64; i++) {
+        blocks[i] = block_allocate((i * 53) % 300 + 1);
+        assert(blocks[i]);
+        if (i % 4 == 3) {
+            assert(block_allocate(1));
+        }
+    }
+
+    for (size_t i = 0; i < 64; i += 2) free_list_insert(blocks[i]);
+    for (size_t i = 1; i < 64; i += 2) free_list_insert(blocks[i]);
+
+    for (size_t s = 1; s <= 1200; s += 7) {
+        Block *b = free_index_search_ff(s);
+        if (b) {
+            free_list_detach(b, s);
+        }
+
+        FreeStats stats;
+        size_t    blocks = 0, bytes = 0, slack = 0, largest = 0;
+        for (Block *curr = FreeList.next; curr != &FreeList; curr = curr->next) {
+            blocks++;
+            bytes += curr->capacity;
+            slack += curr->capacity - curr->size;
+            if (curr->capacity > largest)
+                largest = curr->capacity;
+        }
+
+        free_list_stats(&stats);
+        assert(stats.blocks  == blocks);
+        assert(stats.bytes   == bytes);
+        assert(stats.slack   == slack);
+        assert(stats.largest == largest);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int test_07_free_list_trim() {
+    Block *b0 = block_allocate(100);
+    Block *b1 = block_allocate(5000);
+    Block *b2 = block_allocate(100);
+    Block *b3 = block_allocate(3000);
+    assert(b0 && b1 && b2 && b3);
+    size_t heap = counter_read(HEAP_SIZE);
+
+    // Nothing to trim while the top block is in use
+    free_list_insert(b1);
+    free_list_insert(b2);
+    assert(free_list_trim(0) == 0);
+
+    // Free blocks at the top go back, down to the top block in use
+    free_list_insert(b3);
+    size_t released = free_list_trim(0);
+    assert(released == 3 * sizeof(Block) + ALIGN(5000) + ALIGN(100) + ALIGN(3000));
+    assert(counter_read(HEAP_SIZE) == heap - released);
+    assert((char *)sbrk(0) == b0->data + b0->capacity);
+    assert(free_list_length() == 0);
+
+    FreeStats stats;
+    free_list_stats(&stats);
+    assert(stats.blocks == 0 && stats.bytes == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_08_free_list_purge() {
+    size_t page = getpagesize();
+    Block *b0   = block_allocate(8 * page);
+    Block *b1   = block_allocate(100);
+    assert(b0 && b1);
+
+    memset(b0->data, 0xff, b0->capacity);
+    free_list_insert(b0);
+
+    // Whole pages inside free blocks are dropped (and read back zero)
+    size_t dropped = free_list_purge();
+    assert(dropped >= 7 * page);
+    assert(free_list_length() == 1);
+    assert(b0->capacity == ALIGN(8 * page));
+
+    // Pages already dropped are not counted again, until they are written
+    char *start = (char *)(((uintptr_t)b0->data + page - 1) & ~(page - 1));
+    assert(free_list_purge() == 0);
+    start[page] = 1;
+    assert(free_list_purge() == page);
+
+    for (size_t i = 0; i < dropped; i++) {
+        assert(start[i] == 0);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_09_free_list_consolidate() {
+    Block *b[6];
+    for (size_t i = 0; i < 6; i++) {
+        assert((b[i] = block_allocate(100 * (i + 1))));
+    }
+
+    // Runs of free blocks appended without merging stay split
+    free_list_append(b[1]);
+    free_list_append(b[2]);
+    free_list_append(b[4]);
+    free_list_append(b[3]);
+    assert(free_list_length() == 4);
+
+    // Each run merges into its first block (b[0] and b[5] are in use)
+    size_t bytes = b[1]->capacity + b[2]->capacity + b[3]->capacity + b[4]->capacity;
+    assert(free_list_consolidate() == 3);
+    assert(free_list_length() == 1);
+    assert(b[1]->capacity == bytes + 3 * sizeof(Block));
+    assert((char *)b[1]->data + b[1]->capacity == (char *)b[5]);
+
+    FreeStats stats;
+    free_list_stats(&stats);
+    assert(stats.blocks == 1 && stats.bytes == b[1]->capacity);
+    assert(free_list_search_ff(bytes) == b[1]);
+    assert(free_index_valid() && free_index_search_ff(bytes) == b[1]);
+
+    // Nothing left to merge
+    assert(free_list_consolidate() == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_10_free_list_trim_pad() {
+    Block *b0 = block_allocate(100);
+    Block *b1 = block_allocate(5000);
+    assert(b0 && b1);
+    size_t heap = counter_read(HEAP_SIZE);
+
+    // The top block shrinks to the pad instead of going away
+    free_list_insert(b1);
+    size_t released = free_list_trim(1000);
+    assert(released == ALIGN(5000) - ALIGN(1000));
+    assert(b1->capacity == ALIGN(1000));
+    assert((char *)sbrk(0) == b1->data + b1->capacity);
+    assert(counter_read(HEAP_SIZE) == heap - released);
+    assert(free_list_length() == 1);
+
+    FreeStats stats;
+    free_list_stats(&stats);
+    assert(stats.blocks == 1 && stats.bytes == ALIGN(1000));
+
+    // A top block within the pad is left alone
+    assert(free_list_trim(1000) == 0);
+    assert(free_list_trim(4000) == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_11_free_list_search_region() {
+    // Equal blocks in the main heap and the long-lived region (kept apart
+    // from their neighbours by blocks in use)
+    Block *main = block_allocate(64);
+    assert(main && block_allocate(1));
+    Block *other = block_allocate(256);
+    assert(other && block_allocate(1));
+    Block *held = block_allocate_long(64);
+    assert(held && heap_long(held) && block_allocate_long(1));
+    free_list_insert(main);
+    free_list_insert(other);
+    free_list_insert(held);
+
+    for (size_t round = 0; round < 2; round++) {
+        // Each region is searched on its own, by the index and by the list
+        Indexes[0].broken = round == 1;
+        Block *found = free_list_search_region(64, false);
+        assert(free_list_search_region(64, true)  == held);
+        assert(found == main || found == other);
+        assert(free_list_search_region(100, false) == other);
+        assert(free_list_search_region(100, true) == NULL);
+    }
+    free_index_rebuild();
+
+    // Once its hole is taken, a long-lived request finds nothing (and grows
+    // its region) rather than taking a hole from the main heap
+    free_list_detach(held, 64);
+    assert(free_list_search_region(64, true) == NULL);
+    assert(free_list_search_region(64, false) != NULL);
+    return EXIT_SUCCESS;
+}
+
+int test_12_free_list_trim_regions() {
+    Block *b0 = block_allocate(100);
+    Block *b1 = block_allocate(5000);
+    Block *l0 = block_allocate_long(100);
+    Block *l1 = block_allocate_long(5000);
+    assert(b0 && b1 && l0 && l1 && heap_long(l1));
+    size_t heap = counter_read(HEAP_SIZE);
+
+    // The top blocks of both regions shrink to the pad
+    free_list_insert(b1);
+    free_list_insert(l1);
+    size_t released = free_list_trim(1000);
+    assert(released == 2 * (ALIGN(5000) - ALIGN(1000)));
+    assert(b1->capacity == ALIGN(1000) && l1->capacity == ALIGN(1000));
+    assert((char *)sbrk(0) == b1->data + b1->capacity);
+    assert((char *)heap_sbrk_long(0) == l1->data + l1->capacity);
+    assert(counter_read(HEAP_SIZE) == heap - released);
+
+    // And go away without one, whichever comes first in the free list
+    released = free_list_trim(0);
+    assert(released == 2 * (sizeof(Block) + ALIGN(1000)));
+    assert((char *)sbrk(0) == b0->data + b0->capacity);
+    assert((char *)heap_sbrk_long(0) == l0->data + l0->capacity);
+    assert(free_list_length() == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_13_free_index_adjacent() {
+    Block *b[4];
+    for (size_t i = 0; i < 4; i++) {
+        assert((b[i] = block_allocate(100)));
+    }
+    assert(block_allocate(1));
+
+    // A detached block leaves its tags behind, which must not be trusted
+    free_list_insert(b[1]);
+    assert(free_list_detach(b[1], 100) == b[1]);
+    assert(free_index_adjacent(b[0]) == NULL);
+    assert(free_index_adjacent(b[2]) == NULL);
+
+    // Neither must user data that looks like a tag
+    memset(b[1]->data, 0, b[1]->capacity);
+    free_list_insert(b[3]);
+    assert(Indexes[0].blocks[0] == b[3]);
+    assert(free_index_adjacent(b[2]) == b[3]);
+
+    // With a free block on either side, the first in the free list wins
+    free_list_insert(b[1]);
+    assert(free_index_adjacent(b[2]) == b[3]);
+    free_list_insert(b[2]);
+    assert(b[2]->capacity == 2 * ALIGN(100) + sizeof(Block));
+    assert(free_list_length() == 2);
+    assert(Indexes[0].length - Indexes[0].holes == free_list_length());
+    assert(free_index_adjacent(b[0]) == b[1]);
+    return EXIT_SUCCESS;
+}
+
 /* Main execution */
 
 int main(int argc, char *argv[]) {
@@ -106,6 +384,15 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "    2. Test free_list_search_wf\n");
         fprintf(stderr, "    3. Test free_list_insert\n");
         fprintf(stderr, "    4. Test free_list_length\n");
+        fprintf(stderr, "    5. Test free_index_search\n");
+        fprintf(stderr, "    6. Test free_list_stats\n");
+        fprintf(stderr, "    7. Test free_list_trim\n");
+        fprintf(stderr, "    8. Test free_list_purge\n");
+        fprintf(stderr, "    9. Test free_list_consolidate\n");
+        fprintf(stderr, "    10. Test free_list_trim_pad\n");
+        fprintf(stderr, "    11. Test free_list_search_region\n");
+        fprintf(stderr, "    12. Test free_list_trim_regions\n");
+        fprintf(stderr, "    13. Test free_index_adjacent\n");
         return EXIT_FAILURE;
     }
 
@@ -118,6 +405,15 @@ int main(int argc, char *argv[]) {
         case 2:  status = test_02_free_list_search_wf(); break;
         case 3:  status = test_03_free_list_insert(); break;
         case 4:  status = test_04_free_list_length(); break;
+        case 5:  status = test_05_free_index_search(); break;
+        case 6:  status = test_06_free_list_stats(); break;
+        case 7:  status = test_07_free_list_trim(); break;
+        case 8:  status = test_08_free_list_purge(); break;
+        case 9:  status = test_09_free_list_consolidate(); break;
+        case 10: status = test_10_free_list_trim_pad(); break;
+        case 11: status = test_11_free_list_search_region(); break;
+        case 12: status = test_12_free_list_trim_regions(); break;
+        case 13: status = test_13_free_index_adjacent(); break;
         default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
     }
 
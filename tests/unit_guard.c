@@ -0,0 +1,196 @@
+/* unit_guard.c: Unit tests for sampled guard page allocations */
+
+#include "malloc/block.h"
+#include "malloc/guard.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define SLOTS   4
+
+/* Functions */
+
+/**
+ * Enable the guard pool with every allocation sampled.
+ **/
+void setup() {
+    setenv("MALLOC_GUARD", "1", 1);
+    setenv("MALLOC_GUARD_SLOTS", "4", 1);
+    guard_init();
+    assert(GuardRate == 1);
+}
+
+/**
+ * Run a function in a child process (with stderr captured), and check the
+ * child was killed by the expected signal after reporting the error.
+ **/
+void expect_crash(void (*function)(), int signum, const char *error) {
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        signal(SIGABRT, SIG_DFL);
+        function();
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    char    report[1024] = {0};
+    ssize_t length       = 0;
+    ssize_t nread;
+    while ((nread = read(fds[0], report + length, sizeof(report) - 1 - length)) > 0) {
+        length += nread;
+    }
+    close(fds[0]);
+
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == signum);
+    assert(strstr(report, error));
+    assert(strstr(report, "allocated by 0x1234"));
+}
+
+void overflow() {
+    char *data = guard_malloc(13, 0x1234);
+    data[ALIGN(13)] = 1;
+}
+
+void slack_overflow() {
+    char *data = guard_malloc(13, 0x1234);
+    data[13] = 1;
+    guard_free(data, 0x5678);
+}
+
+void use_after_free() {
+    volatile char *data = guard_malloc(100, 0x1234);
+    guard_free((char *)data, 0x5678);
+    data[0]++;
+}
+
+void double_free() {
+    char *data = guard_malloc(100, 0x1234);
+    guard_free(data, 0x5678);
+    guard_free(data, 0x5678);
+}
+
+int test_00_guard_malloc() {
+    setup();
+
+    /* Blocks end against the next guard page, with their header in front */
+    char *data[SLOTS];
+    for (size_t i = 0; i < SLOTS; i++) {
+        data[i] = guard_malloc(100 + i, 0x1234);
+        assert(data[i]);
+        assert(GUARD_OWNS(data[i]));
+        assert(((uintptr_t)data[i] + ALIGN(100 + i)) % getpagesize() == 0);
+
+        Block *block = BLOCK_FROM_POINTER(data[i]);
+        assert(block->size == 100 + i);
+        assert(block->capacity == ALIGN(100 + i));
+        assert(block->next == block && block->prev == block);
+
+        for (size_t j = 0; j < 100 + i; j++) {
+            assert(data[i][j] == 0);
+        }
+        memset(data[i], 0xff, 100 + i);
+    }
+
+    /* Once every slot is live (or a request is too big), the heap serves it */
+    assert(guard_malloc(8, 0x1234) == NULL);
+    assert(guard_free(data[1], 0x5678) == 101);
+    assert(guard_malloc(getpagesize(), 0x1234) == NULL);
+
+    /* Freed slots are reused, and come back zeroed */
+    char *again = guard_malloc(64, 0x1234);
+    assert(again && GUARD_OWNS(again));
+    for (size_t j = 0; j < 64; j++) {
+        assert(again[j] == 0);
+    }
+
+    /* The heap's own pointers are not in the pool */
+    char local;
+    assert(!GUARD_OWNS(&local));
+    assert(!GUARD_OWNS(NULL));
+    return EXIT_SUCCESS;
+}
+
+int test_01_guard_overflow() {
+    setup();
+    expect_crash(overflow, SIGSEGV, "heap-buffer-overflow at");
+    expect_crash(slack_overflow, SIGABRT, "heap-buffer-overflow (found at free)");
+    return EXIT_SUCCESS;
+}
+
+int test_02_guard_use_after_free() {
+    setup();
+    expect_crash(use_after_free, SIGSEGV, "use-after-free");
+    return EXIT_SUCCESS;
+}
+
+int test_03_guard_double_free() {
+    setup();
+    expect_crash(double_free, SIGABRT, "double-free");
+    return EXIT_SUCCESS;
+}
+
+int test_04_guard_sample() {
+    /* Disabled, nothing is sampled or owned */
+    for (size_t i = 0; i < 1000; i++) {
+        assert(!GUARD_SAMPLE());
+    }
+    char local;
+    assert(!GUARD_OWNS(&local));
+
+    /* About one allocation in the rate is sampled */
+    setenv("MALLOC_GUARD", "100", 1);
+    guard_init();
+
+    size_t samples = 0;
+    for (size_t i = 0; i < 100000; i++) {
+        samples += GUARD_SAMPLE();
+    }
+    assert(samples > 800 && samples < 1200);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test guard_malloc\n");
+        fprintf(stderr, "    1. Test guard_overflow\n");
+        fprintf(stderr, "    2. Test guard_use_after_free\n");
+        fprintf(stderr, "    3. Test guard_double_free\n");
+        fprintf(stderr, "    4. Test guard_sample\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_guard_malloc(); break;
+        case 1:  status = test_01_guard_overflow(); break;
+        case 2:  status = test_02_guard_use_after_free(); break;
+        case 3:  status = test_03_guard_double_free(); break;
+        case 4:  status = test_04_guard_sample(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
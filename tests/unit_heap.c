@@ -0,0 +1,145 @@
+/* unit_heap.c: Unit tests for the huge page heap backend */
+
+#include "malloc/heap.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define RESERVE     (4 * HUGEPAGE_SIZE)     /* MALLOC_HUGEPAGE_RESERVE=8 */
+
+/* Functions */
+
+char *heap_setup() {
+    setenv("MALLOC_HUGEPAGE", "1", 1);
+    setenv("MALLOC_HUGEPAGE_RESERVE", "8", 1);
+    assert(heap_hugepage());
+
+    char *start = heap_sbrk(0);
+    assert(start != SBRK_FAILURE);
+    assert(((uintptr_t)start & (HUGEPAGE_SIZE - 1)) == 0);
+    return start;
+}
+
+/**
+ * Return whether the page holding address is resident.
+ **/
+bool resident(char *address) {
+    unsigned char vector;
+    char *        page = (char *)((uintptr_t)address & ~((uintptr_t)getpagesize() - 1));
+    assert(mincore(page, getpagesize(), &vector) == 0);
+    return vector & 1;
+}
+
+int test_00_heap_break() {
+    char *start = heap_setup();
+
+    // Same contract as sbrk: the previous break is returned
+    assert(heap_sbrk(100) == start);
+    assert(heap_fresh() == start);
+    assert(heap_sbrk(0) == start + 100);
+    assert(heap_sbrk(HUGEPAGE_SIZE) == start + 100);
+    assert(heap_sbrk(-100) == start + 100 + HUGEPAGE_SIZE);
+    assert(heap_sbrk(-(intptr_t)HUGEPAGE_SIZE) == start + HUGEPAGE_SIZE);
+    assert(heap_sbrk(0) == start);
+
+    // Memory the break reached before may hold old data, except for the huge
+    // page past the hysteresis granule, which was released (and is zero)
+    assert(heap_sbrk(64) == start);
+    assert(heap_fresh() == start + HUGEPAGE_SIZE);
+    return EXIT_SUCCESS;
+}
+
+int test_01_heap_limit() {
+    char *start = heap_setup();
+
+    // Growing past the reservation fails and leaves the break alone
+    assert(heap_sbrk(RESERVE + 1) == SBRK_FAILURE);
+    assert(heap_sbrk(0) == start);
+    assert(heap_sbrk(RESERVE) == start);
+    assert(heap_sbrk(1) == SBRK_FAILURE);
+    assert(heap_sbrk(0) == start + RESERVE);
+
+    // As does shrinking below its start
+    assert(heap_sbrk(-(intptr_t)RESERVE - 1) == SBRK_FAILURE);
+    assert(heap_sbrk(0) == start + RESERVE);
+    assert(heap_sbrk(-(intptr_t)RESERVE) == start + RESERVE);
+    assert(heap_sbrk(-1) == SBRK_FAILURE);
+    assert(heap_sbrk(0) == start);
+    return EXIT_SUCCESS;
+}
+
+int test_02_heap_hysteresis() {
+    char *start = heap_setup();
+
+    // Touch three huge pages
+    assert(heap_sbrk(3 * HUGEPAGE_SIZE) == start);
+    for (size_t i = 0; i < 3; i++) {
+        memset(start + i * HUGEPAGE_SIZE, 'a' + i, HUGEPAGE_SIZE);
+    }
+
+    // A shrink within a granule of the backed pages releases nothing
+    assert(heap_sbrk(-(intptr_t)HUGEPAGE_SIZE / 2) == start + 3 * HUGEPAGE_SIZE);
+    assert(heap_sbrk(HUGEPAGE_SIZE / 2) == start + 5 * HUGEPAGE_SIZE / 2);
+    assert(start[3 * HUGEPAGE_SIZE - 1] == 'c');
+    assert(resident(start + 3 * HUGEPAGE_SIZE - 1));
+    assert(heap_fresh() == start + 3 * HUGEPAGE_SIZE);
+    return EXIT_SUCCESS;
+}
+
+int test_03_heap_release() {
+    char *start = heap_setup();
+
+    assert(heap_sbrk(3 * HUGEPAGE_SIZE) == start);
+    for (size_t i = 0; i < 3; i++) {
+        memset(start + i * HUGEPAGE_SIZE, 'a' + i, HUGEPAGE_SIZE);
+    }
+
+    // Shrinking to the first huge page keeps one more as hysteresis and
+    // releases the rest
+    assert(heap_sbrk(-(intptr_t)(3 * HUGEPAGE_SIZE - 100)) == start + 3 * HUGEPAGE_SIZE);
+    assert(resident(start + 2 * HUGEPAGE_SIZE - 1));
+    assert(!resident(start + 2 * HUGEPAGE_SIZE));
+    assert(!resident(start + 3 * HUGEPAGE_SIZE - 1));
+
+    // Growing back: released memory reads zero (and is reported fresh),
+    // kept memory still holds its data
+    assert(heap_sbrk(3 * HUGEPAGE_SIZE - 100) == start + 100);
+    assert(heap_fresh() == start + 2 * HUGEPAGE_SIZE);
+    assert(start[0] == 'a' && start[HUGEPAGE_SIZE] == 'b');
+    assert(start[2 * HUGEPAGE_SIZE] == 0 && start[3 * HUGEPAGE_SIZE - 1] == 0);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test heap_break\n");
+        fprintf(stderr, "    1. Test heap_limit\n");
+        fprintf(stderr, "    2. Test heap_hysteresis\n");
+        fprintf(stderr, "    3. Test heap_release\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_heap_break(); break;
+        case 1:  status = test_01_heap_limit(); break;
+        case 2:  status = test_02_heap_hysteresis(); break;
+        case 3:  status = test_03_heap_release(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,153 @@
+/* unit_latency.c: Unit tests for latency histograms */
+
+#include "malloc/latency.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Externals */
+
+extern size_t   latency_bucket(uint64_t value);
+extern uint64_t latency_value(size_t bucket);
+
+/* Functions */
+
+/**
+ * Add a sample to a histogram the way latency_record does.
+ **/
+void histogram_add(Histogram *histogram, uint64_t value) {
+    histogram->buckets[latency_bucket(value)]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+int test_00_latency_bucket() {
+    // Values below 2^LATENCY_SUBBITS get a bucket each
+    for (uint64_t v = 0; v < 16; v++) {
+        assert(latency_bucket(v) == v);
+    }
+    assert(latency_bucket(15) == 15);
+
+    // [16, 32) is split into 16 buckets of one value each
+    assert(latency_bucket(16) == 16);
+    assert(latency_bucket(17) == 17);
+    assert(latency_bucket(31) == 31);
+
+    // [32, 64) is split into 16 buckets of two values each
+    assert(latency_bucket(32) == 32);
+    assert(latency_bucket(33) == 32);
+    assert(latency_bucket(34) == 33);
+    assert(latency_bucket(63) == 47);
+    assert(latency_bucket(64) == 48);
+
+    // Buckets never decrease and never skip
+    size_t prev = 0;
+    for (uint64_t v = 1; v < 1<<16; v++) {
+        size_t bucket = latency_bucket(v);
+        assert(bucket == prev || bucket == prev + 1);
+        prev = bucket;
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_01_latency_value() {
+    // Each bucket's value is the largest value mapped to it
+    assert(latency_value(15) == 15);
+    assert(latency_value(16) == 16);
+    assert(latency_value(31) == 31);
+    assert(latency_value(32) == 33);
+    assert(latency_value(47) == 63);
+
+    for (size_t b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        assert(latency_bucket(latency_value(b)) == b);
+        assert(latency_bucket(latency_value(b) + 1) == b + 1);
+    }
+
+    // Relative error stays below 1/2^LATENCY_SUBBITS
+    for (uint64_t v = 1; v < 1<<20; v += 7) {
+        uint64_t upper = latency_value(latency_bucket(v));
+        assert(upper >= v && (upper - v) * (1<<LATENCY_SUBBITS) <= v);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_02_latency_clamp() {
+    const uint64_t top = (1ULL<<LATENCY_MAXBITS) - 1;
+
+    // Everything from 2^LATENCY_MAXBITS up lands in the last bucket
+    assert(latency_bucket(top) == LATENCY_BUCKETS - 1);
+    assert(latency_bucket(top + 1) == LATENCY_BUCKETS - 1);
+    assert(latency_bucket(1ULL<<50) == LATENCY_BUCKETS - 1);
+    assert(latency_bucket(UINT64_MAX) == LATENCY_BUCKETS - 1);
+    assert(latency_value(LATENCY_BUCKETS - 1) == top);
+    assert(latency_bucket(1ULL<<(LATENCY_MAXBITS - 1)) < LATENCY_BUCKETS - 1);
+    return EXIT_SUCCESS;
+}
+
+int test_03_latency_percentiles() {
+    static Histogram histogram;
+    Percentiles      p;
+
+    // Empty histograms report zeros
+    latency_percentiles(&histogram, &p);
+    assert(p.p50 == 0 && p.p99 == 0 && p.p999 == 0);
+
+    // Samples 1..1000: each percentile is the top of its sample's bucket,
+    // capped at the largest sample
+    for (uint64_t v = 1; v <= 1000; v++) {
+        histogram_add(&histogram, v);
+    }
+    latency_percentiles(&histogram, &p);
+    assert(p.p50  == latency_value(latency_bucket(500)) && p.p50  == 511);
+    assert(p.p99  == latency_value(latency_bucket(990)) && p.p99  == 991);
+    assert(p.p999 == 1000);
+
+    // A single outlier only shows up past p99.9 of 10000 samples
+    memset(&histogram, 0, sizeof(histogram));
+    for (size_t i = 0; i < 9990; i++) {
+        histogram_add(&histogram, 10);
+    }
+    for (size_t i = 0; i < 10; i++) {
+        histogram_add(&histogram, 1ULL<<45);
+    }
+    latency_percentiles(&histogram, &p);
+    assert(p.p50 == 10 && p.p99 == 10 && p.p999 == 10);
+
+    histogram_add(&histogram, 1ULL<<45);
+    latency_percentiles(&histogram, &p);
+    assert(p.p50 == 10 && p.p99 == 10);
+    assert(p.p999 == (1ULL<<LATENCY_MAXBITS) - 1);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test latency_bucket\n");
+        fprintf(stderr, "    1. Test latency_value\n");
+        fprintf(stderr, "    2. Test latency_clamp\n");
+        fprintf(stderr, "    3. Test latency_percentiles\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_latency_bucket(); break;
+        case 1:  status = test_01_latency_value(); break;
+        case 2:  status = test_02_latency_clamp(); break;
+        case 3:  status = test_03_latency_percentiles(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
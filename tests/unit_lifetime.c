@@ -0,0 +1,87 @@
+/* unit_lifetime.c: Unit tests for lifetime prediction */
+
+#include "malloc/lifetime.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+/* Constants */
+
+#define SITE_SHORT  ((uintptr_t)0x401000)
+#define SITE_LONG   ((uintptr_t)0x402000)
+
+/* Functions */
+
+int test_00_lifetime_predict_short() {
+    /* Objects freed right away are never predicted long-lived */
+    for (uintptr_t i = 1; i <= 4 * LIFETIME_PERIOD * LIFETIME_RING; i++) {
+        void *ptr = (void *)(i * 16);
+        lifetime_malloc(ptr, SITE_SHORT, 64);
+        lifetime_free(ptr);
+    }
+
+    assert(lifetime_predict(SITE_SHORT, 64) == false);
+    return EXIT_SUCCESS;
+}
+
+int test_01_lifetime_predict_long() {
+    /* Objects from one site are kept, from another freed at once (every
+     * third, so sampling does not alias with the pattern) */
+    for (uintptr_t i = 1; i <= 4 * LIFETIME_PERIOD * LIFETIME_RING; i++) {
+        void *ptr = (void *)(i * 16);
+        if (i % 3 == 0) {
+            lifetime_malloc(ptr, SITE_LONG, 64);
+        } else {
+            lifetime_malloc(ptr, SITE_SHORT, 64);
+            lifetime_free(ptr);
+        }
+    }
+
+    assert(lifetime_predict(SITE_LONG, 64)  == true);
+    assert(lifetime_predict(SITE_SHORT, 64) == false);
+
+    /* Same site, different size class is learned separately */
+    assert(lifetime_predict(SITE_LONG, 4096) == false);
+    return EXIT_SUCCESS;
+}
+
+int test_02_lifetime_unlearn() {
+    /* A site that stops producing long-lived objects is unlearned */
+    test_01_lifetime_predict_long();
+
+    for (uintptr_t i = 1; i <= 8 * LIFETIME_PERIOD * LIFETIME_RING; i++) {
+        void *ptr = (void *)((i + (1UL<<32)) * 16);
+        lifetime_malloc(ptr, SITE_LONG, 64);
+        lifetime_free(ptr);
+    }
+
+    assert(lifetime_predict(SITE_LONG, 64) == false);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test lifetime_predict_short\n");
+        fprintf(stderr, "    1. Test lifetime_predict_long\n");
+        fprintf(stderr, "    2. Test lifetime_unlearn\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_lifetime_predict_short(); break;
+        case 1:  status = test_01_lifetime_predict_long(); break;
+        case 2:  status = test_02_lifetime_unlearn(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,206 @@
+/* unit_lines.c: Unit tests for per-thread cache line regions */
+
+#include "malloc/block.h"
+#include "malloc/counters.h"
+#include "malloc/heap.h"
+#include "malloc/lines.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+
+/* Constants */
+
+#define LINE_SIZE   64
+#define THREADS     4
+#define OBJECTS     1000
+
+/* Global Variables */
+
+pthread_mutex_t   Lock = PTHREAD_MUTEX_INITIALIZER;   /* Stands in for the heap lock */
+pthread_barrier_t Done;                             /* Keeps every thread alive (and its slot) */
+Block *           Blocks[THREADS][OBJECTS];
+
+/* Functions */
+
+void lines_setup() {
+    setenv("MALLOC_LINES", "1", 1);
+    lines_init();
+    assert(LinesEnabled);
+}
+
+Block *lines_allocate_locked(size_t capacity) {
+    pthread_mutex_lock(&Lock);
+    Block *block = lines_allocate(capacity);
+    pthread_mutex_unlock(&Lock);
+    return block;
+}
+
+void lines_free_locked(Block *block) {
+    pthread_mutex_lock(&Lock);
+    lines_free(block);
+    pthread_mutex_unlock(&Lock);
+}
+
+void *allocate_objects(void *arg) {
+    Block **blocks = arg;
+    for (size_t i = 0; i < OBJECTS; i++) {
+        blocks[i] = lines_allocate_locked(ALIGNMENT << (i % 4));
+        assert(blocks[i]);
+    }
+    pthread_barrier_wait(&Done);
+    return NULL;
+}
+
+void *allocate_one(void *arg) {
+    Block **block = arg;
+    *block = lines_allocate_locked(ALIGNMENT);
+    return NULL;
+}
+
+bool count_allocated(Block *block, bool allocated, void *arg) {
+    if (allocated && heap_lines(block)) {
+        (*(size_t *)arg)++;
+    }
+    return true;
+}
+
+int test_00_lines_dense() {
+    lines_setup();
+
+    // The first block starts right after the header of an aligned chunk
+    Block *first = lines_allocate(ALIGNMENT);
+    assert(first && heap_lines(first));
+    assert(((uintptr_t)first & (LINES_CHUNK - 1)) == LINES_HEADER);
+    assert(first->prev == first && first->next == first);
+    assert(counter_read(HEAP_SIZE) == LINES_CHUNK);
+
+    // A thread's blocks are packed back to back
+    Block *prev = first;
+    for (size_t i = 0; i < 100; i++) {
+        Block *block = lines_allocate(ALIGNMENT);
+        assert(block == (Block *)(prev->data + prev->capacity));
+        prev = block;
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_01_lines_reuse() {
+    lines_setup();
+
+    Block *a = lines_allocate(2 * ALIGNMENT);
+    Block *b = lines_allocate(2 * ALIGNMENT);
+    assert(a && b && a != b);
+
+    // Freed blocks are reused for the same capacity only
+    lines_free(a);
+    assert(a->prev != a);
+    Block *c = lines_allocate(ALIGNMENT);
+    assert(c != a);
+    assert(lines_allocate(2 * ALIGNMENT) == a);
+    assert(a->prev == a && a->next == a);
+
+    // Capacities up to LINES_MAX are served
+    Block *large = lines_allocate(LINES_MAX);
+    assert(large && large->capacity == LINES_MAX);
+    return EXIT_SUCCESS;
+}
+
+int test_02_lines_threads() {
+    pthread_t threads[THREADS];
+    lines_setup();
+    pthread_barrier_init(&Done, NULL, THREADS);
+
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_create(&threads[t], NULL, allocate_objects, Blocks[t]) == 0);
+    }
+    for (size_t t = 0; t < THREADS; t++) {
+        assert(pthread_join(threads[t], NULL) == 0);
+    }
+
+    // No cache line (header or data) holds blocks of two threads
+    for (size_t t = 0; t < THREADS; t++) {
+        for (size_t i = 0; i < OBJECTS; i++) {
+            uintptr_t first = (uintptr_t)Blocks[t][i] / LINE_SIZE;
+            uintptr_t last  = ((uintptr_t)Blocks[t][i]->data + Blocks[t][i]->capacity - 1) / LINE_SIZE;
+            for (size_t u = t + 1; u < THREADS; u++) {
+                for (size_t j = 0; j < OBJECTS; j++) {
+                    uintptr_t other_first = (uintptr_t)Blocks[u][j] / LINE_SIZE;
+                    uintptr_t other_last  = ((uintptr_t)Blocks[u][j]->data + Blocks[u][j]->capacity - 1) / LINE_SIZE;
+                    assert(last < other_first || other_last < first);
+                }
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_03_lines_remote_free() {
+    pthread_t thread;
+    Block *   remote = NULL;
+    lines_setup();
+
+    Block *local = lines_allocate_locked(ALIGNMENT);
+    assert(pthread_create(&thread, NULL, allocate_one, &remote) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(remote && remote != local);
+
+    // A block freed by another thread goes back to its owner, not the freer
+    lines_free_locked(remote);
+    Block *next = lines_allocate_locked(ALIGNMENT);
+    assert(next != remote);
+
+    // The exited owner's slot (and free lists) pass to the next new thread
+    Block *adopted = NULL;
+    assert(pthread_create(&thread, NULL, allocate_one, &adopted) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    assert(adopted == remote);
+    return EXIT_SUCCESS;
+}
+
+int test_04_lines_walk() {
+    size_t allocated = 0;
+    lines_setup();
+
+    // Enough blocks to span several chunks
+    size_t n = 3 * LINES_CHUNK / (sizeof(Block) + LINES_MAX);
+    for (size_t i = 0; i < n; i++) {
+        assert(lines_allocate(LINES_MAX - (i % 3) * ALIGNMENT));
+    }
+    assert(counter_read(HEAP_SIZE) > 2 * LINES_CHUNK);
+
+    assert(heap_walk(count_allocated, &allocated));
+    assert(allocated == n);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test lines_dense\n");
+        fprintf(stderr, "    1. Test lines_reuse\n");
+        fprintf(stderr, "    2. Test lines_threads\n");
+        fprintf(stderr, "    3. Test lines_remote_free\n");
+        fprintf(stderr, "    4. Test lines_walk\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_lines_dense(); break;
+        case 1:  status = test_01_lines_reuse(); break;
+        case 2:  status = test_02_lines_threads(); break;
+        case 3:  status = test_03_lines_remote_free(); break;
+        case 4:  status = test_04_lines_walk(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
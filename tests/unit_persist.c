@@ -0,0 +1,228 @@
+/* unit_persist.c: Unit tests for the persistent heap */
+
+#include "malloc/freelist.h"
+#include "malloc/heap.h"
+#include "malloc/persist.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* External Functions */
+
+extern Block *free_list_search_ff(size_t size);
+
+/* Constants */
+
+#define NODES   64
+
+/* Structures */
+
+typedef struct node Node;
+struct node {
+    Node *  next;
+    size_t  value;
+};
+
+/* Functions */
+
+/**
+ * Point MALLOC_PERSIST at a new empty file.
+ **/
+void setup(char *path) {
+    strcpy(path, "/tmp/unit_persist.XXXXXX");
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    setenv("MALLOC_PERSIST", path, 1);
+    setenv("MALLOC_PERSIST_SIZE", "16", 1);
+}
+
+/**
+ * In a child process, attach to the heap file, build a list of NODES nodes
+ * from it (freeing every other spare block) and exit, writing the heap back
+ * only if requested.
+ **/
+void populate(bool sync) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    if (pid == 0) {
+        persist_init();
+        assert(Persist && heap_persistent());
+
+        Node *head = NULL;
+        for (size_t i = 0; i < NODES; i++) {
+            Block *block = block_allocate(sizeof(Node));
+            Block *spare = block_allocate(sizeof(Node));
+            assert(block && spare && heap_persistent());
+
+            Node *node  = (Node *)block->data;
+            node->value = i;
+            node->next  = head;
+            head        = node;
+
+            if (i % 2) {
+                free_list_insert(spare);
+            }
+        }
+
+        persist_set_root(head);
+        if (sync) {
+            persist_sync();
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+/**
+ * Attach to the heap file and check the list and free list survived.
+ **/
+void verify() {
+    persist_init();
+    assert(Persist);
+    assert(heap_persistent());
+
+    size_t count = 0;
+    for (Node *node = persist_root(); node; node = node->next) {
+        assert(node->value == NODES - 1 - count);
+        count++;
+    }
+    assert(count == NODES);
+    assert(free_list_length() == NODES / 2);
+
+    /* Free blocks come back from the relinked free list, inside the file */
+    Block *block = free_list_search_ff(sizeof(Node));
+    assert(block);
+    assert((uintptr_t)block >= PERSIST_BASE && (uintptr_t)block < PERSIST_BASE + Persist->reserve);
+    block = free_list_detach(block, sizeof(Node));
+    assert(block->next == block);
+    assert(free_list_length() == NODES / 2 - 1);
+}
+
+int test_00_persist_reattach() {
+    /* A clean exit is relinked from the saved free list */
+    char path[64];
+    setup(path);
+    populate(true);
+
+    verify();
+    assert(counter_read(BLOCKS) == 2 * NODES);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+int test_01_persist_unsynced() {
+    /* Changes that were never synced are not saved */
+    char path[64];
+    setup(path);
+    populate(true);
+    populate(false);
+
+    verify();
+    assert(counter_read(BLOCKS) == 2 * NODES);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+int test_02_persist_rebuild() {
+    /* After an interrupted sync, the free list is rebuilt by walking the heap */
+    char path[64];
+    setup(path);
+    populate(true);
+
+    uint32_t clean = 0;
+    int      fd    = open(path, O_WRONLY);
+    assert(fd >= 0);
+    assert(pwrite(fd, &clean, sizeof(clean), offsetof(PersistHeader, clean)) == sizeof(clean));
+    close(fd);
+
+    verify();
+    assert(counter_read(BLOCKS) == 2 * NODES);
+    assert(counter_read(HEAP_SIZE) == 2 * NODES * (sizeof(Block) + ALIGN(sizeof(Node))));
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+int test_03_persist_bad_brk() {
+    /* A saved break outside the file is not trusted, even when clean */
+    char path[64];
+    setup(path);
+    populate(true);
+
+    uintptr_t brk = PERSIST_BASE + (1UL<<40);
+    int       fd  = open(path, O_WRONLY);
+    assert(fd >= 0);
+    assert(pwrite(fd, &brk, sizeof(brk), offsetof(PersistHeader, brk)) == sizeof(brk));
+    close(fd);
+
+    verify();
+    assert(counter_read(BLOCKS) == 2 * NODES);
+    assert(counter_read(HEAP_SIZE) == 2 * NODES * (sizeof(Block) + ALIGN(sizeof(Node))));
+    assert(heap_sbrk(0) == (char *)PERSIST_BASE + PERSIST_HEADER + counter_read(HEAP_SIZE));
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+int test_04_persist_foreign() {
+    /* A file that is not a heap is left alone */
+    char path[64];
+    setup(path);
+
+    FILE *fs = fopen(path, "w");
+    assert(fs);
+    fputs("not a heap\n", fs);
+    fclose(fs);
+
+    persist_init();
+    assert(Persist == NULL);
+    assert(!heap_persistent());
+
+    char buffer[64] = {0};
+    fs = fopen(path, "r");
+    assert(fgets(buffer, sizeof(buffer), fs));
+    fclose(fs);
+    assert(strcmp(buffer, "not a heap\n") == 0);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test persist_reattach\n");
+        fprintf(stderr, "    1. Test persist_unsynced\n");
+        fprintf(stderr, "    2. Test persist_rebuild\n");
+        fprintf(stderr, "    3. Test persist_bad_brk\n");
+        fprintf(stderr, "    4. Test persist_foreign\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_persist_reattach(); break;
+        case 1:  status = test_01_persist_unsynced(); break;
+        case 2:  status = test_02_persist_rebuild(); break;
+        case 3:  status = test_03_persist_bad_brk(); break;
+        case 4:  status = test_04_persist_foreign(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,107 @@
+/* unit_ptrmap.c: Unit tests for pointer hash map */
+
+#include "malloc/ptrmap.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+/* Functions */
+
+int test_00_ptr_map_insert() {
+    PtrMap   map = {0};
+    uint64_t value;
+
+    assert(ptr_map_lookup(&map, (void *)0x1000, &value) == false);
+    assert(ptr_map_insert(&map, (void *)0x1000, 1));
+    assert(ptr_map_insert(&map, (void *)0x2000, 2));
+    assert(map.length == 2);
+
+    assert(ptr_map_lookup(&map, (void *)0x1000, &value) && value == 1);
+    assert(ptr_map_lookup(&map, (void *)0x2000, &value) && value == 2);
+    assert(ptr_map_lookup(&map, (void *)0x3000, &value) == false);
+
+    assert(ptr_map_insert(&map, (void *)0x1000, 3));
+    assert(map.length == 2);
+    assert(ptr_map_lookup(&map, (void *)0x1000, &value) && value == 3);
+
+    ptr_map_clear(&map);
+    assert(map.length == 0 && map.entries == NULL);
+    return EXIT_SUCCESS;
+}
+
+int test_01_ptr_map_grow() {
+    PtrMap   map = {0};
+    uint64_t value;
+
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        assert(ptr_map_insert(&map, (void *)(i * 16), i));
+    }
+    assert(map.length == 100000);
+    assert(map.capacity >= 2 * map.length);
+
+    for (uintptr_t i = 1; i <= 100000; i++) {
+        assert(ptr_map_lookup(&map, (void *)(i * 16), &value) && value == i);
+    }
+
+    ptr_map_clear(&map);
+    return EXIT_SUCCESS;
+}
+
+int test_02_ptr_map_remove() {
+    PtrMap   map = {0};
+    uint64_t value;
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        assert(ptr_map_insert(&map, (void *)(i * 8), i));
+    }
+
+    /* Remove every other entry; the rest must stay reachable */
+    for (uintptr_t i = 1; i <= 10000; i += 2) {
+        assert(ptr_map_remove(&map, (void *)(i * 8), &value) && value == i);
+        assert(ptr_map_remove(&map, (void *)(i * 8), &value) == false);
+    }
+    assert(map.length == 5000);
+
+    for (uintptr_t i = 1; i <= 10000; i++) {
+        assert(ptr_map_lookup(&map, (void *)(i * 8), &value) == !(i % 2));
+    }
+
+    for (uintptr_t i = 2; i <= 10000; i += 2) {
+        assert(ptr_map_remove(&map, (void *)(i * 8), NULL));
+    }
+    assert(map.length == 0);
+
+    for (size_t slot = 0; slot < map.capacity; slot++) {
+        assert(map.entries[slot].key == 0);
+    }
+
+    ptr_map_clear(&map);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test ptr_map_insert\n");
+        fprintf(stderr, "    1. Test ptr_map_grow\n");
+        fprintf(stderr, "    2. Test ptr_map_remove\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_ptr_map_insert(); break;
+        case 1:  status = test_01_ptr_map_grow(); break;
+        case 2:  status = test_02_ptr_map_remove(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
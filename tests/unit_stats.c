@@ -0,0 +1,163 @@
+/* unit_stats.c: Unit tests for the live statistics page */
+
+#include "malloc/stats.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define PUBLISHES   20000
+#define OBJECT_SIZE 100
+
+/* Global Variables */
+
+bool    Publishing = true;
+
+/* Functions */
+
+void stats_setup() {
+    setenv("MALLOC_STATS", "1", 1);
+    stats_init();
+    assert(Stats);
+}
+
+/**
+ * Return whether the stats page of specified process exists.
+ **/
+bool stats_exists(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), STATS_PATH, pid);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * Allocate and free objects of OBJECT_SIZE bytes, publishing after each, so
+ * every published page has live == (mallocs - frees) * OBJECT_SIZE.
+ **/
+void *publish_objects(void *arg) {
+    (void)arg;
+    for (size_t i = 0; i < PUBLISHES; i++) {
+        if (i % 3 == 2) {
+            stats_free(OBJECT_SIZE);
+        } else {
+            stats_malloc(OBJECT_SIZE);
+        }
+        stats_publish(true);
+        sched_yield();
+    }
+    __atomic_store_n(&Publishing, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int test_00_stats_classes() {
+    SizeClassStats classes[STATS_CLASSES] = {{0}};
+    stats_setup();
+
+    // Size class i holds (2^(i-1), 2^i]
+    assert(STATS_CLASS(0)  == 0);
+    assert(STATS_CLASS(1)  == 0);
+    assert(STATS_CLASS(2)  == 1);
+    assert(STATS_CLASS(3)  == 2);
+    assert(STATS_CLASS(4)  == 2);
+    assert(STATS_CLASS(5)  == 3);
+    assert(STATS_CLASS(16) == 4);
+    assert(STATS_CLASS(17) == 5);
+    assert(STATS_CLASS(1UL<<(STATS_CLASSES - 2)) == STATS_CLASSES - 2);
+    assert(STATS_CLASS((1UL<<(STATS_CLASSES - 2)) + 1) == STATS_CLASSES - 1);
+    assert(STATS_CLASS(SIZE_MAX) == STATS_CLASSES - 1);
+
+    // Mallocs and frees are charged to the class of the requested size
+    stats_malloc(3);
+    stats_malloc(4);
+    stats_malloc(1000);
+    stats_free(4);
+    stats_publish(true);
+
+    memcpy(classes, Stats->classes, sizeof(classes));
+    assert(classes[2].mallocs == 2 && classes[2].frees == 1 && classes[2].live == 3);
+    assert(classes[10].mallocs == 1 && classes[10].frees == 0 && classes[10].live == 1000);
+    assert(classes[3].mallocs == 0 && classes[3].live == 0);
+    return EXIT_SUCCESS;
+}
+
+int test_01_stats_read() {
+    pthread_t thread;
+    StatsPage copy;
+    size_t    reads    = 0;
+    uint64_t  sequence = 0;
+    stats_setup();
+
+    assert(stats_exists(getpid()));
+    assert(Stats->magic == STATS_MAGIC && Stats->pid == (uint32_t)getpid());
+
+    // Every copy taken while another thread publishes is a single publish
+    assert(pthread_create(&thread, NULL, publish_objects, NULL) == 0);
+    do {
+        assert(stats_read(Stats, &copy));
+        assert((copy.sequence & 1) == 0);
+        assert(copy.sequence >= sequence);
+        sequence = copy.sequence;
+
+        SizeClassStats *class = &copy.classes[STATS_CLASS(OBJECT_SIZE)];
+        assert(class->mallocs >= class->frees);
+        assert(class->live == (class->mallocs - class->frees) * OBJECT_SIZE);
+        reads++;
+    } while (__atomic_load_n(&Publishing, __ATOMIC_ACQUIRE));
+    assert(pthread_join(thread, NULL) == 0);
+    assert(reads > 0);
+
+    assert(stats_read(Stats, &copy));
+    assert(copy.classes[STATS_CLASS(OBJECT_SIZE)].mallocs + copy.classes[STATS_CLASS(OBJECT_SIZE)].frees == PUBLISHES);
+    return EXIT_SUCCESS;
+}
+
+int test_02_stats_fork() {
+    int status;
+    stats_setup();
+    StatsPage *parent = Stats;
+
+    // A forked child publishes to its own page, removed when it exits
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        exit(Stats && Stats != parent && Stats->pid == (uint32_t)getpid() && stats_exists(getpid()) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    assert(!stats_exists(pid));
+    assert(Stats == parent && Stats->pid == (uint32_t)getpid());
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test stats_classes\n");
+        fprintf(stderr, "    1. Test stats_read\n");
+        fprintf(stderr, "    2. Test stats_fork\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_stats_classes(); break;
+        case 1:  status = test_01_stats_read(); break;
+        case 2:  status = test_02_stats_fork(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,179 @@
+/* unit_trace.c: Unit tests for allocation trace recording */
+
+#include "malloc/trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define RECORDS     (TRACE_BUFFER + 100)   /* Enough to flush once before exit */
+
+/* Global Variables */
+
+char    Path[] = "/tmp/unit_trace.XXXXXX";
+
+/* Functions */
+
+/**
+ * Run function in a child process that traces to Path, so the trace is
+ * flushed by its exit handler, and return the number of records written.
+ **/
+size_t trace_child(void (*function)()) {
+    int status;
+    int fd = mkstemp(Path);
+    assert(fd >= 0);
+    close(fd);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        setenv("MALLOC_TRACE", Path, 1);
+        trace_init();
+        assert(TraceEnabled);
+        function();
+        exit(EXIT_SUCCESS);
+    }
+
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    struct stat st;
+    assert(stat(Path, &st) == 0);
+    assert(st.st_size >= (off_t)sizeof(TraceHeader));
+    assert((st.st_size - sizeof(TraceHeader)) % sizeof(TraceRecord) == 0);
+    return (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+}
+
+/**
+ * Read the header and records of the trace at Path.
+ **/
+void trace_load(TraceHeader *header, TraceRecord *records, size_t n) {
+    FILE *stream = fopen(Path, "r");
+    assert(stream);
+    assert(fread(header, sizeof(TraceHeader), 1, stream) == 1);
+    assert(fread(records, sizeof(TraceRecord), n, stream) == n);
+    fclose(stream);
+    unlink(Path);
+}
+
+void record_objects() {
+    char objects[4];
+
+    // Two objects, one freed, then its address reused by a new object
+    trace_record(OP_MALLOC, &objects[0], 0, 10);
+    trace_record(OP_CALLOC, &objects[1], 0, 20);
+    trace_record(OP_FREE, NULL, trace_forget(&objects[0]), 0);
+    trace_record(OP_MALLOC, &objects[0], 0, 30);
+
+    // A failed realloc puts the old object back
+    uint32_t old = trace_forget(&objects[1]);
+    assert(old == 2);
+    trace_restore(&objects[1], old);
+    assert(trace_forget(&objects[1]) == 2);
+    trace_record(OP_REALLOC, &objects[2], 2, 40);
+
+    // Pointers that were never traced (or NULL results) have id 0
+    assert(trace_forget(&objects[3]) == 0);
+    trace_record(OP_MALLOC, NULL, 0, 50);
+}
+
+void record_many() {
+    static char objects[RECORDS];
+    for (size_t i = 0; i < RECORDS; i++) {
+        trace_record(OP_MALLOC, &objects[i], 0, i);
+    }
+}
+
+void record_fork() {
+    char object;
+    int  status;
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        // Forked children stop tracing rather than interleave records
+        assert(!TraceEnabled);
+        trace_record(OP_MALLOC, &object, 0, 1);
+        _exit(EXIT_SUCCESS);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    trace_record(OP_MALLOC, &object, 0, 2);
+}
+
+int test_00_trace_records() {
+    TraceHeader header;
+    TraceRecord records[6];
+
+    assert(trace_child(record_objects) == 6);
+    trace_load(&header, records, 6);
+    assert(header.magic == TRACE_MAGIC && header.version == TRACE_VERSION);
+
+    // Ids follow allocation order and reused addresses get new ids
+    assert(records[0].operation == OP_MALLOC  && records[0].id == 1 && records[0].size == 10);
+    assert(records[1].operation == OP_CALLOC  && records[1].id == 2 && records[1].size == 20);
+    assert(records[2].operation == OP_FREE    && records[2].id == 0 && records[2].old  == 1);
+    assert(records[3].operation == OP_MALLOC  && records[3].id == 3 && records[3].size == 30);
+    assert(records[4].operation == OP_REALLOC && records[4].id == 4 && records[4].old  == 2);
+    assert(records[5].operation == OP_MALLOC  && records[5].id == 0 && records[5].size == 50);
+
+    for (size_t i = 0; i < 6; i++) {
+        assert(records[i].thread == 0);
+        assert(i == 0 || records[i].timestamp >= records[i - 1].timestamp);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_01_trace_flush() {
+    static TraceRecord records[RECORDS];
+    TraceHeader        header;
+
+    // Full buffers are written as they fill, the rest at exit
+    assert(trace_child(record_many) == RECORDS);
+    trace_load(&header, records, RECORDS);
+    for (size_t i = 0; i < RECORDS; i++) {
+        assert(records[i].id == i + 1 && records[i].size == i);
+    }
+    return EXIT_SUCCESS;
+}
+
+int test_02_trace_fork() {
+    TraceRecord records[1];
+    TraceHeader header;
+
+    assert(trace_child(record_fork) == 1);
+    trace_load(&header, records, 1);
+    assert(records[0].size == 2);
+    return EXIT_SUCCESS;
+}
+
+/* Main execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s NUMBER\n\n", argv[0]);
+        fprintf(stderr, "Where NUMBER is right of the following:\n");
+        fprintf(stderr, "    0. Test trace_records\n");
+        fprintf(stderr, "    1. Test trace_flush\n");
+        fprintf(stderr, "    2. Test trace_fork\n");
+        return EXIT_FAILURE;
+    }
+
+    int number = atoi(argv[1]);
+    int status = EXIT_FAILURE;
+
+    switch (number) {
+        case 0:  status = test_00_trace_records(); break;
+        case 1:  status = test_01_trace_flush(); break;
+        case 2:  status = test_02_trace_fork(); break;
+        default: fprintf(stderr, "Unknown NUMBER: %d\n", number); break;
+    }
+
+    return status;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
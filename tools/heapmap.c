@@ -0,0 +1,239 @@
+/* heapmap.c: Render heap block maps written with MALLOC_HEAPMAP */
+
+#include "malloc/block.h"
+#include "malloc/heapmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define ROWS        32	    /* Default rows in the address map */
+#define COLUMNS     64	    /* Cells per address map row */
+#define CLASSES     48	    /* Power of two capacity classes */
+#define PINS        5	    /* Highest allocated blocks listed */
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [-c] [-r ROWS] MAP\n\n", program);
+    fprintf(stderr, "Render a heap map written with MALLOC_HEAPMAP=1 (at exit, or on the next\n");
+    fprintf(stderr, "allocator call after the MALLOC_HEAPMAP_SIGNAL signal).\n\n");
+    fprintf(stderr, "Regions are shown in the order they are walked: the main heap, the\n");
+    fprintf(stderr, "long-lived region (MALLOC_LIFETIME), then each chunk of the lines region\n");
+    fprintf(stderr, "(MALLOC_LINES).  Regions that were never used are not shown.\n\n");
+    fprintf(stderr, "    -c      Print the blocks as CSV instead\n");
+    fprintf(stderr, "    -r ROWS Number of rows in the address map (default %d)\n", ROWS);
+    exit(status);
+}
+
+size_t  class_of(uint64_t capacity) {
+    size_t c = 0;
+    while (c + 1 < CLASSES && (1UL << (c + 1)) <= capacity) {
+        c++;
+    }
+    return c;
+}
+
+void    print_csv(const HeapMapRecord *records, size_t n) {
+    printf("address,capacity,size,state\n");
+    for (size_t i = 0; i < n; i++) {
+        printf("0x%lx,%lu,%lu,%s\n", records[i].address, records[i].capacity, records[i].size,
+            records[i].allocated ? "used" : "free");
+    }
+}
+
+/**
+ * Render one contiguous region [records[first], records[last]) as rows of
+ * cells, each showing how much of its address range is in use:
+ *
+ *  '#' at least 3/4 used, '+' at least 1/4, '.' less, ' ' past the end.
+ **/
+void    print_region(const HeapMapRecord *records, size_t first, size_t last, size_t rows) {
+    uint64_t start  = records[first].address;
+    uint64_t end    = records[last - 1].address + sizeof(Block) + records[last - 1].capacity;
+    uint64_t cells  = rows * COLUMNS;
+    uint64_t span   = (end - start + cells - 1) / cells;
+    double * used   = calloc(cells, sizeof(double));
+    uint64_t blocks = 0, allocated = 0, free_blocks = 0, free_bytes = 0;
+
+    for (size_t i = first; i < last; i++) {
+        const HeapMapRecord *record = &records[i];
+        uint64_t lo = record->address - start;
+        uint64_t hi = lo + sizeof(Block) + record->capacity;
+
+        blocks++;
+        if (!record->allocated) {
+            free_blocks++;
+            free_bytes += record->capacity;
+            hi = lo + sizeof(Block);	/* Only the header is in use */
+        } else {
+            allocated += sizeof(Block) + record->capacity;
+        }
+
+        /* Spread the used bytes of the block over the cells it covers */
+        for (uint64_t c = lo / span; c < cells && c * span < hi; c++) {
+            uint64_t a = c * span > lo ? c * span : lo;
+            uint64_t b = (c + 1) * span < hi ? (c + 1) * span : hi;
+            used[c] += b - a;
+        }
+    }
+
+    printf("region 0x%lx-0x%lx: %lu KB, %lu blocks, %lu KB used, %lu free blocks (%lu KB)\n",
+        start, end, (end - start) / 1024, blocks, allocated / 1024, free_blocks, free_bytes / 1024);
+    printf("address map (%lu bytes per cell; '#' >= 75%% used, '+' >= 25%%, '.' less)\n", span);
+
+    for (uint64_t r = 0; r < rows && r * COLUMNS * span < end - start; r++) {
+        printf("  0x%012lx |", start + r * COLUMNS * span);
+        for (uint64_t c = r * COLUMNS; c < (r + 1) * COLUMNS; c++) {
+            double fraction = used[c] / span;
+            putchar(c * span >= end - start ? ' ' : fraction >= 0.75 ? '#' : fraction >= 0.25 ? '+' : '.');
+        }
+        printf("|\n");
+    }
+    printf("\n");
+    free(used);
+}
+
+/**
+ * List the highest allocated blocks, which keep everything free below them
+ * from being trimmed.
+ **/
+void    print_pins(const HeapMapRecord *records, size_t first, size_t last) {
+    uint64_t end     = records[last - 1].address + sizeof(Block) + records[last - 1].capacity;
+    uint64_t pinned  = 0;
+    size_t   top     = last;
+
+    for (size_t i = last; i > first; i--) {
+        if (records[i - 1].allocated) {
+            top = i - 1;
+            break;
+        }
+    }
+    if (top == last) {
+        printf("no allocated blocks: the whole region can be trimmed\n\n");
+        return;
+    }
+
+    for (size_t i = first; i < top; i++) {
+        pinned += records[i].allocated ? 0 : records[i].capacity;
+    }
+
+    printf("top of heap: %lu KB trimmable above the highest allocated block, %lu KB free below it\n",
+        (end - records[top].address - sizeof(Block) - records[top].capacity) / 1024, pinned / 1024);
+    printf("%20s %12s %12s %14s\n", "highest allocated", "capacity", "size", "from top (KB)");
+    for (size_t i = top + 1, n = 0; i > first && n < PINS; i--) {
+        const HeapMapRecord *record = &records[i - 1];
+        if (record->allocated) {
+            printf("  0x%016lx %12lu %12lu %14lu\n", record->address, record->capacity, record->size,
+                (end - record->address) / 1024);
+            n++;
+        }
+    }
+    printf("\n");
+}
+
+void    print_classes(const HeapMapRecord *records, size_t n) {
+    uint64_t used[CLASSES] = {0}, used_bytes[CLASSES] = {0};
+    uint64_t free[CLASSES] = {0}, free_bytes[CLASSES] = {0};
+
+    for (size_t i = 0; i < n; i++) {
+        size_t c = class_of(records[i].capacity);
+        if (records[i].allocated) {
+            used[c]++;
+            used_bytes[c] += records[i].capacity;
+        } else {
+            free[c]++;
+            free_bytes[c] += records[i].capacity;
+        }
+    }
+
+    printf("%12s %12s %12s %12s %12s\n", "capacity", "used", "used(KB)", "free", "free(KB)");
+    for (size_t c = 0; c < CLASSES; c++) {
+        if (used[c] || free[c]) {
+            printf("%12lu %12lu %12lu %12lu %12lu\n", 1UL << c, used[c], used_bytes[c] / 1024, free[c], free_bytes[c] / 1024);
+        }
+    }
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    bool   csv    = false;
+    size_t rows   = ROWS;
+    int    argind = 1;
+
+    while (argind < argc && argv[argind][0] == '-') {
+        char *flag = argv[argind++];
+        if (strcmp(flag, "-c") == 0) {
+            csv = true;
+        } else if (strcmp(flag, "-r") == 0 && argind < argc) {
+            rows = strtoul(argv[argind++], NULL, 10);
+        } else {
+            usage(argv[0], strcmp(flag, "-h") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (argind != argc - 1 || rows == 0) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    int fd = open(argv[argind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", argv[argind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (st.st_size < (off_t)sizeof(HeapMapHeader)) {
+        fprintf(stderr, "%s is not a heap map\n", argv[argind]);
+        return EXIT_FAILURE;
+    }
+
+    const HeapMapHeader *header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "Unable to mmap %s: %s\n", argv[argind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (header->magic != HEAPMAP_MAGIC || header->version != HEAPMAP_VERSION) {
+        fprintf(stderr, "%s is not a version %d heap map\n", argv[argind], HEAPMAP_VERSION);
+        return EXIT_FAILURE;
+    }
+
+    const HeapMapRecord *records  = (const HeapMapRecord *)(header + 1);
+    size_t               nrecords = (st.st_size - sizeof(HeapMapHeader)) / sizeof(HeapMapRecord);
+
+    if (csv) {
+        print_csv(records, nrecords);
+        return EXIT_SUCCESS;
+    }
+
+    printf("pid %u: %lu blocks%s\n\n", header->pid, nrecords,
+        header->complete ? "" : " (walk stopped early: heap map is partial)");
+
+    /* Regions are runs of physically adjacent blocks: the main heap, the
+     * long-lived region, then one per chunk of the lines region */
+    for (size_t first = 0, i = 1; i <= nrecords; i++) {
+        if (i == nrecords || records[i].address != records[i - 1].address + sizeof(Block) + records[i - 1].capacity) {
+            print_region(records, first, i, rows);
+            print_pins(records, first, i);
+            first = i;
+        }
+    }
+
+    if (nrecords) {
+        print_classes(records, nrecords);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
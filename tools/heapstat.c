@@ -0,0 +1,157 @@
+/* heapstat.c: Display live heap statistics of a running process */
+
+#include "malloc/stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [-c|-l] PID [INTERVAL [COUNT]]\n\n", program);
+    fprintf(stderr, "Attach to the stats page of a process running with MALLOC_STATS=1\n");
+    fprintf(stderr, "and print a row every INTERVAL seconds (rates are per second).\n\n");
+    fprintf(stderr, "    -c      Print per size class statistics instead of summary rows\n");
+    fprintf(stderr, "    -l      Print call latency percentiles (requires MALLOC_LATENCY=1)\n");
+    exit(status);
+}
+
+double  percent(uint64_t numerator, uint64_t denominator) {
+    return denominator ? (double)numerator / denominator * 100.0 : 0.0;
+}
+
+void    print_header() {
+    printf("%10s %10s %8s %8s %10s %8s %8s %10s %10s %8s %8s\n",
+        "mallocs/s", "frees/s", "grows/s", "shrink/s",
+        "heap(KB)", "blocks", "free", "free(KB)", "large(KB)", "int%", "ext%");
+}
+
+void    print_row(const StatsPage *curr, const StatsPage *prev) {
+    double elapsed = prev ? (curr->timestamp - prev->timestamp) / 1e9 : 0.0;
+
+    #define RATE(c) \
+        ((prev && elapsed > 0) ? (curr->counters[c] - prev->counters[c]) / elapsed : (double)curr->counters[c])
+
+    printf("%10.0lf %10.0lf %8.0lf %8.0lf %10lu %8lu %8lu %10lu %10lu %8.2lf %8.2lf\n",
+        RATE(MALLOCS), RATE(FREES), RATE(GROWS), RATE(SHRINKS),
+        curr->counters[HEAP_SIZE] / 1024,
+        curr->counters[BLOCKS],
+        curr->free_blocks,
+        curr->free_bytes / 1024,
+        curr->largest_free / 1024,
+        percent(curr->free_slack, curr->counters[HEAP_SIZE]),
+        curr->free_bytes ? 100.0 - percent(curr->largest_free, curr->free_bytes) : 0.0);
+
+    #undef RATE
+}
+
+void    print_classes(const StatsPage *page) {
+    printf("%12s %12s %12s %12s\n", "class", "mallocs", "frees", "live(B)");
+    for (size_t c = 0; c < STATS_CLASSES; c++) {
+        const SizeClassStats *class = &page->classes[c];
+        if (!class->mallocs) {
+            continue;
+        }
+        printf("%12lu %12lu %12lu %12lu\n", c ? 1UL<<c : 1UL, class->mallocs, class->frees, class->live);
+    }
+    printf("\n");
+}
+
+void    print_latency(const StatsPage *page) {
+    static const char *names[NOPERATIONS] = {"malloc", "free", "realloc", "calloc"};
+
+    printf("%12s %12s %12s %12s\n", "operation", "p50", "p99", "p99.9");
+    for (int op = 0; op < NOPERATIONS; op++) {
+        const Percentiles *p = &page->latency[op];
+        printf("%12s %12lu %12lu %12lu\n", names[op], p->p50, p->p99, p->p999);
+    }
+    printf("\n");
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    bool     classes  = false;
+    bool     latency  = false;
+    int      argind   = 1;
+
+    if (argind < argc && strcmp(argv[argind], "-c") == 0) {
+        classes = true;
+        argind++;
+    } else if (argind < argc && strcmp(argv[argind], "-l") == 0) {
+        latency = true;
+        argind++;
+    }
+
+    if (argind >= argc || strcmp(argv[argind], "-h") == 0) {
+        usage(argv[0], argind >= argc ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    int      pid      = atoi(argv[argind++]);
+    unsigned interval = argind < argc ? atoi(argv[argind++]) : 0;
+    long     count    = argind < argc ? atol(argv[argind++]) : (interval ? -1 : 1);
+
+    char path[64];
+    snprintf(path, sizeof(path), STATS_PATH, pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const StatsPage *page = mmap(NULL, sizeof(StatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "Unable to mmap %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (page->magic != STATS_MAGIC || page->version != STATS_VERSION) {
+        fprintf(stderr, "%s is not a version %d stats page\n", path, STATS_VERSION);
+        return EXIT_FAILURE;
+    }
+
+    // Pages of processes that left without running atexit handlers linger
+    if (kill(page->pid, 0) < 0 && errno == ESRCH) {
+        fprintf(stderr, "%s is stale (process %u no longer exists)\n", path, page->pid);
+    }
+
+    StatsPage curr, prev;
+    bool      first = true;
+
+    if (!classes && !latency) {
+        print_header();
+    }
+
+    for (long n = 0; count < 0 || n < count; n++) {
+        if (n) {
+            sleep(interval);
+        }
+
+        if (!stats_read(page, &curr)) {
+            fprintf(stderr, "Unable to read consistent stats from %s\n", path);
+            return EXIT_FAILURE;
+        }
+
+        if (classes) {
+            print_classes(&curr);
+        } else if (latency) {
+            print_latency(&curr);
+        } else {
+            print_row(&curr, first ? NULL : &prev);
+        }
+        fflush(stdout);
+
+        prev  = curr;
+        first = false;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,210 @@
+/* replay.c: Replay an allocation trace against the current allocator */
+
+#define _GNU_SOURCE
+
+#include "malloc/counters.h"
+#include "malloc/trace.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Allocator Hooks
+ *
+ * Resolved at run time, so the same binary can replay against any build (via
+ * LD_PRELOAD) and just reports "-" for metrics glibc does not provide.
+ **/
+
+typedef void   (*SnapshotFunction)(size_t counters[NCOUNTERS]);
+typedef double (*FragmentationFunction)();
+
+/* Functions */
+
+/**
+ * Return the resident set size of the process in bytes.
+ **/
+size_t  resident() {
+    size_t pages = 0, rss = 0;
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%lu %lu", &pages, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(statm);
+    }
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Return the peak resident set size of the process in bytes.
+ **/
+size_t  peak_resident() {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss * 1024 : 0;
+}
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s TRACE\n\n", program);
+    fprintf(stderr, "Replay a trace recorded with MALLOC_TRACE=path in recorded order.\n");
+    fprintf(stderr, "Select the allocator with LD_PRELOAD=lib/libmalloc-XX.so.\n\n");
+    fprintf(stderr, "peak rss is how far the resident set grew past what it was before the\n");
+    fprintf(stderr, "replay (covering every region and any mmap'd chunks); heap size and\n");
+    fprintf(stderr, "resizes (heap grows + shrinks, a proxy for system calls) come from the\n");
+    fprintf(stderr, "allocator's own counters and print '-' under glibc.\n");
+    exit(status);
+}
+
+double  now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 || strcmp(argv[1], "-h") == 0) {
+        usage(argv[0], argc != 2 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /* Map trace */
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(TraceHeader)) {
+        fprintf(stderr, "%s is not a trace\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    const TraceHeader *header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        fprintf(stderr, "Unable to mmap %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+        fprintf(stderr, "%s is not a version %d trace\n", argv[1], TRACE_VERSION);
+        return EXIT_FAILURE;
+    }
+
+    const TraceRecord *records  = (const TraceRecord *)(header + 1);
+    size_t             nrecords = (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+
+    /* Object table (outside the heap under test) */
+    uint32_t objects = 0;
+    for (size_t i = 0; i < nrecords; i++) {
+        if (records[i].id > objects) {
+            objects = records[i].id;
+        }
+    }
+
+    void **table = mmap(NULL, (objects + 1) * sizeof(void *), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        fprintf(stderr, "Unable to map object table: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    SnapshotFunction      snapshot = (SnapshotFunction)dlsym(RTLD_DEFAULT, "counters_snapshot");
+    FragmentationFunction internal = (FragmentationFunction)dlsym(RTLD_DEFAULT, "internal_fragmentation");
+    FragmentationFunction external = (FragmentationFunction)dlsym(RTLD_DEFAULT, "external_fragmentation");
+
+    // Fault the trace and object table in first, so only the heap's own
+    // growth counts toward peak rss
+    volatile uint64_t sum = 0;
+    for (size_t i = 0; i < nrecords; i++) {
+        sum += records[i].id;
+    }
+    memset(table, 0, (objects + 1) * sizeof(void *));
+
+    size_t before[NCOUNTERS] = {0};
+    size_t after[NCOUNTERS]  = {0};
+    if (snapshot) {
+        snapshot(before);
+    }
+
+    /* Replay in recorded order */
+    size_t    baseline = resident();
+    size_t    ops      = 0;
+    double    start    = now();
+
+    for (size_t i = 0; i < nrecords; i++) {
+        const TraceRecord *r = &records[i];
+        void *ptr = NULL;
+
+        switch (r->operation) {
+            case OP_MALLOC:
+                ptr = malloc(r->size);
+                break;
+            case OP_CALLOC:
+                ptr = calloc(1, r->size);
+                break;
+            case OP_REALLOC:
+                ptr = realloc(table[r->old], r->size);
+                table[r->old] = NULL;
+                break;
+            case OP_FREE:
+                if (!r->old) {
+                    continue;
+                }
+                free(table[r->old]);
+                table[r->old] = NULL;
+                break;
+            default:
+                continue;
+        }
+
+        if (r->id) {
+            table[r->id] = ptr;
+        } else if (ptr && r->operation != OP_REALLOC) {
+            free(ptr);
+        }
+        ops++;
+    }
+
+    double elapsed = now() - start;
+
+    if (snapshot) {
+        snapshot(after);
+    }
+
+    printf("records:     %lu\n", nrecords);
+    printf("operations:  %lu\n", ops);
+    printf("elapsed:     %.6lf\n", elapsed);
+    printf("ops/sec:     %.0lf\n", elapsed > 0 ? ops / elapsed : 0.0);
+    size_t peak = peak_resident();
+    printf("peak rss:    %lu\n", peak > baseline ? peak - baseline : 0);
+
+    if (snapshot) {
+        printf("heap size:   %lu\n", after[HEAP_SIZE]);
+        printf("resizes:     %lu\n", (after[GROWS] - before[GROWS]) + (after[SHRINKS] - before[SHRINKS]));
+    } else {
+        printf("heap size:   -\n");
+        printf("resizes:     -\n");
+    }
+
+    if (internal && external) {
+        printf("internal:    %4.2lf\n", internal());
+        printf("external:    %4.2lf\n", external());
+    } else {
+        printf("internal:    -\n");
+        printf("external:    -\n");
+    }
+    fflush(stdout);
+
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */
@@ -0,0 +1,236 @@
+/* sizeclass.c: Generate a size class table from a request size histogram */
+
+#include "malloc/block.h"
+#include "malloc/trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Constants */
+
+#define CLASSES     32
+#define MAX_SIZE    (1<<15)
+
+/* Globals */
+
+size_t  Max     = MAX_SIZE;
+double *Counts  = NULL;		/* Requests per aligned size / ALIGNMENT */
+
+/* Functions */
+
+void usage(const char *program, int status) {
+    fprintf(stderr, "Usage: %s [-n CLASSES] [-m MAX] INPUT > include/malloc/sizeclass.h\n\n", program);
+    fprintf(stderr, "INPUT is a trace recorded with MALLOC_TRACE=path or a text histogram of\n");
+    fprintf(stderr, "'SIZE COUNT' lines.  Chooses CLASSES size classes up to MAX that minimize\n");
+    fprintf(stderr, "the expected internal fragmentation of the input and prints them as a\n");
+    fprintf(stderr, "header of static tables (build with -DSIZE_CLASSES to use them).\n");
+    exit(status);
+}
+
+void add(size_t size, double count) {
+    if (size && size <= Max) {
+        Counts[ALIGN(size) / ALIGNMENT] += count;
+    }
+}
+
+bool load_trace(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(TraceHeader)) {
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    const TraceHeader *header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED || header->magic != TRACE_MAGIC) {
+        return false;
+    }
+
+    const TraceRecord *records  = (const TraceRecord *)(header + 1);
+    size_t             nrecords = (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    for (size_t i = 0; i < nrecords; i++) {
+        if (records[i].operation != OP_FREE) {
+            add(records[i].size, 1);
+        }
+    }
+    return true;
+}
+
+bool load_histogram(const char *path) {
+    FILE *fs = fopen(path, "r");
+    if (!fs) {
+        return false;
+    }
+
+    size_t size;
+    double count;
+    while (fscanf(fs, "%lu %lf", &size, &count) == 2) {
+        add(size, count);
+    }
+    fclose(fs);
+    return true;
+}
+
+/* Expected waste of a table, as a percentage of bytes handed out */
+double waste(const size_t *classes, size_t nclasses) {
+    double wasted = 0, total = 0;
+    size_t c = 0;
+    for (size_t i = 1; i <= Max / ALIGNMENT; i++) {
+        size_t size = i * ALIGNMENT;
+        while (c < nclasses && classes[c] < size) {
+            c++;
+        }
+        total  += Counts[i] * (c < nclasses ? classes[c] : size);
+        wasted += Counts[i] * ((c < nclasses ? classes[c] : size) - size);
+    }
+    return total ? wasted / total * 100.0 : 0.0;
+}
+
+/* Main Execution */
+
+int main(int argc, char *argv[]) {
+    size_t nclasses = CLASSES;
+    int    argind   = 1;
+
+    while (argind < argc && argv[argind][0] == '-') {
+        char *flag = argv[argind++];
+        if (strcmp(flag, "-n") == 0 && argind < argc) {
+            nclasses = strtoul(argv[argind++], NULL, 10);
+        } else if (strcmp(flag, "-m") == 0 && argind < argc) {
+            Max = ALIGN(strtoul(argv[argind++], NULL, 10));
+        } else {
+            usage(argv[0], strcmp(flag, "-h") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (argind != argc - 1 || nclasses < 1 || nclasses > 255 || Max < ALIGNMENT) {
+        usage(argv[0], EXIT_FAILURE);
+    }
+
+    Counts = calloc(Max / ALIGNMENT + 1, sizeof(double));
+    if (!load_trace(argv[argind]) && !load_histogram(argv[argind])) {
+        fprintf(stderr, "Unable to read %s: %s\n", argv[argind], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* Candidate class sizes: every size requested (the largest one closes the
+     * table; anything bigger is left unrounded) */
+    size_t  m      = 0;
+    size_t *sizes  = calloc(Max / ALIGNMENT + 1, sizeof(size_t));
+    double *counts = calloc(Max / ALIGNMENT + 1, sizeof(double));
+    for (size_t i = 1; i <= Max / ALIGNMENT; i++) {
+        if (Counts[i] > 0) {
+            sizes[m]  = i * ALIGNMENT;
+            counts[m] = Counts[i];
+            m++;
+        }
+    }
+    if (!m) {
+        fprintf(stderr, "No requests of at most %lu bytes in %s\n", Max, argv[argind]);
+        return EXIT_FAILURE;
+    }
+    nclasses = nclasses < m ? nclasses : m;
+
+    /* Prefix sums of counts and bytes, so the waste of a class covering
+     * sizes[i..j] is sizes[j] * C(i..j) - S(i..j) */
+    double *C = calloc(m + 1, sizeof(double));
+    double *S = calloc(m + 1, sizeof(double));
+    for (size_t j = 0; j < m; j++) {
+        C[j + 1] = C[j] + counts[j];
+        S[j + 1] = S[j] + counts[j] * sizes[j];
+    }
+    #define COST(i, j) (sizes[j] * (C[(j) + 1] - C[i]) - (S[(j) + 1] - S[i]))
+
+    /* best[k][j]: least waste covering sizes[0..j] with k + 1 classes, the last
+     * ending at sizes[j]; from[k][j] is where that last class starts */
+    double *best = malloc(nclasses * m * sizeof(double));
+    size_t *from = malloc(nclasses * m * sizeof(size_t));
+    for (size_t j = 0; j < m; j++) {
+        best[j] = COST(0, j);
+        from[j] = 0;
+    }
+    for (size_t k = 1; k < nclasses; k++) {
+        for (size_t j = 0; j < m; j++) {
+            best[k * m + j] = best[(k - 1) * m + j];
+            from[k * m + j] = SIZE_MAX;
+            for (size_t i = 1; i <= j; i++) {
+                double cost = best[(k - 1) * m + i - 1] + COST(i, j);
+                if (cost < best[k * m + j]) {
+                    best[k * m + j] = cost;
+                    from[k * m + j] = i;
+                }
+            }
+        }
+    }
+
+    /* Walk back from the last size to recover class boundaries */
+    size_t classes[256];
+    size_t n = 0;
+    for (ssize_t k = nclasses - 1, j = m - 1; j >= 0 && k >= 0; k--) {
+        size_t start = from[k * m + j];
+        if (start == SIZE_MAX) {
+            continue;	/* Fewer classes were just as good */
+        }
+        classes[n++] = sizes[j];
+        j = (ssize_t)start - 1;
+    }
+    for (size_t i = 0; i < n / 2; i++) {
+        size_t t = classes[i]; classes[i] = classes[n - 1 - i]; classes[n - 1 - i] = t;
+    }
+
+    size_t powers[64], npowers = 0;
+    for (size_t p = ALIGNMENT; p < classes[n - 1]; p <<= 1) {
+        powers[npowers++] = p;
+    }
+    powers[npowers++] = classes[n - 1];
+
+    /* Generated header */
+    printf("/* sizeclass.h: Size Class Table\n *\n * Generated by:");
+    for (int i = 0; i < argc; i++) {
+        printf(" %s", argv[i]);
+    }
+    printf("\n *\n * Libraries built with -DSIZE_CLASSES round requests up to these classes.\n *\n");
+    printf(" * Experimental and opt-in: only lib/libmalloc-ff-classes.so, a benchmark\n");
+    printf(" * library, is built with them.\n **/\n\n");
+    printf("#ifndef SIZECLASS_H\n#define SIZECLASS_H\n\n");
+    printf("#include <stddef.h>\n#include <stdint.h>\n\n");
+    printf("/* Expected internal fragmentation of the input: %.2lf%% with these %lu\n", waste(classes, n), n);
+    printf(" * classes, %.2lf%% with power of two classes. */\n\n", waste(powers, npowers));
+    printf("#define NSIZECLASSES    %lu\n", n);
+    printf("#define SIZE_CLASS_MAX  %lu\n\n", classes[n - 1]);
+
+    printf("static const size_t SizeClasses[NSIZECLASSES] = {");
+    for (size_t c = 0; c < n; c++) {
+        printf("%s%lu%s", c % 8 ? " " : "\n    ", classes[c], c + 1 < n ? "," : "");
+    }
+    printf("\n};\n\n");
+
+    printf("/* Class of each size, indexed by (size + %lu) / %lu */\n", ALIGNMENT - 1, ALIGNMENT);
+    printf("static const uint8_t SizeClassIndex[SIZE_CLASS_MAX / %lu + 1] = {", ALIGNMENT);
+    for (size_t i = 0, c = 0; i <= classes[n - 1] / ALIGNMENT; i++) {
+        while (c + 1 < n && classes[c] < i * ALIGNMENT) {
+            c++;
+        }
+        printf("%s%lu%s", i % 16 ? " " : "\n    ", c, i < classes[n - 1] / ALIGNMENT ? "," : "");
+    }
+    printf("\n};\n\n");
+
+    printf("/* Round size up to its class (sizes above SIZE_CLASS_MAX are unchanged) */\n");
+    printf("static inline size_t size_class_round(size_t size) {\n");
+    printf("    return size > SIZE_CLASS_MAX ? size : SizeClasses[SizeClassIndex[(size + %lu) / %lu]];\n", ALIGNMENT - 1, ALIGNMENT);
+    printf("}\n\n");
+    printf("#endif\n\n");
+    printf("/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */\n");
+
+    fprintf(stderr, "%lu classes: %.2lf%% expected internal fragmentation (power of two: %.2lf%%)\n",
+        n, waste(classes, n), waste(powers, npowers));
+    return EXIT_SUCCESS;
+}
+
+/* vim: set expandtab sts=4 sw=4 ts=8 ft=c: */